@@ -0,0 +1,29 @@
+// billboard.vert
+
+// Draws one billboard per instance, from a quad with corners at -1 and 1.
+// Each billboard is turned to face the eye, keeping its y axis horizontal.
+
+attribute vec2 corner;      // corner of the quad
+attribute vec4 instance;    // world position and half size of the billboard
+
+uniform mat4 projMat;
+uniform mat4 modelViewMat;   // the view matrix; the instances are in world space
+uniform vec3 eyePosWorld;
+
+varying vec3 modelPos;  // position in viewspace
+varying vec2 texPos;
+
+void main()
+{
+    vec3 zDir = normalize(eyePosWorld - instance.xyz);
+    vec3 yDir = cross(vec3(0.0, 0.0, 1.0), zDir);
+    yDir = dot(yDir, yDir) > 1e-8 ? normalize(yDir) : vec3(0.0, 1.0, 0.0);   // eye straight above or below
+    vec3 xDir = cross(yDir, zDir);
+
+    vec3 worldPos = instance.xyz + instance.w * (corner.x * xDir + corner.y * yDir);
+
+    gl_Position = projMat * modelViewMat * vec4(worldPos, 1.0);
+
+    modelPos = (modelViewMat * vec4(worldPos, 1.0)).xyz;
+    texPos = 0.5 * (corner + 1.0);
+}
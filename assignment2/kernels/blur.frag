@@ -0,0 +1,28 @@
+// blur.frag
+
+/*
+  One direction of a separable 9-tap gaussian blur; used to prefilter the
+  depth moments for variance shadow mapping.
+*/
+
+uniform sampler2D tex;
+uniform vec2 texelStep;     // (1/width, 0) for the horizontal pass, (0, 1/height) for the vertical one
+
+varying vec2 texPos;
+
+void main()
+{
+    const float w0 = 0.2270270270;
+    const float w1 = 0.1945945946;
+    const float w2 = 0.1216216216;
+    const float w3 = 0.0540540541;
+    const float w4 = 0.0162162162;
+
+    vec4 sum = w0 * texture2D(tex, texPos);
+    sum += w1 * (texture2D(tex, texPos + 1.0 * texelStep) + texture2D(tex, texPos - 1.0 * texelStep));
+    sum += w2 * (texture2D(tex, texPos + 2.0 * texelStep) + texture2D(tex, texPos - 2.0 * texelStep));
+    sum += w3 * (texture2D(tex, texPos + 3.0 * texelStep) + texture2D(tex, texPos - 3.0 * texelStep));
+    sum += w4 * (texture2D(tex, texPos + 4.0 * texelStep) + texture2D(tex, texPos - 4.0 * texelStep));
+
+    gl_FragColor = sum;
+}
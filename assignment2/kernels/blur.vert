@@ -0,0 +1,11 @@
+// blur.vert
+
+// Draws a quad given directly in clip space (-1 to 1) over the whole target.
+
+varying vec2 texPos;
+
+void main()
+{
+    gl_Position = vec4(gl_Vertex.xy, 0.0, 1.0);
+    texPos = 0.5 * (gl_Vertex.xy + 1.0);
+}
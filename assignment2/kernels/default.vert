@@ -14,6 +14,8 @@ uniform sampler2D displacementTex;
 uniform float displacementMapping;
 uniform float TesselationDepth;
 
+uniform mat4 projMat;
+uniform mat4 modelViewMat;
 uniform mat4 modelMat;
 uniform mat4 modelMatInvTrans;
 
@@ -23,8 +25,6 @@ varying vec3 modelPos;
 varying vec3 normal;
 varying vec2 texPos;
 
-varying vec4 glPos;
-
 void main()
 {
     // Render the shape using standard OpenGL position transforms.
@@ -52,11 +52,9 @@ void main()
     }//*/
     
     // Render the shape using modified position.
-    gl_Position = gl_ProjectionMatrix * gl_ModelViewMatrix *  vec4(modelPos,1);
+    gl_Position = projMat * modelViewMat * vec4(modelPos,1);
     
     // transform to world space
     modelPos = (modelMat * vec4(modelPos, 1)).xyz;
 	normal = normalize((modelMatInvTrans * vec4(normal, 0)).xyz);
-
-    glPos = gl_Position;
 }
@@ -21,12 +21,12 @@ void main()
     
     vec3 viewDir = normalize(modelPos - eyePosWorld);
     vec3 cubeMapTexcoord = vec3(viewDir.x, -viewDir.z, -viewDir.y);
-    vec3 color = texture(cubeMap, cubeMapTexcoord).xyz;
+    vec3 color = textureCube(cubeMap, cubeMapTexcoord).xyz;
 
 
     // fog
 
-    const vec3 fogColor = vec3(1/255.0, 27/255.0, 34/255.0);
+    const vec3 fogColor = vec3(1.0/255.0, 27.0/255.0, 34.0/255.0);
     
     float phi = acos(viewDir.z);
 
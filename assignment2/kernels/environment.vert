@@ -1,5 +1,7 @@
 // environment.vert
 
+uniform mat4 projMat;
+uniform mat4 modelViewMat;
 uniform mat4 modelMat;
 
 varying vec3 modelPos;
@@ -7,5 +9,5 @@ varying vec3 modelPos;
 void main()
 {
     modelPos = (modelMat * vec4(gl_Vertex.xyz, 1.0)).xyz;
-    gl_Position = gl_ProjectionMatrix * gl_ModelViewMatrix * vec4(gl_Vertex.xyz, 1.0);
+    gl_Position = projMat * modelViewMat * vec4(gl_Vertex.xyz, 1.0);
 }
@@ -1,58 +1,104 @@
+#version 140
+#extension GL_ARB_compatibility : enable
+// (1.40 for buffer textures; compatibility keeps gl_FrontMaterial and the other built-ins)
+
 // phong.frag
 
 /*
   This fragment implements the Phong Reflection model.
 */
 
+#extension GL_EXT_texture_array : enable
+
 // The input image we will be filtering in this kernel.
 uniform sampler2D normalTex;
 uniform sampler2D colorTex;
 uniform samplerCube cubeMap;
 uniform sampler2D reflTex;
-uniform sampler2D depthTex;     // for shadowmapping
+uniform sampler2DShadow depthTex;   // for shadowmapping; lookups compare against the given depth
 uniform float depthTexDu;
 uniform float depthTexDv;
 uniform sampler2D spotTex;      // for shadowmapping
+uniform sampler2D momentsTex;   // blurred depth moments, for variance shadow mapping
+
+// spotlight shadow filter: 0 = rotated Poisson disk PCF, 1 = variance shadow map, 2 = 9x9 grid PCF
+uniform float shadowFilter;
+#define MAX_SHADOW_TAPS 16
+uniform int shadowTaps;                         // Poisson disk taps used, up to MAX_SHADOW_TAPS
+uniform vec2 poissonDisk[MAX_SHADOW_TAPS];      // in the unit disk
+
+// cascaded shadow map of directional light 0 (the sun), one layer per slice of the view frustum
+#define NUM_CASCADES 3
+uniform sampler2DArrayShadow cascadeTex;
+uniform mat4 cascadeViewProjMat[NUM_CASCADES];  // viewProj matrix each layer was rendered with
+uniform float cascadeTexelSize;
+uniform float sunShadows;
 
 uniform vec3 eyePosWorld;
 
 // enables/disables features
-uniform float normalMapping;
+uniform float normalMapping;  // 2 if normalTex only holds x and y (BC5 compressed)
 uniform float colorMapping;
 uniform float cubeMapping;  // if false, then refl map is used (when rendering water)
-uniform float clipping;     // if true, everything above clipZ is clipped (when rendering mirrored scene)
-
-uniform float clipZ;
 
 uniform mat4 viewMat;               // for reflTex sampling
+uniform mat4 reflViewProjMat;       // viewProj (without translation) of the camera reflTex was last rendered for
 uniform mat4 lightViewProjMat;      // viewProj matrix of the shadow-casting light
 
-// point lights
-#define NUM_POINTLIGHTS 34
-uniform vec3 pointLightPos[NUM_POINTLIGHTS];
+// the lights, as records of LIGHT_TEXELS texels in lightTex (see LightBuffer.h):
+// position and radius, direction and type, diffuse color and ambient level,
+// specular color and shadow map. The first numGlobalLights (directional lights
+// and spotlights) light every fragment; the point lights after them are
+// binned into the clusters of the view frustum (see LightClusters.h).
+#define LIGHT_TEXELS 4.0
+#define DIRECTIONAL_LIGHT 0.0
+#define SUN_SHADOW 1.0
+#define SPOT_SHADOW 2.0
+uniform samplerBuffer lightTex;
+uniform int numGlobalLights;
+
+#define CLUSTER_TILES_X 16.0
+#define CLUSTER_TILES_Y 9.0
+#define CLUSTER_SLICES 24.0
+#define MAX_CLUSTER_LIGHTS 256
+uniform isamplerBuffer clusterTex;      // offset and count of each cluster's lights in clusterIndexTex
+uniform isamplerBuffer clusterIndexTex; // record numbers of the lights
+uniform mat4 clusterViewMat;
+uniform vec2 clusterViewport;
+uniform float clusterSliceNear;
+uniform float clusterSliceScale;
 
 
 varying vec3 modelPos;  // position in world space
 varying vec3 normal;    // normal in world space
 varying vec2 texPos;
 
-varying vec4 glPos;
+
+// Texel t of the record of light i.
+vec4 lightTexel(in float i, in float t) {
+    return texelFetch(lightTex, int(i * LIGHT_TEXELS + t));
+}
 
 
-vec3 pointLight(in vec3 lightSourcePos, in vec3 N, 
+vec3 pointLight(in float i, in vec3 N,
         in vec3 materialDiffuse, in vec3 materialSpecular, in float shininess) {
     
     // no ambient
 
-    vec3 lightDiffuse  = vec3(1.0, 0.7, 0.0);
-    vec3 lightSpecular = vec3(1.0, 0.7, 0.0);
+    vec4 positionRadius = lightTexel(i, 0.0);
+    vec3 lightSourcePos = positionRadius.xyz;
+    float distFactor = 1.0 - length(lightSourcePos-modelPos) / positionRadius.w;
+    if (distFactor <= 0.0) {
+        return vec3(0.0);
+    }
+
+    vec3 lightDiffuse  = lightTexel(i, 2.0).xyz;
+    vec3 lightSpecular = lightTexel(i, 3.0).xyz;
 
     vec3 Lm = normalize(lightSourcePos-modelPos);
 	vec3 Rm = normalize(reflect(-Lm,N));
 	vec3 V = normalize(eyePosWorld - modelPos);
 
-    float distFactor = max((1.0 - length(lightSourcePos-modelPos) / 50.0), 0.0);
-
 	vec3 colorDiffuse = clamp(max(dot(Lm,N),0.0)*materialDiffuse*lightDiffuse*distFactor,0.0,1.0);
     vec3 colorSpecular = clamp(pow(max(dot(Rm,V),0.0),shininess)*materialSpecular*lightSpecular*distFactor,0.0,1.0);
 
@@ -60,15 +106,87 @@ vec3 pointLight(in vec3 lightSourcePos, in vec3 N,
 }
 
 
+// Fraction of the spotlight that reaches a point, given where the point is in
+// the light's depth texture, its depth there and its distance to the light.
+// Every PCF tap is a hardware compare with bilinear filtering.
+float spotVisibility(in vec2 depthTexcoord, in float modelDepth, in float lightDist) {
+    const float bias = 0.00001;
+
+    if (shadowFilter > 1.5) {
+        float lit = 0.0;
+        for (int i = -4; i <= 4; i++) {
+            for (int j = -4; j <= 4; j++) {
+                vec2 texcoordOffset = vec2(float(i)*depthTexDu, float(j)*depthTexDv);
+                lit += shadow2D(depthTex, vec3(depthTexcoord + texcoordOffset, modelDepth - bias)).r;
+            }
+        }
+        return lit / 81.0;
+
+    } else if (shadowFilter > 0.5) {
+        // Chebyshev's upper bound on the lit fraction, with light bleeding reduced
+        const float minVariance = 0.25;
+        const float bleedReduction = 0.3;
+        vec2 moments = texture2D(momentsTex, depthTexcoord).xy;
+        if (lightDist <= 0.0) {
+            return 0.0;     // behind the light
+        }
+        if (lightDist <= moments.x) {
+            return 1.0;
+        }
+        float variance = max(moments.y - moments.x * moments.x, minVariance);
+        float d = lightDist - moments.x;
+        float pMax = variance / (variance + d * d);
+        return clamp((pMax - bleedReduction) / (1.0 - bleedReduction), 0.0, 1.0);
+
+    } else {
+        // the disk is rotated per pixel, trading banding for noise
+        const float radius = 4.0;   // in texels, same extent as the 9x9 grid
+        float angle = 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+        vec2 rotation = vec2(cos(angle), sin(angle));
+        vec2 scale = radius * vec2(depthTexDu, depthTexDv);
+
+        float lit = 0.0;
+        for (int i = 0; i < MAX_SHADOW_TAPS; i++) {
+            if (i >= shadowTaps) {
+                break;
+            }
+            vec2 p = poissonDisk[i];
+            vec2 offset = vec2(p.x*rotation.x - p.y*rotation.y, p.x*rotation.y + p.y*rotation.x) * scale;
+            lit += shadow2D(depthTex, vec3(depthTexcoord + offset, modelDepth - bias)).r;
+        }
+        return lit / float(shadowTaps);
+    }
+}
+
+
+// Fraction of the sun that reaches this point. The first cascade whose layer
+// covers the point is used (a cascade that was not re-rendered this frame may
+// not quite match its slice any more); points beyond the last one are lit.
+float sunVisibility() {
+    if (sunShadows < 0.0) {
+        return 1.0;
+    }
+    for (int i = 0; i < NUM_CASCADES; i++) {
+        vec3 p = (cascadeViewProjMat[i] * vec4(modelPos, 1.0)).xyz * 0.5 + 0.5;
+        if (all(greaterThan(p.xy, vec2(cascadeTexelSize))) && all(lessThan(p.xy, vec2(1.0 - cascadeTexelSize)))) {
+            // 4 bilinear compares, a texel apart
+            float h = 0.5 * cascadeTexelSize;
+            float lit = shadow2DArray(cascadeTex, vec4(p.x - h, p.y - h, float(i), p.z)).r;
+            lit += shadow2DArray(cascadeTex, vec4(p.x + h, p.y - h, float(i), p.z)).r;
+            lit += shadow2DArray(cascadeTex, vec4(p.x - h, p.y + h, float(i), p.z)).r;
+            lit += shadow2DArray(cascadeTex, vec4(p.x + h, p.y + h, float(i), p.z)).r;
+            return 0.25 * lit;
+        }
+    }
+    return 1.0;
+}
+
+
 #define PI 3.1415926535898
 
 
 void main()
 {
-    if (clipping > 0.0f && modelPos.z < clipZ) {
-        discard;
-    }
-
     // Sample from the normal map, if we're not doing displacement mapping
     vec3 N_old = normalize(normal);
     vec3 N = N_old;
@@ -98,6 +216,8 @@ void main()
 
         // perturb normal
         vec3 N_tbn = (2.*texture2D(normalTex, texPos).xyz - 1.);
+        if (normalMapping > 1.5)
+            N_tbn.z = sqrt(max(0., 1. - dot(N_tbn.xy, N_tbn.xy)));
         vec3 Nnew = normalize(N_tbn.x * T + N_tbn.y * B + N_tbn.z * N);
 
         N = Nnew;//normalize((N + Nnew) * 0.5);
@@ -128,7 +248,7 @@ void main()
 
 
 
-    vec3 color = (0.0, 0.0, 0.0);
+    vec3 color = vec3(0.0, 0.0, 0.0);
 
 
     // specular color due to environment map (or refl tex, in case of water)
@@ -137,18 +257,21 @@ void main()
         vec3 eyeToPosDir = normalize(modelPos - eyePosWorld);
         vec3 reflDir = reflect(eyeToPosDir, N);
         vec3 cubeMapTexcoord = vec3(reflDir.x, -reflDir.z, -reflDir.y);
-        vec3 envColor = texture(cubeMap, cubeMapTexcoord).xyz;
+        vec3 envColor = textureCube(cubeMap, cubeMapTexcoord).xyz;
 
         color += materialSpecular * envColor;
 
     } else {
         // calculate component of perturbed normal that's orthogonal to unperturbed normal
         vec3 flatN = N - dot(N, N_old)*N_old;
-        vec2 flatNView = viewMat * vec4(flatN, 0.0);
+        vec2 flatNView = (viewMat * vec4(flatN, 0.0)).xy;
         vec2 reflOffset = normalize(flatNView.xy) * length(flatN) * 0.025;
 
-        // sample reflTex with offset
-        vec2 screenTexcoord = 0.5 * (glPos.xy / glPos.w + 1.0);
+        // sample reflTex with offset. It may have been rendered a few frames ago, so look up
+        // the view direction to this point as that camera saw it; this treats the reflected
+        // scene as distant, which is exact for turning the camera.
+        vec4 reflPos = reflViewProjMat * vec4(modelPos - eyePosWorld, 0.0);
+        vec2 screenTexcoord = 0.5 * (reflPos.xy / reflPos.w + 1.0);
         vec3 reflColor = texture2D(reflTex, screenTexcoord + reflOffset).xyz;
         
         color += materialSpecular * reflColor;
@@ -157,52 +280,52 @@ void main()
 
     // lights
 
-    // directional light 0
-    {
-        vec3 lightDirection = gl_LightSource[0].spotDirection;
-        vec3 lightAmbient  = gl_LightSource[0].ambient.xyz;
-        vec3 lightDiffuse  = gl_LightSource[0].diffuse.xyz;
-        vec3 lightSpecular = gl_LightSource[0].specular.xyz;
+    // directional lights and spotlights. The sun is shadowed by its cascades;
+    // the spotlight by its shadow map, and it projects spotTex. There is one of
+    // each map, so they are looked up once, whichever lights use them.
 
-	    vec3 Lm = -normalize(lightDirection);
-	    vec3 Rm = normalize(reflect(-Lm,N));
-	    vec3 V = normalize(eyePosWorld - modelPos);
-
-	    vec3 colorAmbient = materialAmbient*lightAmbient;
-	    vec3 colorDiffuse = clamp(max(dot(Lm,N),0.0)*materialDiffuse*lightDiffuse,0.0,1.0);
-        vec3 colorSpecular = clamp(pow(max(dot(Rm,V),0.0),shininess)*materialSpecular*lightSpecular,0.0,1.0);
+    float sunLit = sunVisibility();
 
-        color += (colorAmbient + colorDiffuse + colorSpecular);
-    }
-
-    // directional light 1
-    {
-        vec3 lightDirection = gl_LightSource[1].spotDirection;
-        vec3 lightAmbient  = gl_LightSource[1].ambient.xyz;
-        vec3 lightDiffuse  = gl_LightSource[1].diffuse.xyz;
-        vec3 lightSpecular = gl_LightSource[1].specular.xyz;
+    // calculate spotcolor using depthTex and spotTex
+    vec4 lightProjcoord = lightViewProjMat * vec4(modelPos, 1.0);
+    vec3 lightProjcoordNormalized = lightProjcoord.xyz / lightProjcoord.w;
+        
+    vec2 depthTexcoord = (lightProjcoordNormalized.xy + 1.0) * 0.5;
+    float modelDepth = (lightProjcoordNormalized.z + 1.0) * 0.5;    // convert from [-1,1] to [0,1]
 
-	    vec3 Lm = -normalize(lightDirection);
+    // lightProjcoord.w is the distance along the light's view direction
+    float occludeFactor = spotVisibility(depthTexcoord, modelDepth, lightProjcoord.w);
+        
+    vec3 spotColor = occludeFactor * texture2D(spotTex, depthTexcoord).xyz;
+
+    for (int i = 0; i < numGlobalLights; i++) {
+        vec4 positionRadius = lightTexel(float(i), 0.0);
+        vec4 directionType = lightTexel(float(i), 1.0);
+        vec4 diffuseAmbient = lightTexel(float(i), 2.0);
+        vec4 specularShadow = lightTexel(float(i), 3.0);
+
+        vec3 lightAmbient  = vec3(diffuseAmbient.w);
+        vec3 lightDiffuse  = diffuseAmbient.xyz;
+        vec3 lightSpecular = specularShadow.xyz;
+
+        vec3 Lm;
+        if (directionType.w == DIRECTIONAL_LIGHT) {
+            Lm = -normalize(directionType.xyz);
+        } else {
+            Lm = normalize(positionRadius.xyz-modelPos);
+        }
 	    vec3 Rm = normalize(reflect(-Lm,N));
 	    vec3 V = normalize(eyePosWorld - modelPos);
 
-	    vec3 colorAmbient = materialAmbient*lightAmbient;
-	    vec3 colorDiffuse = clamp(max(dot(Lm,N),0.0)*materialDiffuse*lightDiffuse,0.0,1.0);
-        vec3 colorSpecular = clamp(pow(max(dot(Rm,V),0.0),shininess)*materialSpecular*lightSpecular,0.0,1.0);
-
-        color += (colorAmbient + colorDiffuse + colorSpecular);
-    }
-
-    // directional light 2
-    {
-        vec3 lightDirection = gl_LightSource[2].spotDirection;
-        vec3 lightAmbient  = gl_LightSource[2].ambient.xyz;
-        vec3 lightDiffuse  = gl_LightSource[2].diffuse.xyz;
-        vec3 lightSpecular = gl_LightSource[2].specular.xyz;
-
-	    vec3 Lm = -normalize(lightDirection);
-	    vec3 Rm = normalize(reflect(-Lm,N));
-	    vec3 V = normalize(eyePosWorld - modelPos);
+        if (specularShadow.w == SUN_SHADOW) {
+            lightDiffuse *= sunLit;
+            lightSpecular *= sunLit;
+        } else if (specularShadow.w == SPOT_SHADOW) {
+            // distance attenuation
+            float distFactor = max((1.0 - length(positionRadius.xyz-modelPos) / positionRadius.w), 0.0);
+            lightDiffuse *= spotColor * distFactor;
+            lightSpecular *= spotColor * distFactor;
+        }
 
 	    vec3 colorAmbient = materialAmbient*lightAmbient;
 	    vec3 colorDiffuse = clamp(max(dot(Lm,N),0.0)*materialDiffuse*lightDiffuse,0.0,1.0);
@@ -211,68 +334,30 @@ void main()
         color += (colorAmbient + colorDiffuse + colorSpecular);
     }
 
-    // spotlight 3
-    {
-        vec3 lightSourcePos = gl_LightSource[3].position.xyz;
-        vec3 lightDirection = gl_LightSource[3].spotDirection;
-        //float spotCutoff = gl_LightSource[3].spotCutoff;
-
-        vec3 lightAmbient  = gl_LightSource[3].ambient.xyz;
-        vec3 lightDiffuse  = gl_LightSource[3].diffuse.xyz;
-        vec3 lightSpecular = gl_LightSource[3].specular.xyz;
-
-        vec3 Lm = normalize(lightSourcePos-modelPos);
-	    vec3 Rm = normalize(reflect(-Lm,N));
-        vec3 toEye = eyePosWorld - modelPos;
-	    vec3 V = normalize(toEye);
-
-
-        // calculate spotcolor using depthTex and spotTex
-
-        vec4 lightProjcoord = lightViewProjMat * vec4(modelPos, 1.0);
-        vec3 lightProjcoordNormalized = lightProjcoord.xyz / lightProjcoord.w;
-        
-        vec2 depthTexcoord = (lightProjcoordNormalized.xy + 1.0) * 0.5;
-        float modelDepth = (lightProjcoordNormalized.z + 1.0) * 0.5;    // convert from [-1,1] to [0,1]
 
-        // PCF
-        float occludeFactor = 0.0;
-        const float bias = 0.00001;
-        
-        for (int i = -4; i <= 4; i++) {
-            for (int j = -4; j <= 4; j++) {
-                vec2 texcoordOffset = vec2(i*depthTexDu, j*depthTexDv);
-                float occluderDepth = texture2D(depthTex, depthTexcoord + texcoordOffset).x;     // is in [0,1]
-                occludeFactor += (modelDepth <= occluderDepth + bias ? 1.0 : 0.0);
+    // pointlights, only those of this fragment's cluster; there are none beyond the last slice
+    
+    float viewDepth = -(clusterViewMat * vec4(modelPos, 1.0)).z;
+    float slice = floor(max(log(viewDepth / clusterSliceNear), 0.0) * clusterSliceScale);
+    if (slice < CLUSTER_SLICES) {
+        vec2 tile = floor(gl_FragCoord.xy / clusterViewport * vec2(CLUSTER_TILES_X, CLUSTER_TILES_Y));
+        tile = clamp(tile, vec2(0.0), vec2(CLUSTER_TILES_X - 1.0, CLUSTER_TILES_Y - 1.0));
+        int clusterIndex = int((slice * CLUSTER_TILES_Y + tile.y) * CLUSTER_TILES_X + tile.x);
+        ivec2 cluster = texelFetch(clusterTex, clusterIndex).xy;
+
+        for (int i = 0; i < MAX_CLUSTER_LIGHTS; i++) {
+            if (i >= cluster.y) {
+                break;
             }
+            int lightIndex = texelFetch(clusterIndexTex, cluster.x + i).x;
+            color += pointLight(float(lightIndex), N, materialDiffuse, materialSpecular, shininess);
         }
-        occludeFactor /= 81.0f;
-        
-        vec3 spotColor = occludeFactor * texture2D(spotTex, depthTexcoord).xyz;
-
-
-        // distance attenuation
-        float distFactor = max((1.0 - length(lightSourcePos-modelPos) / 5000.0), 0.0);
-        spotColor *= distFactor;
-
-	    vec3 colorAmbient = materialAmbient*lightAmbient;
-	    vec3 colorDiffuse = clamp(max(dot(Lm,N),0.0)*materialDiffuse*lightDiffuse*spotColor,0.0,1.0);
-        vec3 colorSpecular = clamp(pow(max(dot(Rm,V),0.0),shininess)*materialSpecular*lightSpecular*spotColor,0.0,1.0);
-
-	    color += (colorAmbient + colorDiffuse + colorSpecular);
-    }
-
-
-    // pointlights
-    
-    for (int i = 0; i < NUM_POINTLIGHTS; i++) {
-        color += pointLight(pointLightPos[i], N, materialDiffuse, materialSpecular, shininess);
     }
 
 
 
     // apply fog
-    const vec3 fogColor = vec3(1/255.0, 27/255.0, 34/255.0);
+    const vec3 fogColor = vec3(1.0/255.0, 27.0/255.0, 34.0/255.0);
     const float fogStartDist = 0.0;
     const float fogRange = 750.0;
     
@@ -2,10 +2,17 @@
 
 // shadow.frag
 
-layout(location=0) out float depth;
+// The PCF filters only use the depth buffer. For variance shadow mapping a
+// color buffer is attached as well, which receives the first two moments of
+// the depth seen by the light. They are stored as view-space distances
+// (1/gl_FragCoord.w), since post-projection depth is far too nonlinear to
+// square in floating point.
+layout(location=0) out vec2 moments;
 
 void main()
 {
-    //gl_FragColor = vec4(0, 0, 0, 0);
-    depth = gl_FragCoord.z;
+    float depth = 1.0 / gl_FragCoord.w;
+    float dx = dFdx(depth);
+    float dy = dFdy(depth);
+    moments = vec2(depth, depth * depth + 0.25 * (dx * dx + dy * dy));
 }
@@ -1,6 +1,9 @@
 // shadow.vert
 
+uniform mat4 projMat;
+uniform mat4 modelViewMat;
+
 void main()
 {
-    gl_Position = gl_ProjectionMatrix * gl_ModelViewMatrix * vec4(gl_Vertex.xyz, 1.0);
+    gl_Position = projMat * modelViewMat * vec4(gl_Vertex.xyz, 1.0);
 }
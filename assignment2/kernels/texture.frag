@@ -2,29 +2,19 @@
 
 uniform sampler2D colorTex;
 
-uniform float clipping;
-uniform float clipZ;
-
 uniform float alphaScale;
 
 
 varying vec3 modelPos;  // position in viewspace
 varying vec2 texPos;
 
-varying vec3 modelPosWorld;
-
 
 void main()
 {
-    if (clipping > 0.0f && modelPosWorld.z < clipZ) {
-        discard;
-    }
-
-
     vec4 colorAlpha = texture2D(colorTex, texPos);
 
     // apply fog
-    const vec3 fogColor = vec3(1/255.0, 27/255.0, 34/255.0);
+    const vec3 fogColor = vec3(1.0/255.0, 27.0/255.0, 34.0/255.0);
     const float fogStartDist = 0.0;
     const float fogRange = 750.0;
     
@@ -1,18 +1,15 @@
 // texture.vert
 
-uniform mat4 modelMat;
+uniform mat4 projMat;
+uniform mat4 modelViewMat;
 
 varying vec3 modelPos;
 varying vec2 texPos;
 
-varying vec3 modelPosWorld;
-
 void main()
 {
-    gl_Position = gl_ProjectionMatrix * gl_ModelViewMatrix * vec4(gl_Vertex.xyz, 1.0);
+    gl_Position = projMat * modelViewMat * vec4(gl_Vertex.xyz, 1.0);
 
-    modelPos = (gl_ModelViewMatrix * vec4(gl_Vertex.xyz, 1.0)).xyz;
+    modelPos = (modelViewMat * vec4(gl_Vertex.xyz, 1.0)).xyz;
     texPos = gl_MultiTexCoord0.xy;
-
-    modelPosWorld = (modelMat * vec4(gl_Vertex.xyz, 1.0)).xyz;
 }
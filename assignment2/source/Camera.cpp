@@ -132,4 +132,38 @@ glm::mat4 Camera::getProj() const {
 
 glm::mat4 Camera::getViewProj() const {
 	return proj * getView();
+}
+
+float Camera::getNearPlane() const {
+    return nearPlane;
+}
+
+void Camera::getSliceBoundingSphere(float sliceNear, float sliceFar, glm::vec3& center, float& radius) const {
+    // the corners of the slice at distance d are d*k away from the look axis;
+    // the center is on the axis, as far from the near corners as from the far ones
+    float tanHalfFovy = glm::tan(glm::radians(fovy) * 0.5f);
+    float k2 = tanHalfFovy * tanHalfFovy * (1.0f + aspect * aspect);
+    float c = glm::min(0.5f * (sliceNear + sliceFar) * (1.0f + k2), sliceFar);
+    center = position - c * lookNeg;
+    radius = glm::sqrt((sliceFar - c) * (sliceFar - c) + sliceFar * sliceFar * k2);
+}
+
+glm::mat4 Camera::getObliqueProj(const glm::mat4& proj, const glm::vec4& viewPlane) {
+    // corner of the frustum opposite the new near plane, in view space; scale
+    // the plane so that the far plane still passes through it (Lengyel,
+    // "Oblique View Frustum Depth Projection and Clipping")
+    glm::vec4 q;
+    q.x = ((viewPlane.x > 0.0f ? 1.0f : (viewPlane.x < 0.0f ? -1.0f : 0.0f)) + proj[2][0]) / proj[0][0];
+    q.y = ((viewPlane.y > 0.0f ? 1.0f : (viewPlane.y < 0.0f ? -1.0f : 0.0f)) + proj[2][1]) / proj[1][1];
+    q.z = -1.0f;
+    q.w = (1.0f + proj[2][2]) / proj[3][2];
+    glm::vec4 c = viewPlane * (2.0f / glm::dot(viewPlane, q));
+
+    // the third row of the matrix computes clip-space z
+    glm::mat4 oblique = proj;
+    oblique[0][2] = c.x;
+    oblique[1][2] = c.y;
+    oblique[2][2] = c.z + 1.0f;
+    oblique[3][2] = c.w;
+    return oblique;
 }
\ No newline at end of file
@@ -45,6 +45,18 @@ public:
     glm::mat4 getProj() const;
 	glm::mat4 getViewProj() const;
 
+    float getNearPlane() const;
+
+    // smallest sphere around the part of the view frustum between the
+    // distances sliceNear and sliceFar along the look direction, in world
+    // space. Its radius only depends on the lens, not on the camera's pose.
+    void getSliceBoundingSphere(float sliceNear, float sliceFar, glm::vec3& center, float& radius) const;
+
+    // proj with its near plane replaced by viewPlane (a plane in view space,
+    // with the eye on its negative side), so that the hardware clips away
+    // everything on the negative side of the plane
+    static glm::mat4 getObliqueProj(const glm::mat4& proj, const glm::vec4& viewPlane);
+
 private:
 	void updateProj();
 	void orthonormalize();
@@ -0,0 +1,27 @@
+#include "Frustum.h"
+
+Frustum::Frustum(const glm::mat4& viewProj) {
+    // a clip-space point is inside when -w <= x,y,z <= w; each bound is a plane
+    // given by row 3 of the matrix plus or minus row 0, 1 or 2
+    glm::vec4 rows[4];
+    for (int r = 0; r < 4; r++) {
+        rows[r] = glm::vec4(viewProj[0][r], viewProj[1][r], viewProj[2][r], viewProj[3][r]);
+    }
+    for (int k = 0; k < 3; k++) {
+        planes[2*k] = rows[3] + rows[k];
+        planes[2*k+1] = rows[3] - rows[k];
+    }
+}
+
+bool Frustum::intersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const {
+    for (int i = 0; i < 6; i++) {
+        // test the corner of the box furthest along the plane normal
+        glm::vec3 corner(planes[i].x >= 0.0f ? boxMax.x : boxMin.x,
+                         planes[i].y >= 0.0f ? boxMax.y : boxMin.y,
+                         planes[i].z >= 0.0f ? boxMax.z : boxMin.z);
+        if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
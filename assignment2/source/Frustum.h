@@ -0,0 +1,19 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// The six clipping planes of a view-projection matrix, used to skip objects
+// that cannot appear in a pass. The planes are extracted in world space when
+// given proj * view, so world-space boxes can be tested directly.
+class Frustum {
+public:
+    Frustum(const glm::mat4& viewProj);
+
+    // false if the axis-aligned box lies entirely outside one of the planes.
+    // Boxes that straddle a corner of the frustum may be reported as visible.
+    bool intersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+
+private:
+    // plane i keeps the points p with dot(planes[i], vec4(p, 1)) >= 0
+    glm::vec4 planes[6];
+};
@@ -0,0 +1,87 @@
+#include "Headless.h"
+
+#include <stdio.h>
+
+#ifdef __linux__
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLSurface surface = EGL_NO_SURFACE;
+static EGLContext context = EGL_NO_CONTEXT;
+
+bool CreateHeadlessContext(int width, int height) {
+    // prefer Mesa's surfaceless platform, which needs neither X nor a GPU
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        printf("headless: could not initialize EGL\n");
+        return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        printf("headless: EGL %d.%d does not support desktop OpenGL\n", major, minor);
+        return false;
+    }
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+        printf("headless: no EGL config for an RGBA8 pbuffer with a 24-bit depth buffer\n");
+        return false;
+    }
+
+    const EGLint surfaceAttribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+    if (surface == EGL_NO_SURFACE) {
+        printf("headless: could not create a %dx%d pbuffer\n", width, height);
+        return false;
+    }
+
+    // a compatibility context, since the renderer uses the fixed-function matrices
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context)) {
+        printf("headless: could not create an OpenGL context\n");
+        return false;
+    }
+    return true;
+}
+
+void DestroyHeadlessContext() {
+    if (display == EGL_NO_DISPLAY)
+        return;
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (context != EGL_NO_CONTEXT)
+        eglDestroyContext(display, context);
+    if (surface != EGL_NO_SURFACE)
+        eglDestroySurface(display, surface);
+    eglTerminate(display);
+    display = EGL_NO_DISPLAY;
+    surface = EGL_NO_SURFACE;
+    context = EGL_NO_CONTEXT;
+}
+
+#else
+
+bool CreateHeadlessContext(int width, int height) {
+    printf("headless rendering needs EGL, which is only used on Linux\n");
+    return false;
+}
+
+void DestroyHeadlessContext() {
+}
+
+#endif
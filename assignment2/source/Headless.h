@@ -0,0 +1,13 @@
+#pragma once
+
+// An OpenGL context without a window, for rendering on machines that have no
+// display (or no GPU, with Mesa's llvmpipe). It draws into an offscreen
+// width x height default framebuffer, so the renderer and STImage::Read()
+// work exactly as they do with a GLUT window.
+//
+// Uses EGL, so it is only available on Linux; elsewhere
+// CreateHeadlessContext() prints why and returns false.
+
+bool CreateHeadlessContext(int width, int height);
+
+void DestroyHeadlessContext();
@@ -0,0 +1,46 @@
+#include "LightBuffer.h"
+
+#include <algorithm>
+
+LightBuffer::LightBuffer()
+    : globalLights(0), buffer(GL_RGBA32F, 4 * sizeof(float)) {
+}
+
+void LightBuffer::clear() {
+    records.clear();
+    globalLights = 0;
+}
+
+int LightBuffer::add(const Light& light) {
+    int index = numLights();
+    if (light.type != POINT) {
+        globalLights = index + 1;
+    }
+    const float record[4 * TEXELS_PER_LIGHT] = {
+        light.position.x, light.position.y, light.position.z, light.radius,
+        light.direction.x, light.direction.y, light.direction.z, (float)light.type,
+        light.diffuse.r, light.diffuse.g, light.diffuse.b, light.ambient,
+        light.specular.r, light.specular.g, light.specular.b, (float)light.shadow
+    };
+    records.insert(records.end(), record, record + 4 * TEXELS_PER_LIGHT);
+    return index;
+}
+
+int LightBuffer::update() {
+    if (records == uploaded && buffer.capacity() > 0)
+        return 0;
+
+    // only the texels from the first changed record on
+    size_t same = std::mismatch(records.begin(), records.begin() + (std::min)(records.size(), uploaded.size()),
+                                uploaded.begin()).first - records.begin();
+    int texels = buffer.upload(records.empty() ? NULL : &records[0], (int)records.size() / 4, (int)(same / 4));
+
+    uploaded = records;
+    return texels;
+}
+
+void LightBuffer::bind(STShaderProgram* shader, int unit) const {
+    buffer.bind(unit);
+    shader->SetTexture("lightTex", unit);
+    shader->SetUniformInt("numGlobalLights", globalLights);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "stglew.h"
+#include "TextureBuffer.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Every light of the scene as a typed record in one float buffer texture, which
+// all passes and shaders read their lights from. The records are built on the
+// CPU each frame, and the buffer is only written when they changed, from the
+// first changed texel on.
+//
+// A record is TEXELS_PER_LIGHT RGBA texels of lightTex (see TextureBuffer.h):
+//  - position, radius
+//  - direction, type
+//  - diffuse color, ambient level
+//  - specular color, shadow
+// The lights that reach every fragment (directional lights and spotlights)
+// must be added first; shaders loop over those and find the point lights
+// after them through LightClusters, whose indices are record numbers.
+class LightBuffer {
+public:
+    enum Type { DIRECTIONAL, SPOT, POINT };
+    // the shadow map a light is shadowed by
+    enum Shadow { NO_SHADOW, SUN_SHADOW, SPOT_SHADOW };
+    enum { TEXELS_PER_LIGHT = 4 };
+
+    struct Light {
+        Type type;
+        glm::vec3 position;     // spotlights and point lights
+        glm::vec3 direction;    // directional lights and spotlights
+        float radius;           // nothing further away is lit (spotlights and point lights)
+        glm::vec3 diffuse;
+        glm::vec3 specular;
+        float ambient;          // gray level of ambient light
+        Shadow shadow;
+    };
+
+    LightBuffer();
+
+    // Start the list of lights over.
+    void clear();
+
+    // Add a light to the list; returns its record number.
+    int add(const Light& light);
+
+    // Upload the records if they changed since the last upload. Call once a
+    // frame, after adding every light. Returns the number of texels uploaded.
+    int update();
+
+    // Bind lightTex to unit and set the uniforms of the bound shader.
+    void bind(STShaderProgram* shader, int unit) const;
+
+    int numLights() const { return (int)(records.size() / (4 * TEXELS_PER_LIGHT)); }
+    int numGlobalLights() const { return globalLights; }
+
+private:
+    std::vector<float> records;
+    std::vector<float> uploaded;    // what the buffer holds
+    int globalLights;
+
+    TextureBuffer buffer;
+};
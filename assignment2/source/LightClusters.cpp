@@ -0,0 +1,105 @@
+#include "LightClusters.h"
+
+#include <algorithm>
+#include <math.h>
+
+// the first depth slice reaches from the eye to just past this distance; thin
+// slices closer to the eye would hardly ever hold a fragment
+static const float SLICE_NEAR = 5.0f;
+
+LightClusters::LightClusters()
+    : sliceNear(SLICE_NEAR), sliceScale(1.0f), clusterLights(NUM_CLUSTERS), maxCount(0), dropped(0),
+      gridBuffer(GL_RG32I, 2 * sizeof(int)), indexBuffer(GL_R32I, sizeof(int)) {
+}
+
+void LightClusters::build(const std::vector<glm::vec4>& lights, int firstIndex, const glm::mat4& view, const glm::mat4& proj, float farDist) {
+    this->view = view;
+    float nearDist = proj[3][2] / (proj[2][2] - 1.0f);
+    sliceScale = SLICES / logf(farDist / sliceNear);
+
+    // half the width and height of the view at depth 1
+    float tanX = 1.0f / proj[0][0];
+    float tanY = 1.0f / proj[1][1];
+
+    for (int k = 0; k < NUM_CLUSTERS; k++) {
+        clusterLights[k].clear();
+    }
+
+    for (size_t l = 0; l < lights.size(); l++) {
+        glm::vec3 c = glm::vec3(view * glm::vec4(glm::vec3(lights[l]), 1.0f));
+        float r = lights[l].w;
+        float d = -c.z;
+        if (d + r <= nearDist || d - r >= farDist)
+            continue;
+        float dMin = (std::max)(d - r, nearDist);
+        float dMax = (std::min)(d + r, farDist);
+
+        // screen extent of the box around the sphere, in units of the view's half width and height
+        float xMin = (std::min)((c.x - r) / dMin, (c.x - r) / dMax) / tanX;
+        float xMax = (std::max)((c.x + r) / dMin, (c.x + r) / dMax) / tanX;
+        float yMin = (std::min)((c.y - r) / dMin, (c.y - r) / dMax) / tanY;
+        float yMax = (std::max)((c.y + r) / dMin, (c.y + r) / dMax) / tanY;
+        if (xMin >= 1.0f || xMax <= -1.0f || yMin >= 1.0f || yMax <= -1.0f)
+            continue;
+        int tx0 = (std::max)((int)floorf((xMin * 0.5f + 0.5f) * TILES_X), 0);
+        int tx1 = (std::min)((int)floorf((xMax * 0.5f + 0.5f) * TILES_X), TILES_X - 1);
+        int ty0 = (std::max)((int)floorf((yMin * 0.5f + 0.5f) * TILES_Y), 0);
+        int ty1 = (std::min)((int)floorf((yMax * 0.5f + 0.5f) * TILES_Y), TILES_Y - 1);
+        int s0 = (std::max)((int)floorf(logf(dMin / sliceNear) * sliceScale), 0);
+        int s1 = (std::min)((int)floorf(logf(dMax / sliceNear) * sliceScale), SLICES - 1);
+
+        for (int s = s0; s <= s1; s++) {
+            float z0 = s == 0 ? 0.0f : sliceNear * expf(s / sliceScale);
+            float z1 = sliceNear * expf((s + 1) / sliceScale);
+            float dz = d < z0 ? z0 - d : (d > z1 ? d - z1 : 0.0f);
+            for (int ty = ty0; ty <= ty1; ty++) {
+                float y0 = (2.0f * ty / TILES_Y - 1.0f) * tanY;
+                float y1 = (2.0f * (ty + 1) / TILES_Y - 1.0f) * tanY;
+                float yLo = (std::min)(y0 * z0, y0 * z1);
+                float yHi = (std::max)(y1 * z0, y1 * z1);
+                float dy = c.y < yLo ? yLo - c.y : (c.y > yHi ? c.y - yHi : 0.0f);
+                for (int tx = tx0; tx <= tx1; tx++) {
+                    // distance from the light to the box around the cluster
+                    float x0 = (2.0f * tx / TILES_X - 1.0f) * tanX;
+                    float x1 = (2.0f * (tx + 1) / TILES_X - 1.0f) * tanX;
+                    float xLo = (std::min)(x0 * z0, x0 * z1);
+                    float xHi = (std::max)(x1 * z0, x1 * z1);
+                    float dx = c.x < xLo ? xLo - c.x : (c.x > xHi ? c.x - xHi : 0.0f);
+                    if (dx * dx + dy * dy + dz * dz < r * r)
+                        clusterLights[(s * TILES_Y + ty) * TILES_X + tx].push_back(firstIndex + (int)l);
+                }
+            }
+        }
+    }
+
+    // flatten the lists
+    grid.resize(2 * NUM_CLUSTERS);
+    indices.clear();
+    maxCount = 0;
+    dropped = 0;
+    for (int k = 0; k < NUM_CLUSTERS; k++) {
+        unsigned int count = (unsigned int)clusterLights[k].size();
+        maxCount = (std::max)(maxCount, count);
+        if (count > MAX_CLUSTER_LIGHTS) {
+            dropped += count - MAX_CLUSTER_LIGHTS;
+            count = MAX_CLUSTER_LIGHTS;
+        }
+        grid[2*k] = (int)indices.size();
+        grid[2*k+1] = (int)count;
+        indices.insert(indices.end(), clusterLights[k].begin(), clusterLights[k].begin() + count);
+    }
+}
+
+void LightClusters::bind(STShaderProgram* shader, int firstUnit, int viewportWidth, int viewportHeight) {
+    gridBuffer.upload(&grid[0], NUM_CLUSTERS);
+    indexBuffer.upload(indices.empty() ? NULL : &indices[0], (int)indices.size());
+    gridBuffer.bind(firstUnit);
+    indexBuffer.bind(firstUnit + 1);
+
+    shader->SetTexture("clusterTex", firstUnit);
+    shader->SetTexture("clusterIndexTex", firstUnit + 1);
+    shader->SetUniformMatrix("clusterViewMat", &view[0][0]);
+    shader->SetUniform("clusterViewport", (float)viewportWidth, (float)viewportHeight);
+    shader->SetUniform("clusterSliceNear", sliceNear);
+    shader->SetUniform("clusterSliceScale", sliceScale);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "stglew.h"
+#include "TextureBuffer.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Point lights binned into the clusters of a view frustum, for clustered
+// forward shading. The frustum is cut into TILES_X x TILES_Y screen tiles and
+// SLICES depth slices (exponentially spaced, so clusters are roughly cubes),
+// and each cluster gets the list of lights whose sphere of influence touches
+// it. phong.frag finds the cluster of a fragment and only loops over its list.
+//
+// The lists live in integer buffer textures (see TextureBuffer.h):
+//  - clusterTex (RG): offset and count in the index list of each cluster,
+//    tile by tile across the screen, then slice by slice
+//  - clusterIndexTex (R): light indices, cluster after cluster
+// The lights themselves are records in LightBuffer's lightTex.
+class LightClusters {
+public:
+    enum { TILES_X = 16, TILES_Y = 9, SLICES = 24, NUM_CLUSTERS = TILES_X * TILES_Y * SLICES };
+    // lights beyond this many in one cluster are dropped (and counted)
+    enum { MAX_CLUSTER_LIGHTS = 256 };
+
+    LightClusters();
+
+    // Bin the lights (xyz = world position, w = radius) into the clusters
+    // of view and proj, up to farDist along the view direction. proj must be
+    // a symmetric perspective projection (not an oblique one). Light i is
+    // listed as firstIndex + i, its record number in the LightBuffer.
+    void build(const std::vector<glm::vec4>& lights, int firstIndex, const glm::mat4& view, const glm::mat4& proj, float farDist);
+
+    // Upload the lists and set the uniforms of the bound shader, with the
+    // two buffer textures on units firstUnit and firstUnit+1.
+    void bind(STShaderProgram* shader, int firstUnit, int viewportWidth, int viewportHeight);
+
+    // stats of the last build()
+    unsigned int numLightRefs() const { return (unsigned int)indices.size(); }
+    unsigned int maxClusterLights() const { return maxCount; }
+    unsigned int numDroppedRefs() const { return dropped; }
+
+private:
+    glm::mat4 view;
+    float sliceNear;
+    float sliceScale;       // slices per unit of log(depth / sliceNear)
+
+    std::vector<std::vector<int> > clusterLights;
+    std::vector<int> grid;          // offset and count of each cluster
+    std::vector<int> indices;
+    unsigned int maxCount;
+    unsigned int dropped;
+
+    TextureBuffer gridBuffer;
+    TextureBuffer indexBuffer;
+};
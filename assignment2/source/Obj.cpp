@@ -15,18 +15,26 @@ Obj::Obj() :
     name(),
     stMeshes(),
     centerOfMass(),
-    defaultWorldMat(),
-    worldMat()
+    defaultTransform(),
+    worldMat(),
+    normalMat(),
+    transform(),
+    matricesValid(false),
+    boundsValid(false)
 {
 }
 
-Obj::Obj(const std::string& filename) :
+Obj::Obj(const std::string& filename, const glm::mat4* mat) :
     stMeshes(),
     centerOfMass(),
-    defaultWorldMat(),
-    worldMat()
+    defaultTransform(),
+    worldMat(),
+    normalMat(),
+    transform(),
+    matricesValid(false),
+    boundsValid(false)
 {
-    read(filename);
+    read(filename, mat);
 }
 
 Obj::~Obj() {
@@ -36,11 +44,19 @@ Obj::~Obj() {
     }
 }
 
-bool Obj::read(const std::string& filename) {
+bool Obj::read(const std::string& filename, const glm::mat4* mat) {
+    if (!load(filename, mat)) {
+        return false;
+    }
+    upload();
+    return true;
+}
+
+bool Obj::load(const std::string& filename, const glm::mat4* mat) {
     int pos = filename.find_last_of('.');
     name = filename.substr(0, pos);
 
-    std::string err = STTriangleMesh::LoadObj(stMeshes, filename);
+    std::string err = STTriangleMesh::LoadObjData(stMeshes, filename);
     if (err.length() > 0) {
         std::cout << "Load obj error: " << err;
         return false;
@@ -48,71 +64,99 @@ bool Obj::read(const std::string& filename) {
     STPoint3 cmSt = STTriangleMesh::GetMassCenter(stMeshes);
     centerOfMass = glm::vec3(cmSt.x, cmSt.y, cmSt.z);
     
-    if (!readWorldMatrix()) {
-        // no default matrix file was found; use bbcenter-to-origin translation matrix as default
-        std::cout << name << " has no mat file, using default" << std::endl;
+    if (!mat) {
+        // no default matrix in the scene; use bbcenter-to-origin translation matrix as default
+        std::cout << name << " has no matrix, using default" << std::endl;
+        setTransform(Transform());
         centerAtOrigin();
-        defaultWorldMat = worldMat;
+        defaultTransform = transform;
     } else {
-        std::cout << name << " mat file found" << std::endl;
+        defaultTransform = Transform(*mat);
+        setTransform(defaultTransform);
     }
     return true;
 }
 
-bool Obj::readWorldMatrix() {
-    std::string matFileName = name;
-    matFileName.append(".txt");
-    std::ifstream in(matFileName.c_str(), std::ios::in);
-    if( !in ){
-        return false;
-    }
-
-    float values[16];
-    for (int i=0; i<16; i+=4) {
-        in >> values[i] >> values[i+1] >> values[i+2] >> values[i+3];
+void Obj::upload() {
+    for (size_t i=0; i<stMeshes.size(); i++) {
+        stMeshes[i]->UploadBuffers();
+        stMeshes[i]->UploadTextures();
     }
-    defaultWorldMat = glm::mat4(values[0], values[1], values[2], values[3],
-    values[4], values[5], values[6], values[7],
-    values[8], values[9], values[10], values[11],
-    values[12], values[13], values[14], values[15]);
-    
-    in.close();
-
-    worldMat = defaultWorldMat;
-
-    return true;
 }
 
-bool Obj::writeWorldMatrix() {
-    std::string matFileName = name;
-    matFileName.append(".txt");
-    std::ofstream out(matFileName.c_str(), std::ios::out);
-    if (!out) {
-        std::cout << "cannot open file" << matFileName << std::endl;
-        return false;
-    }
-    float* values = glm::value_ptr(worldMat);
-    for (int i=0; i<16; i+=4) {
-        out << values[i] << " " << values[i+1] << " " << values[i+2] << " " << values[i+3] << std::endl;
-    }
-    out.close();
-
-    std::cout << matFileName << " written" << std::endl;
-    return true;
+void Obj::setTransform(const Transform& newTransform) {
+    transform = newTransform;
+    matricesValid = false;
 }
 
 void Obj::resetWorldMatrix() {
-    worldMat = defaultWorldMat;
+    setTransform(defaultTransform);
 }
 
 void Obj::centerAtOrigin() {
-    glm::vec4 worldCm = worldMat * glm::vec4(centerOfMass, 1.0f);
+    glm::vec3 worldCm = transform.translation + transform.rotation * (transform.scale * centerOfMass);
     printf("center was at %f, %f %f\n", worldCm.x, worldCm.y, worldCm.z);
-    worldMat = glm::translate(-glm::vec3(worldCm)) * worldMat;
+    translate(-worldCm);
 }
 
 void Obj::rotateCenter(glm::vec3& axis, float deg) {
-    glm::vec4 center = worldMat * glm::vec4(centerOfMass, 1.0f);
-    glm::vec3 translateToOrigin = -glm::vec3(center);
-    worldMat = glm::translate(-translateToOrigin) * glm::rotate(deg, axis) * glm::translate(translateToOrigin) * worldMat;
-}
\ No newline at end of file
+    glm::vec3 center = transform.translation + transform.rotation * (transform.scale * centerOfMass);
+    glm::quat turn = glm::angleAxis(deg, axis);
+    transform.rotation = glm::normalize(turn * transform.rotation);
+    transform.translation = center + turn * (transform.translation - center);
+    matricesValid = false;
+}
+
+void Obj::translate(const glm::vec3& offset) {
+    transform.translation += offset;
+    matricesValid = false;
+}
+
+void Obj::scaleBy(float factor) {
+    transform.translation *= factor;
+    transform.scale *= factor;
+    matricesValid = false;
+}
+
+bool Obj::updateMatrices() {
+    if (matricesValid) {
+        return false;
+    }
+    worldMat = transform.matrix();
+    normalMat = transform.normalMatrix();
+    matricesValid = true;
+    return true;
+}
+
+bool Obj::updateBounds() {
+    if (boundsValid && worldMat == boundsWorldMat && meshBoundsMin.size() == stMeshes.size()) {
+        return false;
+    }
+    meshBoundsMin.resize(stMeshes.size());
+    meshBoundsMax.resize(stMeshes.size());
+    for (size_t i=0; i<stMeshes.size(); i++) {
+        // transform the center and the half extents of the object-space box;
+        // the world box has to contain the rotated extents
+        const STPoint3& bbMin = stMeshes[i]->mBoundingBoxMin;
+        const STPoint3& bbMax = stMeshes[i]->mBoundingBoxMax;
+        glm::vec3 center(0.5f * (bbMin.x + bbMax.x), 0.5f * (bbMin.y + bbMax.y), 0.5f * (bbMin.z + bbMax.z));
+        glm::vec3 extent(0.5f * (bbMax.x - bbMin.x), 0.5f * (bbMax.y - bbMin.y), 0.5f * (bbMax.z - bbMin.z));
+
+        glm::vec3 worldCenter = glm::vec3(worldMat * glm::vec4(center, 1.0f));
+        glm::vec3 worldExtent;
+        for (int r = 0; r < 3; r++) {
+            worldExtent[r] = fabs(worldMat[0][r]) * extent.x + fabs(worldMat[1][r]) * extent.y + fabs(worldMat[2][r]) * extent.z;
+        }
+        meshBoundsMin[i] = worldCenter - worldExtent;
+        meshBoundsMax[i] = worldCenter + worldExtent;
+
+        boundsMin = (i == 0) ? meshBoundsMin[i] : glm::min(boundsMin, meshBoundsMin[i]);
+        boundsMax = (i == 0) ? meshBoundsMax[i] : glm::max(boundsMax, meshBoundsMax[i]);
+    }
+    if (stMeshes.empty()) {
+        boundsMin = boundsMax = glm::vec3(worldMat[3]);
+    }
+    boundsWorldMat = worldMat;
+    boundsValid = true;
+    return true;
+}
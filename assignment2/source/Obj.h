@@ -1,6 +1,7 @@
 #pragma once
 
 #include "STTriangleMesh.h"
+#include "Transform.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -11,23 +12,67 @@ class Obj {
 
 public:
     Obj();
-    Obj(const std::string& filename);
+    Obj(const std::string& filename, const glm::mat4* mat = NULL);
     ~Obj();
 
-    bool read(const std::string& filename);
+    // Read the meshes of an obj file and place them with mat, which
+    // also becomes the default transform. Without one, the obj is
+    // centered at the origin.
+    bool read(const std::string& filename, const glm::mat4* mat = NULL);
+
+    // read() in two steps: load() may run on any thread, upload() must
+    // then run on the OpenGL thread.
+    bool load(const std::string& filename, const glm::mat4* mat = NULL);
+    void upload();
+
+    // Move the obj in the world. The world and normal matrices below are
+    // only recomputed by the next updateMatrices().
+    void setTransform(const Transform& newTransform);
+    const Transform& getTransform() const { return transform; }
 
-    bool readWorldMatrix();
-    bool writeWorldMatrix();
     void resetWorldMatrix();
 
     void centerAtOrigin();
 
     void rotateCenter(glm::vec3& axis, float deg);
 
+    void translate(const glm::vec3& offset);
+
+    // scale about the world origin
+    void scaleBy(float factor);
+
+    // recompute worldMat and normalMat if the transform changed since the
+    // last call. Returns true if they were recomputed.
+    bool updateMatrices();
+
+    // recompute the world-space bounds below if worldMat (or the number of
+    // meshes) changed since the last call; cheap otherwise. Returns true if
+    // the bounds were recomputed, i.e. the obj moved.
+    bool updateBounds();
+
     std::string name;
     std::vector<STTriangleMesh*> stMeshes;
     glm::vec3 centerOfMass;
 
-    glm::mat4 defaultWorldMat;
+    Transform defaultTransform;
+
+    // transform.matrix() and transform.normalMatrix(), valid after
+    // updateMatrices()
     glm::mat4 worldMat;
+    glm::mat4 normalMat;
+
+    // world-space axis-aligned bounds of the whole obj and of each mesh,
+    // valid after updateBounds()
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    std::vector<glm::vec3> meshBoundsMin;
+    std::vector<glm::vec3> meshBoundsMax;
+
+private:
+    Transform transform;
+    bool matricesValid;
+
+    // worldMat the bounds were computed with
+    glm::mat4 boundsWorldMat;
+    bool boundsValid;
 };
@@ -0,0 +1,396 @@
+#include "SceneFile.h"
+
+#include "STMappedFile.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* const HEADER = "scanline-scene 1";
+static const char* const lightTypeNames[] = { "directional", "spot", "point" };
+
+// the whole file, or false if it cannot be opened
+static bool readFile(const std::string& filename, std::string& text) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    text.resize(size > 0 ? size : 0);
+    size_t numRead = size > 0 ? fread(&text[0], 1, size, file) : 0;
+    fclose(file);
+    text.resize(numRead);
+    return true;
+}
+
+// Read up to n floats from s, advancing it past them; returns how many were read.
+static int readFloats(const char*& s, float* values, int n) {
+    for (int i = 0; i < n; i++) {
+        char* end;
+        values[i] = strtof(s, &end);
+        if (end == s) {
+            return i;
+        }
+        s = end;
+    }
+    return n;
+}
+
+static int readFloats(const std::string& text, float* values, int n) {
+    const char* s = text.c_str();
+    return readFloats(s, values, n);
+}
+
+// the next word of s, advancing it past the word
+static std::string readWord(const char*& s) {
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+    const char* start = s;
+    while (*s && *s != ' ' && *s != '\t') {
+        s++;
+    }
+    return std::string(start, s);
+}
+
+// true if s has nothing left but spaces
+static bool atEnd(const char* s) {
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+    return *s == '\0';
+}
+
+// Write the shortest of %.6g to %.9g that reads back as exactly value.
+static void writeFloat(FILE* file, float value) {
+    char text[32];
+    for (int precision = 6; ; precision++) {
+        sprintf(text, "%.*g", precision, value);
+        if (precision == 9 || strtof(text, NULL) == value) {
+            break;
+        }
+    }
+    fprintf(file, " %s", text);
+}
+
+static SceneFile::Light makeLight(SceneFile::LightType type) {
+    SceneFile::Light light;
+    light.type = type;
+    light.az = light.el = 0.0f;
+    light.scale = 1.0f;
+    light.color = glm::vec3(1.0f);
+    light.position = glm::vec3(0.0f);
+    return light;
+}
+
+SceneFile::SceneFile() :
+    hasCamera(false),
+    cameraPos(),
+    cameraLook()
+{
+}
+
+bool SceneFile::read(const std::string& filename) {
+    std::string text;
+    if (!readFile(filename, text)) {
+        printf("cannot open scene file %s\n", filename.c_str());
+        return false;
+    }
+    objects.clear();
+    lights.clear();
+    settings.clear();
+    hasCamera = false;
+
+    if (text.compare(0, strlen(HEADER), HEADER) != 0) {
+        return readLegacy(filename, text);
+    }
+    return parse(filename, text);
+}
+
+bool SceneFile::parse(const std::string& filename, const std::string& text) {
+    int lineNumber = 0;
+    size_t lineStart = 0;
+    std::string line;
+    while (lineStart < text.size()) {
+        size_t lineEnd = text.find('\n', lineStart);
+        if (lineEnd == std::string::npos) {
+            lineEnd = text.size();
+        }
+        line.assign(text, lineStart, lineEnd - lineStart);
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.resize(line.size() - 1);
+        }
+        lineStart = lineEnd + 1;
+        lineNumber++;
+
+        const char* s = line.c_str();
+        std::string record = readWord(s);
+        if (lineNumber == 1 || record.empty() || record[0] == '#') {
+            continue;
+        }
+
+        bool ok = true;
+        float values[16];
+        if (record == "camera") {
+            ok = readFloats(s, values, 6) == 6;
+            if (ok) {
+                hasCamera = true;
+                cameraPos = glm::vec3(values[0], values[1], values[2]);
+                cameraLook = glm::vec3(values[3], values[4], values[5]);
+            }
+        } else if (record == "object") {
+            while (*s == ' ' || *s == '\t') {
+                s++;
+            }
+            Object object;
+            object.path = s;
+            object.hasWorldMat = false;
+            ok = !object.path.empty();
+            s += object.path.size();
+            objects.push_back(object);
+        } else if (record == "matrix") {
+            ok = !objects.empty() && readFloats(s, values, 16) == 16;
+            if (ok) {
+                objects.back().hasWorldMat = true;
+                objects.back().worldMat = glm::mat4(
+                    values[0], values[1], values[2], values[3],
+                    values[4], values[5], values[6], values[7],
+                    values[8], values[9], values[10], values[11],
+                    values[12], values[13], values[14], values[15]);
+            }
+        } else if (record == "light") {
+            std::string type = readWord(s);
+            int t = 0;
+            while (t < 3 && type != lightTypeNames[t]) {
+                t++;
+            }
+            ok = t < 3 && readFloats(s, values, 6) == 6;
+            if (ok) {
+                Light light = makeLight((LightType)t);
+                light.az = values[0];
+                light.el = values[1];
+                light.scale = values[2];
+                light.color = glm::vec3(values[3], values[4], values[5]);
+                if (light.type == LIGHT_SPOT) {
+                    ok = readFloats(s, values, 3) == 3;
+                    light.position = glm::vec3(values[0], values[1], values[2]);
+                }
+                lights.push_back(light);
+            }
+        } else if (record == "set") {
+            std::string name = readWord(s);
+            char* end;
+            long value = strtol(s, &end, 10);
+            ok = !name.empty() && end != s;
+            s = end;
+            settings.push_back(std::make_pair(name, (int)value));
+        } else {
+            ok = false;
+        }
+
+        if (!ok || !atEnd(s)) {
+            printf("%s:%d: cannot read \"%s\"\n", filename.c_str(), lineNumber, line.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+//
+// A list of .obj files, one per line, with the rest of the scene in
+// camera.txt, light0.txt, light1.txt, ... and a matrix file next to each mesh.
+//
+bool SceneFile::readLegacy(const std::string& filename, const std::string& text) {
+    std::string contents;
+    size_t lineStart = 0;
+    while (lineStart < text.size()) {
+        size_t lineEnd = text.find('\n', lineStart);
+        if (lineEnd == std::string::npos) {
+            lineEnd = text.size();
+        }
+        Object object;
+        object.path.assign(text, lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        if (!object.path.empty() && object.path[object.path.size() - 1] == '\r') {
+            object.path.resize(object.path.size() - 1);
+        }
+        if (object.path.empty()) {
+            continue;
+        }
+
+        float values[16];
+        std::string matFileName = object.path.substr(0, object.path.find_last_of('.')) + ".txt";
+        object.hasWorldMat = readFile(matFileName, contents) && readFloats(contents, values, 16) == 16;
+        if (object.hasWorldMat) {
+            object.worldMat = glm::mat4(
+                values[0], values[1], values[2], values[3],
+                values[4], values[5], values[6], values[7],
+                values[8], values[9], values[10], values[11],
+                values[12], values[13], values[14], values[15]);
+        }
+        objects.push_back(object);
+    }
+
+    float values[6];
+    if (readFile("camera.txt", contents) && readFloats(contents, values, 6) == 6) {
+        hasCamera = true;
+        cameraPos = glm::vec3(values[0], values[1], values[2]);
+        cameraLook = glm::vec3(values[3], values[4], values[5]);
+    }
+
+    // lights 0-2 are directional and 3 is the spotlight, over the helicopter;
+    // they exist without a file. The rest are point lights.
+    for (int i = 0; ; i++) {
+        Light light = makeLight(i < 3 ? LIGHT_DIRECTIONAL : i == 3 ? LIGHT_SPOT : LIGHT_POINT);
+        if (i == 3) {
+            light.position = glm::vec3(-28.2751f, 253.996f, 67.9616f);
+        } else if (i > 3) {
+            light.color = glm::vec3(1.0f, 0.7f, 0.0f);
+        }
+        char lightFileName[32];
+        sprintf(lightFileName, "light%d.txt", i);
+        if (readFile(lightFileName, contents) && readFloats(contents, values, 3) == 3) {
+            light.az = values[0];
+            light.el = values[1];
+            light.scale = values[2];
+        } else if (i > 3) {
+            break;
+        }
+        lights.push_back(light);
+    }
+
+    printf("%s: read %d objects and %d lights from the separate scene files\n", filename.c_str(),
+        (int)objects.size(), (int)lights.size());
+    return true;
+}
+
+bool SceneFile::write(const std::string& filename) const {
+    std::string tmpFilename = filename + ".tmp";
+    FILE* file = fopen(tmpFilename.c_str(), "wb");
+    if (!file) {
+        printf("cannot open %s\n", tmpFilename.c_str());
+        return false;
+    }
+
+    fprintf(file, "%s\n", HEADER);
+    if (hasCamera) {
+        fprintf(file, "camera");
+        for (int i = 0; i < 3; i++) {
+            writeFloat(file, cameraPos[i]);
+        }
+        for (int i = 0; i < 3; i++) {
+            writeFloat(file, cameraLook[i]);
+        }
+        fprintf(file, "\n");
+    }
+    for (size_t i = 0; i < objects.size(); i++) {
+        fprintf(file, "object %s\n", objects[i].path.c_str());
+        if (objects[i].hasWorldMat) {
+            fprintf(file, "matrix");
+            for (int c = 0; c < 4; c++) {
+                for (int r = 0; r < 4; r++) {
+                    writeFloat(file, objects[i].worldMat[c][r]);
+                }
+            }
+            fprintf(file, "\n");
+        }
+    }
+    for (size_t i = 0; i < lights.size(); i++) {
+        const Light& light = lights[i];
+        fprintf(file, "light %s", lightTypeNames[light.type]);
+        writeFloat(file, light.az);
+        writeFloat(file, light.el);
+        writeFloat(file, light.scale);
+        for (int j = 0; j < 3; j++) {
+            writeFloat(file, light.color[j]);
+        }
+        if (light.type == LIGHT_SPOT) {
+            for (int j = 0; j < 3; j++) {
+                writeFloat(file, light.position[j]);
+            }
+        }
+        fprintf(file, "\n");
+    }
+    for (size_t i = 0; i < settings.size(); i++) {
+        fprintf(file, "set %s %d\n", settings[i].first.c_str(), settings[i].second);
+    }
+
+    bool ok = STMappedFile::CommitFile(file, tmpFilename, filename);
+    if (!ok) {
+        printf("cannot write %s\n", filename.c_str());
+    }
+    return ok;
+}
+
+
+SceneSaver::SceneSaver() :
+    pending(false),
+    writing(false),
+    quit(false)
+{
+}
+
+SceneSaver::~SceneSaver() {
+    if (!worker.joinable()) {
+        return;
+    }
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    saveRequested.notify_one();
+    worker.join();
+}
+
+void SceneSaver::save(const SceneFile& scene, const std::string& filename) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingScene = scene;
+        pendingFilename = filename;
+        pending = true;
+    }
+    // started on the first save, so a scene that is never saved costs no thread
+    if (!worker.joinable()) {
+        worker = std::thread(&SceneSaver::workerLoop, this);
+    }
+    saveRequested.notify_one();
+}
+
+void SceneSaver::finish() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (pending || writing) {
+        saveDone.wait(lock);
+    }
+}
+
+void SceneSaver::workerLoop() {
+    for (;;) {
+        SceneFile scene;
+        std::string filename;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!quit && !pending) {
+                saveRequested.wait(lock);
+            }
+            if (!pending) {
+                return;
+            }
+            std::swap(scene, pendingScene);
+            filename.swap(pendingFilename);
+            pending = false;
+            writing = true;
+        }
+        if (scene.write(filename)) {
+            printf("%s saved\n", filename.c_str());
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            writing = false;
+        }
+        saveDone.notify_all();
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Everything a scene is made of: its objects and their world matrices, its
+// lights, the starting camera and the render settings. It is kept in one text
+// file, one record per line (see README.txt), which is read in one pass:
+//
+//   scanline-scene 1
+//   camera -79.98 408.19 30.94 0.615 -0.788 -0.035
+//   object meshes2/water/water.obj
+//   matrix 910.591 0 0 0 0 910.591 0 0 0 0 910.591 0 -3743.3 -3672.3 -28 1
+//   light directional 0 88.75 0.106 1 1 1
+//   light spot 3 -147.5 4.5 1 1 1 -28.2751 253.996 67.9616
+//   light point 12 -3 25 1 0.7 0
+//   set shadowFilter 0
+//
+// Scenes from before this format, a list of .obj files with camera.txt, the
+// lightN.txt files and a <mesh>.txt matrix file next to each mesh, are still
+// read, and are written in this format when saved.
+class SceneFile {
+public:
+    enum LightType { LIGHT_DIRECTIONAL, LIGHT_SPOT, LIGHT_POINT };
+
+    struct Object {
+        std::string path;
+        bool hasWorldMat;       // without one, the obj is centered at the origin
+        glm::mat4 worldMat;
+    };
+
+    struct Light {
+        LightType type;
+        float az;               // x, y, z position of a point light
+        float el;
+        float scale;
+        glm::vec3 color;
+        glm::vec3 position;     // spotlights only
+    };
+
+    SceneFile();
+
+    // Replace the contents with the scene in filename. Prints what is wrong
+    // with the file and returns false if it cannot be read.
+    bool read(const std::string& filename);
+
+    // Write the scene to filename, replacing it atomically: readers see the
+    // old file or the new one, never a partly written one.
+    bool write(const std::string& filename) const;
+
+    std::vector<Object> objects;
+    std::vector<Light> lights;
+    bool hasCamera;
+    glm::vec3 cameraPos;
+    glm::vec3 cameraLook;
+    std::vector<std::pair<std::string, int> > settings;
+
+private:
+    bool parse(const std::string& filename, const std::string& text);
+    bool readLegacy(const std::string& filename, const std::string& text);
+};
+
+// Writes scenes on a thread of its own, so saving does not hold up the frame.
+// Saves are done in order, and a save requested while one is being written
+// replaces any other that is still waiting.
+class SceneSaver {
+public:
+    SceneSaver();
+
+    // Waits for the last save to be written.
+    ~SceneSaver();
+
+    void save(const SceneFile& scene, const std::string& filename);
+
+    // Return once every requested save has been written.
+    void finish();
+
+private:
+    // Not copyable.
+    SceneSaver(const SceneSaver&);
+    SceneSaver& operator=(const SceneSaver&);
+
+    void workerLoop();
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable saveRequested;
+    std::condition_variable saveDone;
+    bool pending;
+    bool writing;
+    bool quit;
+    SceneFile pendingScene;
+    std::string pendingFilename;
+};
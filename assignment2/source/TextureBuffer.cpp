@@ -0,0 +1,34 @@
+#include "TextureBuffer.h"
+
+TextureBuffer::TextureBuffer(GLenum internalFormat, int texelBytes)
+    : internalFormat(internalFormat), texelBytes(texelBytes), buffer(0), tex(0), capacityTexels(0) {
+}
+
+int TextureBuffer::upload(const void* data, int numTexels, int first) {
+    if (tex == 0) {
+        glGenBuffers(1, &buffer);
+        glGenTextures(1, &tex);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    if (numTexels > capacityTexels || capacityTexels == 0) {
+        // reallocated with room to grow, and filled from the start
+        capacityTexels = 2 * (numTexels > 0 ? numTexels : 1);
+        glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)capacityTexels * texelBytes, NULL, GL_DYNAMIC_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, tex);
+        glTexBuffer(GL_TEXTURE_BUFFER, internalFormat, buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        first = 0;
+    }
+    int uploaded = numTexels - first;
+    if (uploaded > 0) {
+        glBufferSubData(GL_TEXTURE_BUFFER, (GLintptr)first * texelBytes, (GLsizeiptr)uploaded * texelBytes,
+                        (const char*)data + (size_t)first * texelBytes);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    return uploaded > 0 ? uploaded : 0;
+}
+
+void TextureBuffer::bind(int unit) const {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_BUFFER, tex);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "stglew.h"
+
+// A buffer texture (GL_TEXTURE_BUFFER, OpenGL 3.1): a buffer object that
+// shaders read as a flat array of texels with texelFetch() on a samplerBuffer,
+// so there are no rows to lay the data out in and it may hold as many texels
+// as GL_MAX_TEXTURE_BUFFER_SIZE allows (millions on current GPUs).
+class TextureBuffer {
+public:
+    // Texels of internalFormat (GL_RGBA32F, GL_R32I, ...), texelBytes each.
+    TextureBuffer(GLenum internalFormat, int texelBytes);
+
+    // Upload texels first to numTexels of data, which holds all numTexels of
+    // them. When the buffer is too small it is recreated, with room to grow,
+    // and all of data is uploaded. Returns the number of texels uploaded.
+    int upload(const void* data, int numTexels, int first = 0);
+
+    // Bind the texture to unit.
+    void bind(int unit) const;
+
+    // Texels the buffer has room for.
+    int capacity() const { return capacityTexels; }
+
+private:
+    // Not copyable.
+    TextureBuffer(const TextureBuffer&);
+    TextureBuffer& operator=(const TextureBuffer&);
+
+    GLenum internalFormat;
+    int texelBytes;
+    GLuint buffer;
+    GLuint tex;
+    int capacityTexels;
+};
@@ -0,0 +1,84 @@
+#include "Transform.h"
+
+#include <stdio.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TRANSFORM_NEON
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(_M_X64)
+#define TRANSFORM_SSE
+#include <emmintrin.h>
+#endif
+
+Transform::Transform()
+    : translation(0.0f), rotation(), scale(1.0f) {
+}
+
+Transform::Transform(const glm::mat4& mat) {
+    glm::mat3 axes(mat);
+    translation = glm::vec3(mat[3]);
+    scale = glm::vec3(glm::length(axes[0]), glm::length(axes[1]), glm::length(axes[2]));
+    if (glm::determinant(axes) < 0.0f) {
+        scale.x = -scale.x;     // mirrored
+    }
+    for (int i = 0; i < 3; i++) {
+        axes[i] /= scale[i];
+    }
+    if (glm::abs(glm::dot(axes[0], axes[1])) > 1e-3f || glm::abs(glm::dot(axes[1], axes[2])) > 1e-3f ||
+        glm::abs(glm::dot(axes[2], axes[0])) > 1e-3f) {
+        printf("world matrix has a shear, which is dropped\n");
+    }
+    rotation = glm::normalize(glm::quat_cast(axes));
+}
+
+glm::mat4 Transform::matrix() const {
+    glm::mat3 axes = glm::mat3_cast(rotation);
+    return glm::mat4(glm::vec4(axes[0] * scale.x, 0.0f),
+                     glm::vec4(axes[1] * scale.y, 0.0f),
+                     glm::vec4(axes[2] * scale.z, 0.0f),
+                     glm::vec4(translation, 1.0f));
+}
+
+glm::mat4 Transform::normalMatrix() const {
+    // (R S)^-T = R S^-1; the last row undoes the translation
+    glm::mat3 axes = glm::mat3_cast(rotation);
+    glm::mat4 result;
+    for (int i = 0; i < 3; i++) {
+        glm::vec3 column = axes[i] / scale[i];
+        result[i] = glm::vec4(column, -glm::dot(column, translation));
+    }
+    return result;
+}
+
+glm::mat4 multiplyMatrices(const glm::mat4& a, const glm::mat4& b) {
+    glm::mat4 result;
+#if defined(TRANSFORM_SSE)
+    __m128 a0 = _mm_loadu_ps(&a[0][0]);
+    __m128 a1 = _mm_loadu_ps(&a[1][0]);
+    __m128 a2 = _mm_loadu_ps(&a[2][0]);
+    __m128 a3 = _mm_loadu_ps(&a[3][0]);
+    for (int i = 0; i < 4; i++) {
+        __m128 sum = _mm_mul_ps(a0, _mm_set1_ps(b[i][0]));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a1, _mm_set1_ps(b[i][1])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_set1_ps(b[i][2])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_set1_ps(b[i][3])));
+        _mm_storeu_ps(&result[i][0], sum);
+    }
+#elif defined(TRANSFORM_NEON)
+    // separate multiplies and adds, not fused, to round like glm
+    float32x4_t a0 = vld1q_f32(&a[0][0]);
+    float32x4_t a1 = vld1q_f32(&a[1][0]);
+    float32x4_t a2 = vld1q_f32(&a[2][0]);
+    float32x4_t a3 = vld1q_f32(&a[3][0]);
+    for (int i = 0; i < 4; i++) {
+        float32x4_t sum = vmulq_n_f32(a0, b[i][0]);
+        sum = vaddq_f32(sum, vmulq_n_f32(a1, b[i][1]));
+        sum = vaddq_f32(sum, vmulq_n_f32(a2, b[i][2]));
+        sum = vaddq_f32(sum, vmulq_n_f32(a3, b[i][3]));
+        vst1q_f32(&result[i][0], sum);
+    }
+#else
+    result = a * b;
+#endif
+    return result;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Placement of an obj in the world as a translation, a rotation and a scale
+// along the obj's own axes: vertices are scaled, then rotated, then moved.
+// Uniform scales, rotations and translations applied in world space keep this
+// form, so the world matrix and its inverse transpose never need a general
+// inverse.
+class Transform {
+public:
+    // identity
+    Transform();
+
+    // Split a world matrix into its parts. A shear cannot be kept and is
+    // dropped, with a warning.
+    explicit Transform(const glm::mat4& mat);
+
+    glm::mat4 matrix() const;
+
+    // inverse transpose of matrix(), for transforming normals
+    glm::mat4 normalMatrix() const;
+
+    glm::vec3 translation;
+    glm::quat rotation;
+    glm::vec3 scale;
+};
+
+// a * b, four floats at a time on SSE2 and NEON, with the same products and
+// sums in the same order as glm's operator*.
+glm::mat4 multiplyMatrices(const glm::mat4& a, const glm::mat4& b);
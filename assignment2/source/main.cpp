@@ -1,6 +1,7 @@
 // main.cpp
 
 #include "Camera.h"
+#include "Frustum.h"
 //
 // For this project, we use OpenGL, GLUT
 // and GLEW (to load OpenGL extensions)
@@ -11,8 +12,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
 
 #include "Obj.h"
+#include "Transform.h"
+#include "LightBuffer.h"
+#include "LightClusters.h"
+#include "Headless.h"
+#include "SceneFile.h"
+#include "tiny_obj_loader.h"
 
 //
 // Globals used by this application.
@@ -24,7 +34,52 @@
 static int gWindowSizeX = 0;
 static int gWindowSizeY = 0;
 
-// File locations
+// true when rendering a camera path offscreen, without GLUT
+bool headless = false;
+
+// screenshots and recorded frames are read back a few frames late and saved
+// on other threads, so taking them does not hold up rendering
+STFrameCapture *frameCapture;
+bool screenshotRequested = false;
+int screenshots = 0;        // to number the files, so no two saves share one
+bool recording = false;
+int recordedFrames = 0;     // over all recordings, to number the files
+
+// CPU and GPU times of the passes, shown over the scene with Tab and written
+// to profile.csv with `
+STProfiler *profiler;
+STFont *hudFont;            // NULL if no font was found; the HUD is printed instead
+bool showHud = false;
+int hudFramesShown = 0;
+
+// input recorded with Shift+R and replayed by -bench, to time the same frames
+// on different builds
+struct InputEvent {
+    unsigned int frame;     // the event comes before this frame, counted from the start
+    float millis;           // time since the start, only for reference
+    char type;              // 'k' key, 's' special key, 'b' mouse button, 'm' mouse motion
+    int args[4];
+};
+FILE *inputRecording = NULL;
+unsigned int recordingFrames;
+STTimer recordingTimer;
+
+bool benchmarking = false;
+std::vector<InputEvent> benchEvents;
+size_t benchNextEvent = 0;
+unsigned int benchFrames = 0;       // frames in the recording
+unsigned int benchFrame = 0;
+bool benchHasCamera = false;
+glm::vec3 benchCameraPos, benchCameraLook;
+int benchWidth = 1280, benchHeight = 720;
+std::vector<float> benchFrameMillis;
+STTimer benchFrameTimer;
+
+// the scene file given on the command line and what was read from it; M
+// saves the scene back to it in the background
+std::string sceneFilename;
+SceneFile sceneFile;
+SceneSaver sceneSaver;
 std::vector<std::string> objFilePaths;
 
 STShaderProgram *shader;
@@ -59,7 +114,62 @@ GLuint shadowFbo;
 GLuint depthTex;
 GLuint spotTex;
 
+// variance shadow mapping: depth moments rendered along with depthTex, then
+// blurred through momentsBlurTex
+GLuint momentsTex;
+GLuint momentsBlurTex;
+GLuint momentsBlurFbo;
+
 STShaderProgram *shadowMapShader;
+STShaderProgram *blurShader;
+
+// how phong.frag filters the spotlight's shadow ('e' key cycles; 't' key
+// cycles the number of Poisson disk taps)
+enum { SHADOW_POISSON, SHADOW_VARIANCE, SHADOW_GRID, NUM_SHADOW_FILTERS };
+const char* const shadowFilterNames[NUM_SHADOW_FILTERS] = {
+    "rotated Poisson disk PCF", "variance shadow map", "9x9 grid PCF"
+};
+int shadowFilter = SHADOW_POISSON;
+const int MAX_SHADOW_TAPS = 16;
+int shadowTaps = 12;
+
+// Poisson disk samples in the unit disk; any prefix is reasonably spread out
+const float poissonDisk[2*MAX_SHADOW_TAPS] = {
+    -0.94201624f, -0.39906216f,     0.94558609f, -0.76890725f,
+    -0.09418410f, -0.92938870f,     0.34495938f,  0.29387760f,
+    -0.91588581f,  0.45771432f,    -0.81544232f, -0.87912464f,
+    -0.38277543f,  0.27676845f,     0.97484398f,  0.75648379f,
+     0.44323325f, -0.97511554f,     0.53742981f, -0.47373420f,
+    -0.26496911f, -0.41893023f,     0.79197514f,  0.19090188f,
+    -0.24188840f,  0.99706507f,    -0.81409955f,  0.91437590f,
+     0.19984126f,  0.78641367f,     0.14383161f, -0.14100790f
+};
+
+// everything further than this from the eye is fully fogged (fogRange in phong.frag)
+const float FOG_RANGE = 750.0f;
+
+// cascaded shadow maps of the sun (directional light 0): the camera's view
+// frustum up to CASCADE_MAX_DIST is cut into NUM_CASCADES slices, and each
+// slice gets a layer of cascadeTex fit around its bounding sphere
+#define CASCADE_TEX_SIZE 1024
+const int NUM_CASCADES = 3;
+const float CASCADE_MAX_DIST = FOG_RANGE;
+const float CASCADE_SPLIT_LAMBDA = 0.75f;   // blend of logarithmic (1) and uniform (0) slice splits
+
+GLuint cascadeFbo;
+GLuint cascadeTex;
+glm::mat4 cascadeViewProj[NUM_CASCADES];    // light matrix each layer was last rendered with
+bool cascadesValid = false;
+unsigned int cascadeFrame = 0;
+
+// 'z' key cycles. Amortized, cascade 0 is re-rendered every frame and cascade
+// i > 0 every 2^i frames, with the far cascades taking turns.
+enum { CASCADES_OFF, CASCADES_EVERY_FRAME, CASCADES_AMORTIZED, NUM_CASCADE_MODES };
+const char* const cascadeModeNames[NUM_CASCADE_MODES] = {
+    "sun shadows off", "sun shadow cascades every frame", "far sun shadow cascades amortized"
+};
+int cascadeMode = CASCADES_AMORTIZED;
+unsigned int cascadeRenders = 0;
 
 
 // cubemap stuff
@@ -67,11 +177,36 @@ GLuint cubeMap;
 STShaderProgram *environmentShader;
 
 // reflection stuff
-#define REFTEX_SIZE 512
-
 GLuint reflectionFbo;
 GLuint reflectionTex;
 GLuint reflectionDepthTex;
+int reflectionWidth = 0;        // size reflectionTex is allocated with
+int reflectionHeight = 0;
+
+// reflection resolution as a fraction of the window size ('g' key cycles)
+const int NUM_REFLECTION_QUALITIES = 3;
+const float reflectionScales[NUM_REFLECTION_QUALITIES] = { 1.0f, 0.5f, 0.25f };
+int reflectionQuality = 1;
+
+// amortized reflection updates: the reflection is re-rendered every
+// reflectionUpdateInterval frames ('j' key cycles), and with
+// reflectionSkipStill ('l' key) those updates are skipped while the camera
+// stays within the thresholds below of where it was at the last update and
+// nothing in the scene changed. Between updates, the water samples the old
+// reflection in the direction it saw each reflected ray (see phong.frag).
+int reflectionUpdateInterval = 1;
+bool reflectionSkipStill = true;
+const float REFLECTION_MOVE_THRESHOLD = 0.5f;          // world units
+const float REFLECTION_TURN_THRESHOLD = 0.25f;         // degrees
+bool reflectionValid = false;
+int framesSinceReflectionUpdate = 0;
+glm::vec3 reflectionCameraPos;
+glm::vec3 reflectionCameraLook;
+glm::mat4 reflectionViewProj;   // camera viewProj, without translation, the reflection was rendered for
+unsigned int reflectionUpdates = 0;
+
+// set when lights or shading are edited, so that cached renderings are redone
+bool sceneEdited = false;
 
 
 // billboard stuff
@@ -79,84 +214,159 @@ STShaderProgram *textureShader;
 GLuint orbBillboardTex;
 GLuint beamBillboardTex;
 
+// the point-light orbs are drawn with one instanced draw of billboardQuadBuffer,
+// with the position and size of each orb in orbInstanceBuffer
+STShaderProgram *billboardShader;
+GLint billboardCornerAttrib;
+GLint billboardInstanceAttrib;
+GLuint billboardQuadBuffer;
+GLuint orbInstanceBuffer;
+std::vector<glm::vec4> orbInstances;        // what orbInstanceBuffer holds
+const float ORB_SIZE = 4.0f;                // half the width of an orb
+
 struct Dirlight {
     float az;
     float el;
     float scale;
     glm::vec3 color;        // scale*color is used for diffuse
+    float ambient;          // gray level of ambient light
+    float specular;         // specular*color is used for specular
+
+    Dirlight() : az(0.0f), el(0.0f), scale(1.0f), color(1.0f), ambient(0.0f), specular(1.0f) {}
 
-    Dirlight() : az(0.0f), el(0.0f), scale(1.0f), color() {}
-    
-    bool readLightsFile(int id) {
-        std::string filename = "light";
-        filename.append(std::to_string(static_cast<long long>(id))).append(".txt");
-        std::ifstream in(filename.c_str(), std::ios::in);
-        if(!in){
-            std::cout << "no light file" << filename << std::endl;
-            return false;
-        }
-        std::cout << "light file" << filename << "found" << std::endl;
-        in >> az >> el >> scale;
-        in.close();
-        return true;
-    }
-    bool writeLightsFile(int id) {
-        std::string filename = "light";
-        filename.append(std::to_string(static_cast<long long>(id))).append(".txt");
-        std::ofstream out(filename.c_str(), std::ios::out);
-        if (!out) {
-            std::cout << "cannot open file" << filename << std::endl;
-            return false;
-        }
-        out << az << " " << el << " " << scale << std::endl;
-        out.close();
-        return true;
-    }
     glm::vec3 getDir() {
         glm::vec3 negXdir(-1.0f, 0.0f, 0.0f);
         return glm::rotateZ(glm::rotateY(negXdir, -el), az);
     }
 };
 
-// lights
-const int NUMLIGHTS = 4 + 34;
-struct Dirlight lights[NUMLIGHTS];
+// lights: directional lights 0-2 and spotlight 3, then any number of point
+// lights (az, el and scale are their position), as many as the scene has
+const int NUM_DIRLIGHTS = 4;
+std::vector<Dirlight> lights;
+int numSceneLights;     // lights of the scene; the rest were added with '+'
 int selectedLight;
 int selectedLightAttrib;
 
+// every light is a record in lightBuffer, which is rebuilt every frame and
+// only uploaded when a light changed; shaders read their lights from it
+LightBuffer lightBuffer;
+unsigned int lightUploads = 0;
+unsigned int lightTexelsUploaded = 0;
+
+// view * worldMat of every obj, for the pass being drawn
+std::vector<glm::mat4> objModelViews;
+unsigned int objMatrixUpdates = 0;
 
-// worldpos of spotlight (light 3)
-const glm::vec3 spotLightPosition(-28.2751, 253.996, 67.9616);
+// point lights are shaded per cluster of the view frustum (see LightClusters.h)
+const float POINTLIGHT_RADIUS = 50.0f;
+const int MAX_POINTLIGHTS = 8192;
+LightClusters lightClusters;
+unsigned int clusterBuilds = 0;
+unsigned int clusterLightRefs = 0;
+unsigned int clusterMaxLights = 0;
+unsigned int clusterDroppedRefs = 0;
+float clusterMillis = 0.0f;
+
+
+// worldpos of spotlight (light 3), from the scene
+glm::vec3 spotLightPosition(-28.2751, 253.996, 67.9616);
+const float SPOTLIGHT_RANGE = 5000.0f;
 
 
 // right mouse controlling?
 bool rightMouseControllLights;
 
 
-// these must be set with GL_MODELVIEW set to identity
-void setDirectionalLightAttribs() {
-    // set directional and spot light attribs (GL_LIGHTx)
-    for (int i=0; i<4; i++) {
-        glLightfv(GL_LIGHT0 + i, GL_DIFFUSE, glm::value_ptr(lights[i].scale * lights[i].color));
-        glLightfv(GL_LIGHT0 + i, GL_SPOT_DIRECTION, glm::value_ptr(lights[i].getDir()));
+// frame timing used to compare drawing paths ('i' and 'u' keys)
+const int NUM_TIMED_FRAMES = 200;
+STTimer frameTimer;
+int timedFramesLeft = 0;
+float timedFramesMillis = 0.0f;
+unsigned int timedFramesShaderCalls = 0;
+std::string timedFramesLabel;
+
+// view-frustum culling of objs and meshes in each pass ('v' key)
+bool frustumCulling = true;
+enum { SHADOW_PASS, CASCADE_PASS, REFLECTION_PASS, MAIN_PASS, NUM_PASSES };
+const char* const passNames[NUM_PASSES] = { "shadow", "sun shadow", "reflection", "main" };
+// meshes drawn and culled in each pass, summed over the timed frames
+unsigned int passMeshesDrawn[NUM_PASSES];
+unsigned int passMeshesCulled[NUM_PASSES];
+
+// the spotlight's shadow map is only re-rendered when the light moved, or an
+// obj moved into, within or out of the light frustum ('h' key)
+bool shadowMapCaching = true;
+bool shadowMapValid = false;
+glm::mat4 shadowMapLightViewProj;   // light matrix the cached map was rendered with
+unsigned int shadowPassesSkipped = 0;
+
+// time the next NUM_TIMED_FRAMES frames; the result is printed with label
+void startTimedFrames(const std::string& label) {
+    printf("%s, timing %d frames...\n", label.c_str(), NUM_TIMED_FRAMES);
+    timedFramesLabel = label;
+    timedFramesLeft = NUM_TIMED_FRAMES;
+    timedFramesMillis = 0.0f;
+    timedFramesShaderCalls = 0;
+    for (int i = 0; i < NUM_PASSES; i++) {
+        passMeshesDrawn[i] = passMeshesCulled[i] = 0;
     }
-    // set spotlight (light3) position
-    {
-        glm::vec4 position = glm::vec4(spotLightPosition, 1.0f);
-        glLightfv(GL_LIGHT3, GL_POSITION, glm::value_ptr(position));
+    shadowPassesSkipped = 0;
+    cascadeRenders = 0;
+    clusterBuilds = clusterLightRefs = clusterMaxLights = clusterDroppedRefs = 0;
+    clusterMillis = 0.0f;
+    lightUploads = lightTexelsUploaded = 0;
+    objMatrixUpdates = 0;
+    reflectionUpdates = 0;
+    STShaderProgram::sNumGLCalls = 0;
+    frameTimer.Reset();
+}
+
+
+// bin the point lights into the clusters of a view, then pass the lists and
+// the light records to the shader (textures on units 9 to 11)
+void setLightAttribs(const glm::mat4& view, const glm::mat4& proj) {
+    STTimer timer;
+    std::vector<glm::vec4> pointLights;
+    pointLights.reserve(lights.size() - NUM_DIRLIGHTS);
+    for (size_t i=NUM_DIRLIGHTS; i<lights.size(); i++) {
+        pointLights.push_back(glm::vec4(lights[i].az, lights[i].el, lights[i].scale, POINTLIGHT_RADIUS));
     }
+    lightClusters.build(pointLights, NUM_DIRLIGHTS, view, proj, FOG_RANGE);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    lightClusters.bind(shader, 9, viewport[2], viewport[3]);
+    lightBuffer.bind(shader, 11);
+
+    clusterMillis += timer.GetElapsedMillis();
+    clusterBuilds++;
+    clusterLightRefs += lightClusters.numLightRefs();
+    clusterMaxLights = (std::max)(clusterMaxLights, lightClusters.maxClusterLights());
+    clusterDroppedRefs += lightClusters.numDroppedRefs();
 }
 
-void setPointLightAttribs(GLint pointLightPosUniformLocation) {
-    // set point light attribs (uniform vec3 pointLightPos[] in frag shader)
-    float pointLightPositions[(NUMLIGHTS - 4)*3];
-    int length = 0;
-    for (int i=4; i<NUMLIGHTS; i++) {
-        pointLightPositions[length++] = lights[i].az;
-        pointLightPositions[length++] = lights[i].el;
-        pointLightPositions[length++] = lights[i].scale;
+//
+// Double the number of point lights with copies of the scene's own, scattered
+// around them, or go back to the scene's lights after MAX_POINTLIGHTS.
+//
+void AddPointLights()
+{
+    int numScenePointLights = numSceneLights - NUM_DIRLIGHTS;
+    int numPointLights = (int)lights.size() - NUM_DIRLIGHTS;
+    if (numScenePointLights == 0)
+        return;
+    if (2 * numPointLights > MAX_POINTLIGHTS) {
+        lights.resize(numSceneLights);
+        selectedLight = (std::min)(selectedLight, numSceneLights - 1);
+        return;
+    }
+    for (int i = 0; i < numPointLights; i++) {
+        Dirlight light = lights[NUM_DIRLIGHTS + i % numScenePointLights];
+        light.az += (rand() % 400) - 200.0f;
+        light.el += (rand() % 400) - 200.0f;
+        lights.push_back(light);
     }
-    glUniform3fv(pointLightPosUniformLocation, (NUMLIGHTS - 4)*3, pointLightPositions);
 }
 
 
@@ -165,47 +375,179 @@ void resetCamera(){
     camera.setLook(defaultCameraLook);
 }
 
-bool readSceneFile(const std::string& filename) {
-    std::ifstream in(filename.c_str(), std::ios::in);
-    if(!in){
+// render settings kept in the scene file; each is an int in [min, max] or a bool
+struct SceneSetting {
+    const char* name;
+    int* value;
+    bool* flag;
+    int min;
+    int max;
+};
+const SceneSetting sceneSettings[] = {
+    { "smooth", NULL, &smooth, 0, 1 },
+    { "shadowFilter", &shadowFilter, NULL, 0, NUM_SHADOW_FILTERS - 1 },
+    { "shadowTaps", &shadowTaps, NULL, 1, MAX_SHADOW_TAPS },
+    { "shadowMapCaching", NULL, &shadowMapCaching, 0, 1 },
+    { "cascadeMode", &cascadeMode, NULL, 0, NUM_CASCADE_MODES - 1 },
+    { "reflectionQuality", &reflectionQuality, NULL, 0, NUM_REFLECTION_QUALITIES - 1 },
+    { "reflectionUpdateInterval", &reflectionUpdateInterval, NULL, 1, 8 },
+    { "reflectionSkipStill", NULL, &reflectionSkipStill, 0, 1 },
+    { "frustumCulling", NULL, &frustumCulling, 0, 1 },
+};
+const int NUM_SCENE_SETTINGS = sizeof(sceneSettings) / sizeof(sceneSettings[0]);
+
+// Read the scene file and apply its render settings; the rest of the scene is
+// used by Setup()
+bool readScene(const std::string& filename) {
+    STTimer timer;
+    if (!sceneFile.read(filename)) {
         return false;
     }
-    std::string line;
-    while (std::getline(in, line)) {
-        printf("%s\n", line.c_str());
-        objFilePaths.push_back(line);
+    float millis = timer.GetElapsedMillis();
+
+    for (size_t i = 0; i < sceneFile.objects.size(); i++) {
+        printf("%s\n", sceneFile.objects[i].path.c_str());
+        objFilePaths.push_back(sceneFile.objects[i].path);
+    }
+    for (size_t i = 0; i < sceneFile.settings.size(); i++) {
+        const std::string& name = sceneFile.settings[i].first;
+        int value = sceneFile.settings[i].second;
+        int j = 0;
+        while (j < NUM_SCENE_SETTINGS && name != sceneSettings[j].name) {
+            j++;
+        }
+        if (j == NUM_SCENE_SETTINGS || value < sceneSettings[j].min || value > sceneSettings[j].max) {
+            printf("%s: ignoring setting %s %d\n", filename.c_str(), name.c_str(), value);
+        } else if (sceneSettings[j].value) {
+            *sceneSettings[j].value = value;
+        } else {
+            *sceneSettings[j].flag = value != 0;
+        }
     }
+    printf("%s: %d objects, %d lights, read in %.2f ms\n", filename.c_str(),
+        (int)sceneFile.objects.size(), (int)sceneFile.lights.size(), millis);
     return true;
 }
 
-bool readCameraFile(const std::string& filename) {
-    std::ifstream in(filename.c_str(), std::ios::in);
-    if(!in){
-        return false;
+// Put the lights of the scene file in their places in lights: the directional
+// lights first, then the spotlight and then the point lights
+void setSceneLights() {
+    lights.assign(NUM_DIRLIGHTS, Dirlight());
+    int numDirectional = 0;
+    bool hasSpot = false;
+    for (size_t i = 0; i < sceneFile.lights.size(); i++) {
+        const SceneFile::Light& sceneLight = sceneFile.lights[i];
+        Dirlight light;
+        light.az = sceneLight.az;
+        light.el = sceneLight.el;
+        light.scale = sceneLight.scale;
+        light.color = sceneLight.color;
+        if (sceneLight.type == SceneFile::LIGHT_DIRECTIONAL && numDirectional < NUM_DIRLIGHTS - 1) {
+            lights[numDirectional++] = light;
+        } else if (sceneLight.type == SceneFile::LIGHT_SPOT && !hasSpot) {
+            lights[NUM_DIRLIGHTS - 1] = light;
+            spotLightPosition = sceneLight.position;
+            hasSpot = true;
+        } else if (sceneLight.type == SceneFile::LIGHT_POINT) {
+            lights.push_back(light);
+        } else {
+            printf("ignoring light %d: the scene can only have %d directional lights and one spotlight\n",
+                (int)i, NUM_DIRLIGHTS - 1);
+        }
     }
-    in >> defaultCameraPos.x >> defaultCameraPos.y >> defaultCameraPos.z;
-    in >> defaultCameraLook.x >> defaultCameraLook.y >> defaultCameraLook.z;
-    return true;
+    numSceneLights = (int)lights.size();
 }
 
-bool writeCameraFile(const std::string& filename) {
-    std::ofstream out(filename.c_str(), std::ios::out);
-    if(!out){
-        return false;
+//
+// Save the camera, the objects, the lights of the scene (not those added with
+// '+') and the render settings to the scene file. Only the copy is made here;
+// the file is written on another thread.
+//
+void saveScene() {
+    SceneFile scene;
+    scene.hasCamera = true;
+    scene.cameraPos = camera.getPosition();
+    scene.cameraLook = camera.getLook();
+    for (size_t i = 0; i < objs.size(); i++) {
+        SceneFile::Object object;
+        object.path = objFilePaths[i];
+        object.hasWorldMat = true;
+        object.worldMat = objs[i].getTransform().matrix();
+        scene.objects.push_back(object);
     }
-    glm::vec3 pos = camera.getPosition();
-    glm::vec3 look = camera.getLook();
-    out << pos.x << ' ' <<  pos.y << ' ' << pos.z << std::endl;
-    out << look.x << ' ' << look.y << ' ' << look.z << std::endl;
-    return true;
+    for (int i = 0; i < numSceneLights; i++) {
+        SceneFile::Light light;
+        light.type = i < NUM_DIRLIGHTS - 1 ? SceneFile::LIGHT_DIRECTIONAL :
+                     i == NUM_DIRLIGHTS - 1 ? SceneFile::LIGHT_SPOT : SceneFile::LIGHT_POINT;
+        light.az = lights[i].az;
+        light.el = lights[i].el;
+        light.scale = lights[i].scale;
+        light.color = lights[i].color;
+        light.position = spotLightPosition;
+        scene.lights.push_back(light);
+    }
+    for (int i = 0; i < NUM_SCENE_SETTINGS; i++) {
+        const SceneSetting& setting = sceneSettings[i];
+        scene.settings.push_back(std::make_pair(std::string(setting.name),
+            setting.value ? *setting.value : (int)*setting.flag));
+    }
+    sceneSaver.save(scene, sceneFilename);
+}
+
+
+//
+// Decode an image on a loader thread, then pass it to upload on the
+// OpenGL thread and free it.
+//
+void QueueImage(STAssetLoader& loader, const std::string& filename,
+                const std::function<void(const STImage&)>& upload)
+{
+    STImage** image = new STImage*(NULL);
+    loader.Add(filename,
+               [=]() { *image = new STImage(filename); },
+               [=]() { upload(**image); delete *image; delete image; });
 }
 
+//
+// Create texture from image, linearly filtered and clamped to its edges.
+//
+void UploadTexture2D(GLuint& texture, const STImage& image)
+{
+    glEnable(GL_TEXTURE_2D);
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, image.GetWidth(), image.GetHeight());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.GetWidth(), image.GetHeight(), GL_RGBA, GL_UNSIGNED_BYTE, image.GetPixels());
+}
 
 //
 // Initialize the application, loading all of the settings that
 // we will be accessing later in our fragment shaders.
 //
 void Setup() {
+    frameCapture = new STFrameCapture();
+
+    profiler = new STProfiler();
+    static const char* fontFiles[] = {
+        "C:/Windows/Fonts/consola.ttf", "/System/Library/Fonts/Menlo.ttc",
+        "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf", "/usr/share/fonts/truetype/DejaVuSansMono.ttf"
+    };
+    hudFont = NULL;
+    for (int i = 0; i < 4 && !hudFont; i++) {
+        std::ifstream fontFile(fontFiles[i]);
+        if (!fontFile)
+            continue;
+        try {
+            hudFont = new STFont(fontFiles[i], 14);
+        } catch (std::runtime_error* e) {
+            delete e;
+        }
+    }
+
     shader = new STShaderProgram();
     shader->LoadVertexShader("kernels/default.vert");
     shader->LoadFragmentShader("kernels/phong.frag");
@@ -214,6 +556,10 @@ void Setup() {
     shadowMapShader->LoadVertexShader("kernels/shadow.vert");
     shadowMapShader->LoadFragmentShader("kernels/shadow.frag");
 
+    blurShader = new STShaderProgram();
+    blurShader->LoadVertexShader("kernels/blur.vert");
+    blurShader->LoadFragmentShader("kernels/blur.frag");
+
     environmentShader = new STShaderProgram();
     environmentShader->LoadVertexShader("kernels/environment.vert");
     environmentShader->LoadFragmentShader("kernels/environment.frag");
@@ -222,9 +568,32 @@ void Setup() {
     textureShader->LoadVertexShader("kernels/texture.vert");
     textureShader->LoadFragmentShader("kernels/texture.frag");
 
+    billboardShader = new STShaderProgram();
+    billboardShader->LoadVertexShader("kernels/billboard.vert");
+    billboardShader->LoadFragmentShader("kernels/texture.frag");
+    billboardCornerAttrib = billboardShader->GetAttribLocation("corner");
+    billboardInstanceAttrib = billboardShader->GetAttribLocation("instance");
+
+    // Meshes and images are parsed and decoded on worker threads while
+    // the rest of Setup() runs; only their uploads happen on this thread.
+    STAssetLoader loader;
+
+    // load meshes
+    objs.resize(objFilePaths.size());
+    for (size_t i=0; i < objFilePaths.size(); i++) {
+        /*objs.push_back(Obj());
+        objs.back().read(objFilePaths[i]);*/    // may cause array to expand and copy, which causes errors freeing objs
+        loader.Add(objFilePaths[i],
+                   [i]() { const SceneFile::Object& object = sceneFile.objects[i];
+                           objs[i].load(object.path, object.hasWorldMat ? &object.worldMat : NULL); },
+                   [i]() { objs[i].upload(); });
+    }
+
     
-    // read camera file
-    if (!readCameraFile("camera.txt")) {
+    if (sceneFile.hasCamera) {
+        defaultCameraPos = sceneFile.cameraPos;
+        defaultCameraLook = sceneFile.cameraLook;
+    } else {
         defaultCameraPos = glm::vec3(15.0f, 0.0f, 0.0f);
         defaultCameraLook = glm::vec3(-1.0f, 0.0f, 0.0f);
     }
@@ -237,71 +606,16 @@ void Setup() {
     glEnable(GL_DEPTH_TEST);
 
 
-    glEnable(GL_LIGHTING);
-
-    // read lights files
-    for (int i=0; i<NUMLIGHTS; i++) {
-        lights[i] = struct Dirlight();
-        lights[i].readLightsFile(i);
-    }
+    setSceneLights();
     
     selectedLight = 0;
     selectedLightAttrib = 0;
 
-
-    // set non-manipulable attribs of the lights
-
-    // set all necessary light attributes except GL_DIFFUSE and GL_SPOT_DIRECTION
-    // (all hardcoded)
-
-    // direct light 0
-    {
-        static float ambientLight[]  = {0.10, 0.10, 0.10, 1.0};
-        lights[0].color = glm::vec3(1.0f, 1.0f, 1.0f);
-        static float specularLight[] = {1.00, 1.00, 1.00, 1.0};
-        
-        glEnable(GL_LIGHT0);
-        glLightfv(GL_LIGHT0, GL_SPECULAR,  specularLight);
-        glLightfv(GL_LIGHT0, GL_AMBIENT,   ambientLight);
-        //glLightfv(GL_LIGHT0, GL_DIFFUSE,   diffuseLight);
-    }
-    // direct light 1
-    {
-        static float ambientLight[]  = {0.0, 0.0, 0.0, 1.0};
-        lights[1].color = glm::vec3(1.0f, 1.0f, 1.0f);
-        static float specularLight[] = {0.00, 0.00, 0.00, 1.0};
-        
-        glEnable(GL_LIGHT1);
-        glLightfv(GL_LIGHT1, GL_SPECULAR,  specularLight);
-        glLightfv(GL_LIGHT1, GL_AMBIENT,   ambientLight);
-        //glLightfv(GL_LIGHT1, GL_DIFFUSE,   diffuseLight);
-    }
-    // direct light 2
-    {
-        static float ambientLight[]  = {0.0, 0.0, 0.0, 1.0};
-        lights[2].color = glm::vec3(1.0f, 1.0f, 1.0f);
-        static float specularLight[] = {0.00, 0.00, 0.00, 1.0};
-        
-        glEnable(GL_LIGHT2);
-        glLightfv(GL_LIGHT2, GL_SPECULAR,  specularLight);
-        glLightfv(GL_LIGHT2, GL_AMBIENT,   ambientLight);
-        //glLightfv(GL_LIGHT2, GL_DIFFUSE,   diffuseLight);
-    }
-    // spotlight 3
-    {
-        static float ambientLight[]  = {0.00, 0.00, 0.00, 1.0};
-        lights[3].color = glm::vec3(1.0f, 1.0f, 1.0f);
-        static float specularLight[] = {1.00, 1.00, 1.00, 1.0};
-        
-        //static float spotCutoff = 5.0f;
-
-        glEnable(GL_LIGHT3);
-        glLightfv(GL_LIGHT3, GL_SPECULAR,  specularLight);
-        glLightfv(GL_LIGHT3, GL_AMBIENT,   ambientLight);
-        //glLightfv(GL_LIGHT3, GL_DIFFUSE,   diffuseLight);
-
-        //glLightfv(GL_LIGHT3, GL_SPOT_CUTOFF, &spotCutoff);
-    }
+    // the parts of the lights the scene does not set: only the sun adds
+    // ambient light, and directional lights 1 and 2 have no highlights
+    lights[0].ambient = 0.1f;
+    lights[1].specular = 0.0f;
+    lights[2].specular = 0.0f;
 
     // setup shadow stuff
     {
@@ -312,36 +626,79 @@ void Setup() {
         glGenTextures(1, &depthTex);
         glBindTexture(GL_TEXTURE_2D, depthTex);
         glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, SHADOWMAP_TEX_WIDTH, SHADOWMAP_TEX_HEIGHT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        // lookups through sampler2DShadow compare against the depth, with bilinear filtering of the results
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
         float borderColor[] = {0.0f, 0.0f, 0.0f, 0.0f};     // full shadow outside depthtex edges
         glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 
         glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTex, 0);
+
+        // depth moments for variance shadow mapping, and the texture they are blurred through;
+        // a zero border is full shadow here too
+        GLuint* moments[2] = { &momentsTex, &momentsBlurTex };
+        for (int i = 0; i < 2; i++) {
+            glGenTextures(1, moments[i]);
+            glBindTexture(GL_TEXTURE_2D, *moments[i]);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32F, SHADOWMAP_TEX_WIDTH, SHADOWMAP_TEX_HEIGHT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        }
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, momentsTex, 0);
     
-        glDrawBuffer(GL_NONE);  // no color buffers are rendered to
+        glDrawBuffer(GL_NONE);  // the moments are only rendered to for variance shadow mapping
 
         if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
             printf("shadowmap framebuffer setup failed\n");
             exit(1);
         }
 
+        glGenFramebuffers(1, &momentsBlurFbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, momentsBlurFbo);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, momentsBlurTex, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            printf("shadow moments blur framebuffer setup failed\n");
+            exit(1);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowFbo);
+
         // setup spotlight texture
-        STImage spotImg("textures/spot.png");
-        int width = spotImg.GetWidth();
-        int height = spotImg.GetHeight();
+        QueueImage(loader, "textures/spot.png", [](const STImage& image) {
+            UploadTexture2D(spotTex, image);
+        });
+    }
 
-        glEnable(GL_TEXTURE_2D);
-        glGenTextures(1, &spotTex);
-        glBindTexture(GL_TEXTURE_2D, spotTex);
-        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA, width, height);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, spotImg.GetPixels());
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // setup sun shadow cascades; each layer of cascadeTex is attached to cascadeFbo when it is rendered
+    {
+        glGenTextures(1, &cascadeTex);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, cascadeTex);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT24, CASCADE_TEX_SIZE, CASCADE_TEX_SIZE, NUM_CASCADES);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glGenFramebuffers(1, &cascadeFbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, cascadeFbo);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cascadeTex, 0, 0);
+        glDrawBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            printf("sun shadow cascade framebuffer setup failed\n");
+            exit(1);
+        }
+
+        // 24-bit depth is stored in 32 bits
+        printf("sun shadow cascades: %d x %dx%d, %.1f MB\n", NUM_CASCADES, CASCADE_TEX_SIZE, CASCADE_TEX_SIZE,
+            NUM_CASCADES * CASCADE_TEX_SIZE * CASCADE_TEX_SIZE * 4 / (1024.f * 1024.f));
     }
 
 
@@ -357,14 +714,23 @@ void Setup() {
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-        STImage Xneg("cubemap/Xneg.png");
-        STImage Xpos("cubemap/Xpos.png");
-        STImage Yneg("cubemap/Yneg.png");
-        STImage Ypos("cubemap/Ypos.png");
-        STImage Zneg("cubemap/Zneg.png");
-        STImage Zpos("cubemap/Zpos.png");
-        int width = Xneg.GetWidth();
-        int height = Xneg.GetHeight();
+        // the Y faces are swapped on purpose
+        static const char* faceFiles[6] = {
+            "cubemap/Xpos.png", "cubemap/Xneg.png", "cubemap/Yneg.png",
+            "cubemap/Ypos.png", "cubemap/Zpos.png", "cubemap/Zneg.png"
+        };
+        static bool cubeMapAllocated = false;
+        for (int face=0; face<6; face++) {
+            QueueImage(loader, faceFiles[face], [face](const STImage& image) {
+                glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMap);
+                if (!cubeMapAllocated) {
+                    glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_RGBA8, image.GetWidth(), image.GetHeight());
+                    cubeMapAllocated = true;
+                }
+                glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, 0, 0, image.GetWidth(), image.GetHeight(),
+                                GL_RGBA, GL_UNSIGNED_BYTE, image.GetPixels());
+            });
+        }
 
         /*glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_RGBA, width, width, 0, GL_RGBA, GL_UNSIGNED_BYTE, Xpos.GetPixels());
         glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, GL_RGBA, width, width, 0, GL_RGBA, GL_UNSIGNED_BYTE, Xneg.GetPixels());
@@ -372,76 +738,29 @@ void Setup() {
         glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, GL_RGBA, width, width, 0, GL_RGBA, GL_UNSIGNED_BYTE, Ypos.GetPixels());
         glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, GL_RGBA, width, width, 0, GL_RGBA, GL_UNSIGNED_BYTE, Zpos.GetPixels());
         glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, GL_RGBA, width, width, 0, GL_RGBA, GL_UNSIGNED_BYTE, Zneg.GetPixels());*/
-        glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_RGBA, width, height);
-        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, Xpos.GetPixels());
-        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, Xneg.GetPixels());
-        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, Yneg.GetPixels());
-        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, Ypos.GetPixels());
-        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, Zpos.GetPixels());
-        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, Zneg.GetPixels());
     }
 
     // set up billboard textures
     {
-        glEnable(GL_TEXTURE_2D);
-        glGenTextures(1, &orbBillboardTex);
-        glBindTexture(GL_TEXTURE_2D, orbBillboardTex);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-        STImage orbImg("textures/orb.png");
-        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA, orbImg.GetWidth(), orbImg.GetHeight());
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, orbImg.GetWidth(), orbImg.GetHeight(), GL_RGBA, GL_UNSIGNED_BYTE, orbImg.GetPixels());
-
-
-        glEnable(GL_TEXTURE_2D);
-        glGenTextures(1, &beamBillboardTex);
-        glBindTexture(GL_TEXTURE_2D, beamBillboardTex);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-        STImage beamImg("textures/beam.png");
-        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA, beamImg.GetWidth(), beamImg.GetHeight());
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, beamImg.GetWidth(), beamImg.GetHeight(), GL_RGBA, GL_UNSIGNED_BYTE, beamImg.GetPixels());
+        QueueImage(loader, "textures/orb.png", [](const STImage& image) {
+            UploadTexture2D(orbBillboardTex, image);
+        });
+        QueueImage(loader, "textures/beam.png", [](const STImage& image) {
+            UploadTexture2D(beamBillboardTex, image);
+        });
+
+        // corners of the quad every orb is drawn from, as a triangle strip
+        static const float quad[] = { 1.0f, -1.0f,   1.0f, 1.0f,   -1.0f, -1.0f,   -1.0f, 1.0f };
+        glGenBuffers(1, &billboardQuadBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, billboardQuadBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+        glGenBuffers(1, &orbInstanceBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
 
-    // set up reflection tex fbo
+    // set up reflection tex fbo; its texture is allocated by ResizeReflectionFbo() once the window size is known
     {
         glGenFramebuffers(1, &reflectionFbo);
-        glBindFramebuffer(GL_FRAMEBUFFER, reflectionFbo);
-
-        glEnable(GL_TEXTURE_2D);
-
-        // set up texture to render reflected scene to
-        glGenTextures(1, &reflectionTex);
-        glBindTexture(GL_TEXTURE_2D, reflectionTex);
-        //glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, REFTEX_SIZE, REFTEX_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA, REFTEX_SIZE, REFTEX_SIZE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        // attach to fbo
-        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, reflectionTex, 0);
-    
-        // depth buffer
-        glGenRenderbuffers(1, &reflectionDepthTex);
-        glBindRenderbuffer(GL_RENDERBUFFER, reflectionDepthTex);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, REFTEX_SIZE, REFTEX_SIZE);
-        // attach to fbo
-        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, reflectionDepthTex);
-
-        GLenum drawBuffers[1] = {GL_COLOR_ATTACHMENT0};
-        glDrawBuffers(1, drawBuffers);
-
-        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-            printf("reflection fbo setup failed\n");
-            exit(1);
-        }
     }
 
     // initial scene manipulation settings
@@ -449,13 +768,8 @@ void Setup() {
     axisOfRotation = glm::vec3(0.0f, 0.0f, 1.0f);
     axisOfTranslation = glm::vec3(0.0f, 0.0f, 1.0f);
 
-    // load meshes
-    objs.resize(objFilePaths.size());
-    for (size_t i=0; i < objFilePaths.size(); i++) {
-        /*objs.push_back(Obj());
-        objs.back().read(objFilePaths[i]);*/    // may cause array to expand and copy, which causes errors freeing objs
-        objs[i].read(objFilePaths[i]);
-    }
+    // wait for the meshes and images, uploading each as it is ready
+    loader.Finish();
     selectedObj = 0;
 }
 
@@ -464,67 +778,215 @@ void CleanUp()
 }
 
 
-void DrawScene(bool drawAxes, bool clipped, float clipZ, bool drawWater,
+void DrawScene(int pass, bool drawAxes, bool clipped, float clipZ, bool drawWater,
     const glm::vec3& cameraPos, const glm::mat4& view, const glm::mat4& proj,
     const glm::mat4& lightViewProj);
 
 void DrawObjsToDepthTex(const glm::mat4 view, const glm::mat4 proj);
 
+void UpdateShadowCascades(bool sceneChanged, const glm::vec3& sceneMin, const glm::vec3& sceneMax);
+
+void UpdateOrbInstances();
+
+void UpdateLightBuffer();
+
+void DrawProfilerHud();
+
+void ReplayInput();
+
+void EndBenchFrame();
+
+
+//
+// (Re)allocate the reflection texture and depth buffer at the given size.
+// The texture has immutable storage, so it is recreated each time.
+//
+void ResizeReflectionFbo(int width, int height)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, reflectionFbo);
+
+    glEnable(GL_TEXTURE_2D);
+
+    if (reflectionWidth > 0) {
+        glDeleteTextures(1, &reflectionTex);
+        glDeleteRenderbuffers(1, &reflectionDepthTex);
+    }
+    reflectionWidth = width;
+    reflectionHeight = height;
+
+    // set up texture to render reflected scene to
+    glGenTextures(1, &reflectionTex);
+    glBindTexture(GL_TEXTURE_2D, reflectionTex);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // attach to fbo
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, reflectionTex, 0);
+
+    // depth buffer
+    glGenRenderbuffers(1, &reflectionDepthTex);
+    glBindRenderbuffer(GL_RENDERBUFFER, reflectionDepthTex);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
+    // attach to fbo
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, reflectionDepthTex);
+
+    GLenum drawBuffers[1] = {GL_COLOR_ATTACHMENT0};
+    glDrawBuffers(1, drawBuffers);
+
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("reflection fbo setup failed\n");
+        exit(1);
+    }
+
+    printf("reflection texture is %dx%d\n", width, height);
+    reflectionValid = false;
+}
+
+//
+// Whether the reflection has to be re-rendered this frame (see reflectionUpdateInterval).
+//
+bool IsReflectionDue(bool sceneChanged)
+{
+    if (!reflectionValid)
+        return true;
+    if (framesSinceReflectionUpdate < reflectionUpdateInterval)
+        return false;
+    if (!reflectionSkipStill || sceneChanged)
+        return true;
+
+    float turned = glm::degrees(glm::acos(glm::clamp(glm::dot(camera.getLook(), reflectionCameraLook), -1.0f, 1.0f)));
+    return glm::length(camera.getPosition() - reflectionCameraPos) > REFLECTION_MOVE_THRESHOLD ||
+           turned > REFLECTION_TURN_THRESHOLD;
+}
+
 
 //
 // Display the output image from our vertex and fragment shaders
 //
 void DisplayCallback()
 {
+    if (benchmarking)
+        ReplayInput();
+
+    profiler->BeginFrame();
+
     Camera lightCam;
     lightCam.setLens(0.1f, 10000.0f, 30.0f);
     lightCam.setAspect(1.0f);
     lightCam.setPosition(spotLightPosition);
     lightCam.setLook(lights[3].getDir());
 
+    // the shadow map is out of date if the light moved
+    glm::mat4 lightViewProj = lightCam.getViewProj();
+    bool shadowMapDirty = !shadowMapCaching || !shadowMapValid || lightViewProj != shadowMapLightViewProj;
+
+    // world-space bounds for culling; only recomputed for objs that moved.
+    // A moved obj also dirties the shadow map if it was or is now in the light frustum.
+    Frustum lightFrustum(lightViewProj);
+    bool objsMoved = false;
+    glm::vec3 sceneMin(1e30f), sceneMax(-1e30f);
+    for (size_t i=0; i < objs.size(); i++) {
+        if (objs[i].updateMatrices())
+            objMatrixUpdates++;
+        glm::vec3 oldBoundsMin = objs[i].boundsMin;
+        glm::vec3 oldBoundsMax = objs[i].boundsMax;
+        bool moved = objs[i].updateBounds();
+        sceneMin = glm::min(sceneMin, objs[i].boundsMin);
+        sceneMax = glm::max(sceneMax, objs[i].boundsMax);
+        if (!moved)
+            continue;
+        objsMoved = true;
+        if (!shadowMapDirty) {
+            shadowMapDirty = lightFrustum.intersectsBox(oldBoundsMin, oldBoundsMax) ||
+                             lightFrustum.intersectsBox(objs[i].boundsMin, objs[i].boundsMax);
+        }
+    }
+
 
     // render scene objs to depth tex for shadowmap #####################################################################################################################################################
     
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowFbo);
-    glViewport(0, 0, SHADOWMAP_TEX_WIDTH, SHADOWMAP_TEX_HEIGHT);
+    if (shadowMapDirty) {
+        STProfileScope scope(*profiler, "shadow");
 
-    glClear(GL_DEPTH_BUFFER_BIT);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowFbo);
+        glViewport(0, 0, SHADOWMAP_TEX_WIDTH, SHADOWMAP_TEX_HEIGHT);
+
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        DrawObjsToDepthTex(lightCam.getView(), lightCam.getProj());
+
+        shadowMapLightViewProj = lightViewProj;
+        shadowMapValid = true;
+    } else {
+        shadowPassesSkipped++;
+    }
 
-    DrawObjsToDepthTex(lightCam.getView(), lightCam.getProj());
+    {
+        STProfileScope scope(*profiler, "sun shadow");
+        UpdateShadowCascades(objsMoved || sceneEdited, sceneMin, sceneMax);
+    }
+
+    UpdateOrbInstances();
+    UpdateLightBuffer();
     
 
     // render mirrored scene to reflection tex ##########################################################################################################################################################
     
-    glBindFramebuffer(GL_FRAMEBUFFER, reflectionFbo);
-    glViewport(0, 0, REFTEX_SIZE, REFTEX_SIZE);
+    int reflectionScaledWidth = (std::max)(1, (int)(gWindowSizeX * reflectionScales[reflectionQuality] + 0.5f));
+    int reflectionScaledHeight = (std::max)(1, (int)(gWindowSizeY * reflectionScales[reflectionQuality] + 0.5f));
+    if (reflectionScaledWidth != reflectionWidth || reflectionScaledHeight != reflectionHeight) {
+        ResizeReflectionFbo(reflectionScaledWidth, reflectionScaledHeight);
+    }
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    framesSinceReflectionUpdate++;
+    bool reflectionDue = IsReflectionDue(objsMoved || sceneEdited);
+    sceneEdited = false;
+
+    if (reflectionDue) {
+        STProfileScope scope(*profiler, "reflection");
+
+        glBindFramebuffer(GL_FRAMEBUFFER, reflectionFbo);
+        glViewport(0, 0, reflectionWidth, reflectionHeight);
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     
-    // find height of water
-    glm::vec4 origin = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-    float waterZ = (objs[0].worldMat * origin).z;
+        // find height of water
+        glm::vec4 origin = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        float waterZ = (objs[0].worldMat * origin).z;
 
 
 
     
-    // calculate mirrored camera position
-    glm::vec3 cameraPosMirrored = camera.getPosition();
-    cameraPosMirrored.z = 2*waterZ - cameraPosMirrored.z;
-
-    // calculate mirrored view matrix
-    glm::mat4 reflectZ = glm::mat4( 1.0, 0.0, 0.0, 0.0,
-                                    0.0, 1.0, 0.0, 0.0,
-                                    0.0, 0.0, -1.0, 0.0,
-                                    0.0, 0.0, 0.0, 1.0 );
-    glm::vec3 translateZ(0.0f, 0.0f, waterZ);
-    glm::mat4 reflectWaterZ = glm::translate(translateZ) * reflectZ * glm::translate(-translateZ);
-    glm::mat4 viewMirrored = camera.getView() * reflectWaterZ;
-
-    // lightviewproj does not need to be mirrored since the worldpos of the fragments is unaffected (since we're just
-    // mirroring the view matrix).
-
-    DrawScene(false, true, waterZ, false, cameraPosMirrored, viewMirrored, camera.getProj(), lightCam.getViewProj());
+        // calculate mirrored camera position
+        glm::vec3 cameraPosMirrored = camera.getPosition();
+        cameraPosMirrored.z = 2*waterZ - cameraPosMirrored.z;
+
+        // calculate mirrored view matrix
+        glm::mat4 reflectZ = glm::mat4( 1.0, 0.0, 0.0, 0.0,
+                                        0.0, 1.0, 0.0, 0.0,
+                                        0.0, 0.0, -1.0, 0.0,
+                                        0.0, 0.0, 0.0, 1.0 );
+        glm::vec3 translateZ(0.0f, 0.0f, waterZ);
+        glm::mat4 reflectWaterZ = glm::translate(translateZ) * reflectZ * glm::translate(-translateZ);
+        glm::mat4 viewMirrored = camera.getView() * reflectWaterZ;
+
+        // lightviewproj does not need to be mirrored since the worldpos of the fragments is unaffected (since we're just
+        // mirroring the view matrix).
+
+        // everything below the water is clipped away by the near plane of the reflection's projection (see DrawScene)
+
+        DrawScene(REFLECTION_PASS, false, true, waterZ, false, cameraPosMirrored, viewMirrored, camera.getProj(), lightCam.getViewProj());
+
+        reflectionValid = true;
+        framesSinceReflectionUpdate = 0;
+        reflectionCameraPos = camera.getPosition();
+        reflectionCameraLook = camera.getLook();
+        reflectionViewProj = camera.getProj() * glm::mat4(glm::mat3(camera.getView()));
+        reflectionUpdates++;
+    }
     
 
 
@@ -536,54 +998,450 @@ void DisplayCallback()
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     
 
-    DrawScene(axes, false, 0.0f, true, camera.getPosition(), camera.getView(), camera.getProj(), lightCam.getViewProj());
+    DrawScene(MAIN_PASS, axes, false, 0.0f, true, camera.getPosition(), camera.getView(), camera.getProj(), lightCam.getViewProj());
 
-    glutSwapBuffers();
-    glutPostRedisplay();
+    if (showHud)
+        DrawProfilerHud();
+
+    // read back the frame before it is swapped away
+    if (screenshotRequested) {
+        char filename[32];
+        sprintf(filename, "screenshot%03d.jpg", screenshots++);
+        frameCapture->Capture(gWindowSizeX, gWindowSizeY, filename);
+        screenshotRequested = false;
+    }
+    if (recording) {
+        char filename[32];
+        sprintf(filename, "frame%05d.jpg", recordedFrames++);
+        frameCapture->Capture(gWindowSizeX, gWindowSizeY, filename);
+    }
+    frameCapture->Update();
+
+    if (headless)
+        glFinish();
+    else
+        glutSwapBuffers();
+
+    profiler->EndFrame();
+
+    if (inputRecording)
+        recordingFrames++;
+    if (benchmarking)
+        EndBenchFrame();
+
+    if (timedFramesLeft > 0) {
+        timedFramesMillis += frameTimer.GetElapsedMillis();
+        timedFramesShaderCalls += STShaderProgram::sNumGLCalls;
+        STShaderProgram::sNumGLCalls = 0;
+        frameTimer.Reset();
+        if (--timedFramesLeft == 0) {
+            printf("%s: %.3f ms/frame, %.1f shader GL calls/frame over %d frames\n",
+                timedFramesLabel.c_str(), timedFramesMillis / NUM_TIMED_FRAMES,
+                (float)timedFramesShaderCalls / NUM_TIMED_FRAMES, NUM_TIMED_FRAMES);
+            for (int i = 0; i < NUM_PASSES; i++) {
+                printf("    %s pass: %.1f meshes drawn, %.1f culled per frame\n", passNames[i],
+                    (float)passMeshesDrawn[i] / NUM_TIMED_FRAMES, (float)passMeshesCulled[i] / NUM_TIMED_FRAMES);
+            }
+            printf("    shadow pass skipped in %u of %d frames\n", shadowPassesSkipped, NUM_TIMED_FRAMES);
+            printf("    %s: %.2f of %d cascades re-rendered per frame\n", cascadeModeNames[cascadeMode],
+                (float)cascadeRenders / NUM_TIMED_FRAMES, NUM_CASCADES);
+            if (clusterBuilds > 0) {
+                printf("    %d point lights: clustered in %.2f ms per pass, %.1f light refs per pass, at most %u lights in a cluster",
+                    (int)lights.size() - NUM_DIRLIGHTS, clusterMillis / clusterBuilds,
+                    (float)clusterLightRefs / clusterBuilds, clusterMaxLights);
+                if (clusterDroppedRefs > 0)
+                    printf(" (%.1f refs over the limit dropped per pass)", (float)clusterDroppedRefs / clusterBuilds);
+                printf("\n");
+            }
+            printf("    %d light records uploaded in %u of %d frames, %.1f KB per frame\n", lightBuffer.numLights(),
+                lightUploads, NUM_TIMED_FRAMES, lightTexelsUploaded * 16.0f / 1024.0f / NUM_TIMED_FRAMES);
+            printf("    %u obj matrices recomputed over %d frames\n", objMatrixUpdates, NUM_TIMED_FRAMES);
+            printf("    reflection (%dx%d) re-rendered in %u of %d frames\n", reflectionWidth, reflectionHeight,
+                reflectionUpdates, NUM_TIMED_FRAMES);
+        }
+    }
+
+    if (!headless)
+        glutPostRedisplay();
+}
+
+
+//
+// Frustum tests of an obj and of one of its meshes, counted in the stats of
+// the given pass. A culled obj counts all of its meshes as culled, so only
+// call isMeshVisible() for the meshes of visible objs.
+//
+bool isObjVisible(const Obj& obj, const Frustum& frustum, int pass)
+{
+    if (!frustumCulling || frustum.intersectsBox(obj.boundsMin, obj.boundsMax))
+        return true;
+    passMeshesCulled[pass] += (unsigned int)obj.stMeshes.size();
+    return false;
+}
+
+bool isMeshVisible(const Obj& obj, size_t j, const Frustum& frustum, int pass)
+{
+    if (frustumCulling && !frustum.intersectsBox(obj.meshBoundsMin[j], obj.meshBoundsMax[j])) {
+        passMeshesCulled[pass]++;
+        return false;
+    }
+    passMeshesDrawn[pass]++;
+    return true;
+}
+
+//
+// Blur the shadow depth moments in momentsTex, horizontally into
+// momentsBlurTex and then vertically back.
+//
+void BlurShadowMoments()
+{
+    glDisable(GL_DEPTH_TEST);
+    blurShader->Bind();
+    blurShader->SetTexture("tex", 7);
+    glActiveTexture(GL_TEXTURE7);
+
+    for (int pass = 0; pass < 2; pass++) {
+        glBindFramebuffer(GL_FRAMEBUFFER, pass == 0 ? momentsBlurFbo : shadowFbo);
+        glBindTexture(GL_TEXTURE_2D, pass == 0 ? momentsTex : momentsBlurTex);
+        if (pass == 0) {
+            blurShader->SetUniform("texelStep", 1.0f / SHADOWMAP_TEX_WIDTH, 0.0f);
+        } else {
+            blurShader->SetUniform("texelStep", 0.0f, 1.0f / SHADOWMAP_TEX_HEIGHT);
+        }
+
+        glBegin(GL_TRIANGLE_STRIP);
+        glVertex2f(-1.0f, -1.0f);
+        glVertex2f(1.0f, -1.0f);
+        glVertex2f(-1.0f, 1.0f);
+        glVertex2f(1.0f, 1.0f);
+        glEnd();
+    }
+
+    blurShader->UnBind();
+    glEnable(GL_DEPTH_TEST);
+}
+
+//
+// Fill objModelViews with view * worldMat of every obj, all in one go at the
+// start of a pass.
+//
+void UpdateModelViews(const glm::mat4& view)
+{
+    objModelViews.resize(objs.size());
+    for (size_t i=0; i < objs.size(); i++) {
+        objModelViews[i] = multiplyMatrices(view, objs[i].worldMat);
+    }
+}
+
+//
+// Draw the objs in the frustum of proj * view with shadowMapShader, which
+// must be bound, counted in the stats of the given pass.
+//
+void DrawObjDepths(const glm::mat4& view, const glm::mat4& proj, int pass)
+{
+    shadowMapShader->SetUniformMatrix("projMat", glm::value_ptr(proj));
+    STShaderProgram::Uniform modelViewMatUniform = shadowMapShader->GetUniform("modelViewMat");
+
+    UpdateModelViews(view);
+
+    // draw objs
+    Frustum frustum(proj * view);
+
+    for (size_t i=0; i < objs.size(); i++) {
+        if (!isObjVisible(objs[i], frustum, pass))
+            continue;
+
+        shadowMapShader->SetUniformMatrix(modelViewMatUniform, glm::value_ptr(objModelViews[i]));
+        
+        std::vector<STTriangleMesh*>& stMeshes = objs[i].stMeshes;
+        for (int j=0; j < stMeshes.size(); j++) {
+            if (isMeshVisible(objs[i], j, frustum, pass))
+                stMeshes[j]->Draw(smooth);
+        }
+    }
+}
+
+void DrawObjsToDepthTex(const glm::mat4 view, const glm::mat4 proj) {
+    // shadow map: render objs from spotlight perspective to depth texture
+
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowFbo);
+    glViewport(0, 0, SHADOWMAP_TEX_WIDTH, SHADOWMAP_TEX_HEIGHT);
+
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    // the moments of empty texels are as far away as the light's far plane
+    bool variance = (shadowFilter == SHADOW_VARIANCE);
+    glDrawBuffer(variance ? GL_COLOR_ATTACHMENT0 : GL_NONE);
+    if (variance) {
+        const float farMoments[4] = { 10000.0f, 10000.0f * 10000.0f, 0.0f, 0.0f };
+        glClearBufferfv(GL_COLOR, 0, farMoments);
+    }
+
+    shadowMapShader->Bind();
+
+    glPolygonOffset(-10.0f, -100.0f);
+
+    DrawObjDepths(view, proj, SHADOW_PASS);
+
+    glPolygonOffset(0.0f, 0.0f);
+
+    shadowMapShader->UnBind();
+
+    if (variance) {
+        BlurShadowMoments();
+    }
 }
 
+//
+// View and orthographic projection of the sun that cover slice i of the
+// camera's view frustum, with the near and far planes around the whole scene
+// (sceneMin to sceneMax) so that casters outside the slice are kept. The
+// projection only moves by whole texels as the camera moves and its size
+// does not change as the camera turns, so shadow edges do not shimmer.
+//
+void FitCascade(int i, const glm::vec3& sceneMin, const glm::vec3& sceneMax, glm::mat4& view, glm::mat4& proj)
+{
+    // slice bounds, between logarithmic and uniform spacing
+    float n = camera.getNearPlane();
+    float f = CASCADE_MAX_DIST;
+    float splits[2];
+    for (int s = 0; s < 2; s++) {
+        float t = (float)(i + s) / NUM_CASCADES;
+        splits[s] = CASCADE_SPLIT_LAMBDA * n * glm::pow(f / n, t) + (1.0f - CASCADE_SPLIT_LAMBDA) * (n + (f - n) * t);
+    }
+    glm::vec3 center;
+    float radius;
+    camera.getSliceBoundingSphere(splits[0], splits[1], center, radius);
+
+    glm::vec3 lightDir = lights[0].getDir();
+    glm::vec3 up = glm::abs(lightDir.z) > 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+    view = glm::lookAt(glm::vec3(0.0f), lightDir, up);
+
+    // snap the center to the texel grid
+    float texelSize = 2.0f * radius / CASCADE_TEX_SIZE;
+    glm::vec3 lightCenter = glm::vec3(view * glm::vec4(center, 1.0f));
+    lightCenter.x = glm::floor(lightCenter.x / texelSize) * texelSize;
+    lightCenter.y = glm::floor(lightCenter.y / texelSize) * texelSize;
+
+    float zMin = 1e30f, zMax = -1e30f;
+    for (int k = 0; k < 8; k++) {
+        glm::vec3 corner((k & 1) ? sceneMax.x : sceneMin.x, (k & 2) ? sceneMax.y : sceneMin.y, (k & 4) ? sceneMax.z : sceneMin.z);
+        float z = (view * glm::vec4(corner, 1.0f)).z;
+        zMin = (std::min)(zMin, z);
+        zMax = (std::max)(zMax, z);
+    }
+
+    // the light looks down -z
+    proj = glm::ortho(lightCenter.x - radius, lightCenter.x + radius, lightCenter.y - radius, lightCenter.y + radius,
+                      -zMax - 1.0f, -zMin + 1.0f);
+}
+
+//
+// Re-render the sun shadow cascades that are due this frame (see cascadeMode);
+// all of them if anything in the scene changed.
+//
+void UpdateShadowCascades(bool sceneChanged, const glm::vec3& sceneMin, const glm::vec3& sceneMax)
+{
+    if (cascadeMode == CASCADES_OFF) {
+        cascadesValid = false;
+        return;
+    }
+    bool renderAll = !cascadesValid || sceneChanged || cascadeMode == CASCADES_EVERY_FRAME;
+    cascadeFrame++;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, cascadeFbo);
+    glViewport(0, 0, CASCADE_TEX_SIZE, CASCADE_TEX_SIZE);
+
+    shadowMapShader->Bind();
+
+    // slope-scaled depth bias against shadow acne
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+
+    for (int i = 0; i < NUM_CASCADES; i++) {
+        // cascade i is due every 2^i frames, half a period after cascade i-1
+        unsigned int period = 1u << i;
+        if (!renderAll && cascadeFrame % period != period / 2)
+            continue;
+
+        glm::mat4 view, proj;
+        FitCascade(i, sceneMin, sceneMax, view, proj);
+        cascadeViewProj[i] = proj * view;
+
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cascadeTex, 0, i);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        DrawObjDepths(view, proj, CASCADE_PASS);
+        cascadeRenders++;
+    }
+
+    glPolygonOffset(0.0f, 0.0f);
+    glDisable(GL_POLYGON_OFFSET_FILL);
+
+    shadowMapShader->UnBind();
+    cascadesValid = true;
+}
+
+
+//
+// Value of the normalMapping uniform for a mesh: -1 without a normal map,
+// 2 if the map is BC5 compressed (the shader has to rebuild z), else 1.
+//
+float NormalMappingMode(const STTriangleMesh* mesh)
+{
+    if (!mesh->mHasNormalMap)
+        return -1.0f;
+    mesh->UploadTextures();
+    return mesh->mSurfaceNormalTex->IsTwoChannel() ? 2.0f : 1.0f;
+}
+
+//
+// Projection for the objs in a pass whose view is mirrored about the water at
+// clipZ: the near plane of proj is replaced by the water plane, so that the
+// hardware clips everything below the water. If the eye is not above the
+// water (the mirrored eye is not below it), proj is returned unchanged.
+//
+glm::mat4 WaterClippedProj(const glm::mat4& view, const glm::mat4& proj, float clipZ)
+{
+    // planes transform by the inverse transpose
+    glm::vec4 waterPlane = glm::transpose(glm::inverse(view)) * glm::vec4(0.0f, 0.0f, 1.0f, -clipZ);
+    if (waterPlane.w >= 0.0f)
+        return proj;
+    return Camera::getObliqueProj(proj, waterPlane);
+}
+
+//
+// Upload the positions of the point-light orbs if any of the lights moved,
+// was added or was removed.
+//
+void UpdateOrbInstances()
+{
+    static std::vector<glm::vec4> instances;
+    instances.clear();
+    for (size_t i = NUM_DIRLIGHTS; i < lights.size(); i++) {
+        instances.push_back(glm::vec4(lights[i].az, lights[i].el, lights[i].scale, ORB_SIZE));
+    }
+    if (instances == orbInstances)
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, orbInstanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::vec4), instances.empty() ? 0 : &instances[0], GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    orbInstances = instances;
+}
 
-void DrawObjsToDepthTex(const glm::mat4 view, const glm::mat4 proj) {
-    // shadow map: render objs from spotlight perspective to depth texture
+//
+// Make the light records of this frame, and upload them if a light changed.
+//
+void UpdateLightBuffer()
+{
+    lightBuffer.clear();
+    for (int i = 0; i < NUM_DIRLIGHTS; i++) {
+        LightBuffer::Light light;
+        bool spot = i == NUM_DIRLIGHTS - 1;
+        light.type = spot ? LightBuffer::SPOT : LightBuffer::DIRECTIONAL;
+        light.position = spot ? spotLightPosition : glm::vec3(0.0f);
+        light.direction = lights[i].getDir();
+        light.radius = spot ? SPOTLIGHT_RANGE : 0.0f;
+        light.diffuse = lights[i].scale * lights[i].color;
+        light.specular = lights[i].specular * lights[i].color;
+        light.ambient = lights[i].ambient;
+        light.shadow = spot ? LightBuffer::SPOT_SHADOW : i == 0 ? LightBuffer::SUN_SHADOW : LightBuffer::NO_SHADOW;
+        lightBuffer.add(light);
+    }
+    for (size_t i = NUM_DIRLIGHTS; i < lights.size(); i++) {
+        LightBuffer::Light light;
+        light.type = LightBuffer::POINT;
+        light.position = glm::vec3(lights[i].az, lights[i].el, lights[i].scale);
+        light.direction = glm::vec3(0.0f);
+        light.radius = POINTLIGHT_RADIUS;
+        light.diffuse = lights[i].color;
+        light.specular = lights[i].specular * lights[i].color;
+        light.ambient = lights[i].ambient;
+        light.shadow = LightBuffer::NO_SHADOW;
+        lightBuffer.add(light);
+    }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowFbo);
-    glViewport(0, 0, SHADOWMAP_TEX_WIDTH, SHADOWMAP_TEX_HEIGHT);
+    int texels = lightBuffer.update();
+    if (texels > 0) {
+        lightUploads++;
+        lightTexelsUploaded += texels;
+    }
+}
 
-    glClear(GL_DEPTH_BUFFER_BIT);
+//
+// Draw the mean, 95th percentile and worst CPU and GPU times of each pass over
+// the last 120 frames in the top left corner, or print them every 120 frames
+// if there is no font.
+//
+void DrawProfilerHud()
+{
+    std::vector<std::string> lines;
+    char line[128];
+    sprintf(line, "%-11s %8s %7s %7s", "ms", "cpu mean", "p95", "max");
+    lines.push_back(line);
+    if (profiler->HasGPUTimes()) {
+        sprintf(line, "   %8s %7s %7s", "gpu mean", "p95", "max");
+        lines.back() += line;
+    }
+    for (int i = 0; i < profiler->GetNumSections(); i++) {
+        STProfiler::Stats cpu = profiler->GetCPUStats(i);
+        sprintf(line, "%-11s %8.2f %7.2f %7.2f", profiler->GetName(i).c_str(), cpu.mean, cpu.p95, cpu.max);
+        lines.push_back(line);
+        if (profiler->HasGPUTimes()) {
+            STProfiler::Stats gpu = profiler->GetGPUStats(i);
+            sprintf(line, "   %8.2f %7.2f %7.2f", gpu.mean, gpu.p95, gpu.max);
+            lines.back() += line;
+        }
+    }
 
-    shadowMapShader->Bind();
+    if (!hudFont) {
+        if (hudFramesShown++ % 120 == 0) {
+            for (size_t i = 0; i < lines.size(); i++)
+                printf("%s\n", lines[i].c_str());
+        }
+        return;
+    }
 
-    glPolygonOffset(-10.0f, -100.0f);
+    glPushAttrib(GL_ENABLE_BIT);
+    glDisable(GL_DEPTH_TEST);
+    for (int unit = 0; unit < 12; unit++) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glDisable(GL_TEXTURE_2D);
+    }
+    glActiveTexture(GL_TEXTURE0);
 
     glMatrixMode(GL_PROJECTION);
-    glLoadMatrixf(glm::value_ptr(proj));
-
-    // draw objs
+    glLoadIdentity();
+    glOrtho(0.0, gWindowSizeX, 0.0, gWindowSizeY, -1.0, 1.0);
     glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
 
-    for (size_t i=0; i < objs.size(); i++) {
-        glm::mat4 modelView = view * objs[i].worldMat;
-        glLoadMatrixf(glm::value_ptr(modelView));
-        
-        std::vector<STTriangleMesh*>& stMeshes = objs[i].stMeshes;
-        for (int j=0; j < stMeshes.size(); j++) {
-            stMeshes[j]->Draw(smooth);
-        }
+    float lineHeight = hudFont->GetHeight();
+    for (size_t i = 0; i < lines.size(); i++) {
+        glLoadIdentity();
+        glTranslatef(10.0f, gWindowSizeY - 10.0f - (i + 1) * lineHeight, 0.0f);
+        hudFont->DrawString(lines[i], STColor4f(1.0f, 1.0f, 1.0f, 1.0f));
     }
 
-    glPolygonOffset(0.0f, 0.0f);
-
-    shadowMapShader->UnBind();
+    glPopAttrib();
 }
 
-
-
-void DrawScene(bool drawAxes, bool clipped, float clipZ, bool drawWater,
+void DrawScene(int pass, bool drawAxes, bool clipped, float clipZ, bool drawWater,
         const glm::vec3& cameraPos, const glm::mat4& view, const glm::mat4& proj,
         const glm::mat4& lightViewProj) {
 
+    // the environment cube around the eye is below the water in a mirrored pass,
+    // so only the objs and billboards are drawn with the clipping projection
+    glm::mat4 sceneProj = clipped ? WaterClippedProj(view, proj, clipZ) : proj;
+
+    // the main pass is profiled part by part; the other passes are profiled as a whole
+    bool profiled = pass == MAIN_PASS;
+
     // render environment and XYZ axes ===============================================================================================================
     {
+        if (profiled)
+            profiler->Begin("skybox");
+
         environmentShader->Bind();
 
         // draw environment using cubemap
@@ -601,15 +1459,10 @@ void DrawScene(bool drawAxes, bool clipped, float clipZ, bool drawWater,
 
 
             // set matrices
-            glMatrixMode(GL_PROJECTION);
-            glLoadMatrixf(glm::value_ptr(proj));
-
-            glMatrixMode(GL_MODELVIEW);
-            glm::mat4 modelMat = glm::translate(cameraPos);
-            glLoadMatrixf(glm::value_ptr(view * modelMat));    // cube will be drawn around camera
-
-            GLint modelMatLocation = environmentShader->GetUniformLocation("modelMat");
-            glUniformMatrix4fv(modelMatLocation, 1, false, glm::value_ptr(modelMat));
+            glm::mat4 modelMat = glm::translate(cameraPos);     // cube will be drawn around camera
+            environmentShader->SetUniformMatrix("projMat", glm::value_ptr(proj));
+            environmentShader->SetUniformMatrix("modelViewMat", glm::value_ptr(view * modelMat));
+            environmentShader->SetUniformMatrix("modelMat", glm::value_ptr(modelMat));
 
             const float s = 1.0f;
 
@@ -647,11 +1500,7 @@ void DrawScene(bool drawAxes, bool clipped, float clipZ, bool drawWater,
     
         // draw world XYZ reference axes
         if (drawAxes) {
-            glMatrixMode(GL_PROJECTION);
-            glLoadMatrixf(glm::value_ptr(proj));
-
-            glMatrixMode(GL_MODELVIEW);
-            glLoadMatrixf(glm::value_ptr(view));
+            environmentShader->SetUniformMatrix("modelViewMat", glm::value_ptr(view));
 
             environmentShader->SetUniform("overrideWithColor", 1.0f);
 
@@ -680,6 +1529,8 @@ void DrawScene(bool drawAxes, bool clipped, float clipZ, bool drawWater,
 
         environmentShader->UnBind();
 
+        if (profiled)
+            profiler->End();
     }
     
 
@@ -687,6 +1538,9 @@ void DrawScene(bool drawAxes, bool clipped, float clipZ, bool drawWater,
     // render models  ========================================================================================================================================================================================
 
     {
+        if (profiled)
+            profiler->Begin("scene");
+
         shader->Bind();
         
         // displacement mapping not supported
@@ -703,22 +1557,14 @@ void DrawScene(bool drawAxes, bool clipped, float clipZ, bool drawWater,
         //shader->SetTexture("reflTex", 4); // only needed if drawing water
         shader->SetTexture("depthTex", 5);
         shader->SetTexture("spotTex", 6);
+        shader->SetTexture("momentsTex", 7);
+        shader->SetTexture("cascadeTex", 8);
 
+        shader->SetUniform("shadowFilter", (float)shadowFilter);
+        shader->SetUniformInt("shadowTaps", shadowTaps);
+        shader->SetUniformArray("poissonDisk", poissonDisk, MAX_SHADOW_TAPS, 2);
 
-        glMatrixMode(GL_PROJECTION);
-        glLoadMatrixf(glm::value_ptr(proj));
-    
-    
-
-        // load light positions
-        // since phong.frag needs these in world space (which they're in already) but OpenGL
-        // will automatically transform these to view space, we want GL_MODELVIEW to be identity.
-
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-
-
-        setDirectionalLightAttribs();
+        shader->SetUniformMatrix("projMat", glm::value_ptr(sceneProj));
 
 
         // bind cubemap
@@ -734,30 +1580,43 @@ void DrawScene(bool drawAxes, bool clipped, float clipZ, bool drawWater,
         glActiveTexture(GL_TEXTURE6);
         glEnable(GL_TEXTURE_2D);
         glBindTexture(GL_TEXTURE_2D, spotTex);
+
+        glActiveTexture(GL_TEXTURE7);
+        glBindTexture(GL_TEXTURE_2D, momentsTex);
+
+        // bind the sun's shadow cascades
+        glActiveTexture(GL_TEXTURE8);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, cascadeTex);
+        shader->SetUniform("sunShadows", cascadeMode != CASCADES_OFF ? 1.0f : -1.0f);
+        shader->SetUniformMatrix("cascadeViewProjMat", glm::value_ptr(cascadeViewProj[0]), NUM_CASCADES);
+        shader->SetUniform("cascadeTexelSize", 1.0f / CASCADE_TEX_SIZE);
     
         // set world eye pos
         shader->SetUniform("eyePosWorld", STColor3f(cameraPos.x, cameraPos.y, cameraPos.z));
-        // get location of modelmat uniforms
-        GLint modelMatLocation = shader->GetUniformLocation("modelMat");
-	    GLint modelMatInvTransLocation = shader->GetUniformLocation("modelMatInvTrans");
+        // get handles of the per-obj and per-mesh uniforms
+        STShaderProgram::Uniform modelViewMatUniform = shader->GetUniform("modelViewMat");
+        STShaderProgram::Uniform modelMatUniform = shader->GetUniform("modelMat");
+        STShaderProgram::Uniform modelMatInvTransUniform = shader->GetUniform("modelMatInvTrans");
+        STShaderProgram::Uniform normalMappingUniform = shader->GetUniform("normalMapping");
+        STShaderProgram::Uniform colorMappingUniform = shader->GetUniform("colorMapping");
 
         // set viewproj matrix of shadow-casting light (spotlight)
-        GLint lightViewProjMatUniformLocation = shader->GetUniformLocation("lightViewProjMat");
-        glUniformMatrix4fv(lightViewProjMatUniformLocation, 1, false, glm::value_ptr(lightViewProj));
+        shader->SetUniformMatrix("lightViewProjMat", glm::value_ptr(lightViewProj));
 
 
-        // set light attribs
-        GLint pointLightPosUniformLocation = shader->GetUniformLocation("pointLightPos");
-        setPointLightAttribs(pointLightPosUniformLocation);
+        // set light attribs; the clusters are laid out on the screen by proj,
+        // sceneProj only differs from it in depth
+        setLightAttribs(view, proj);
 
 
         // draw objs
-        glMatrixMode(GL_MODELVIEW);
+        UpdateModelViews(view);
+
+        Frustum frustum(sceneProj * view);
 
         // draw water
-        if (drawWater) {
+        if (drawWater && isObjVisible(objs[0], frustum, pass)) {
             shader->SetUniform("cubeMapping", -1.0f);   // use refl tex
-            shader->SetUniform("clipping", -1.0f);      // disable clipping
 
             shader->SetTexture("reflTex", 4);
 
@@ -767,21 +1626,20 @@ void DrawScene(bool drawAxes, bool clipped, float clipZ, bool drawWater,
 
 
             int i = 0;      // water should be first entry in scene.txt
-            glm::mat4 modelView = view * objs[i].worldMat;
-            glLoadMatrixf(glm::value_ptr(modelView));
+            shader->SetUniformMatrix(modelViewMatUniform, glm::value_ptr(objModelViews[i]));
+            shader->SetUniformMatrix(modelMatUniform, glm::value_ptr(objs[i].worldMat));
+            shader->SetUniformMatrix(modelMatInvTransUniform, glm::value_ptr(objs[i].normalMat));
 
-            GLint viewMatUniformLocation = shader->GetUniformLocation("viewMat");
-            glUniformMatrix4fv(viewMatUniformLocation, 1, false, glm::value_ptr(view));
+            shader->SetUniformMatrix("viewMat", glm::value_ptr(view));
+            shader->SetUniformMatrix("reflViewProjMat", glm::value_ptr(reflectionViewProj));
         
             std::vector<STTriangleMesh*>& stMeshes = objs[i].stMeshes;
             for (int j=0; j < stMeshes.size(); j++) {
+                if (!isMeshVisible(objs[i], j, frustum, pass))
+                    continue;
             
-                glm::mat4 invTrans = glm::transpose(glm::inverse(objs[i].worldMat));
-                glUniformMatrix4fv(modelMatLocation, 1, false, glm::value_ptr(objs[i].worldMat));
-                glUniformMatrix4fv(modelMatInvTransLocation, 1, false, glm::value_ptr(invTrans));
-
-                shader->SetUniform("normalMapping", stMeshes[j]->mHasNormalMap ? 1.0 : -1.0);
-                shader->SetUniform("colorMapping", stMeshes[j]->mHasColorMap ? 1.0 : -1.0);
+                shader->SetUniform(normalMappingUniform, NormalMappingMode(stMeshes[j]));
+                shader->SetUniform(colorMappingUniform, stMeshes[j]->mHasColorMap ? 1.0f : -1.0f);
             
                 stMeshes[j]->Draw(smooth);
             }
@@ -790,97 +1648,90 @@ void DrawScene(bool drawAxes, bool clipped, float clipZ, bool drawWater,
         // draw other objs
     
         shader->SetUniform("cubeMapping", 1.0);                     // don't use refl tex
-        if (clipped) {                                              // set clipping
-            shader->SetUniform("clipping", 1.0f);                   
-            shader->SetUniform("clipZ", clipZ);
-        } else {
-            shader->SetUniform("clipping", -1.0f);
-        }
 
         for (size_t i=1; i < objs.size(); i++) {
-            glm::mat4 modelView = view * objs[i].worldMat;
-            glLoadMatrixf(glm::value_ptr(modelView));
+            // objs entirely below the water would be clipped anyway
+            if (clipped && objs[i].boundsMax.z <= clipZ) {
+                passMeshesCulled[pass] += (unsigned int)objs[i].stMeshes.size();
+                continue;
+            }
+            if (!isObjVisible(objs[i], frustum, pass))
+                continue;
+
+            shader->SetUniformMatrix(modelViewMatUniform, glm::value_ptr(objModelViews[i]));
+            shader->SetUniformMatrix(modelMatUniform, glm::value_ptr(objs[i].worldMat));
+            shader->SetUniformMatrix(modelMatInvTransUniform, glm::value_ptr(objs[i].normalMat));
         
             std::vector<STTriangleMesh*>& stMeshes = objs[i].stMeshes;
             for (int j=0; j < stMeshes.size(); j++) {
+                if (!isMeshVisible(objs[i], j, frustum, pass))
+                    continue;
             
-                glm::mat4 invTrans = glm::transpose(glm::inverse(objs[i].worldMat));
-                glUniformMatrix4fv(modelMatLocation, 1, false, glm::value_ptr(objs[i].worldMat));
-                glUniformMatrix4fv(modelMatInvTransLocation, 1, false, glm::value_ptr(invTrans));
-
-                shader->SetUniform("normalMapping", stMeshes[j]->mHasNormalMap ? 1.0 : -1.0);
-                shader->SetUniform("colorMapping", stMeshes[j]->mHasColorMap ? 1.0 : -1.0);
+                shader->SetUniform(normalMappingUniform, NormalMappingMode(stMeshes[j]));
+                shader->SetUniform(colorMappingUniform, stMeshes[j]->mHasColorMap ? 1.0f : -1.0f);
             
                 stMeshes[j]->Draw(smooth);
             }
         }
 
         shader->UnBind();
+
+        if (profiled)
+            profiler->End();
     }
 
 
     // render billboards  ========================================================================================================================================================================================
     {
-        textureShader->Bind();
+        if (profiled)
+            profiler->Begin("billboards");
 
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
         glDepthMask(GL_FALSE);  // disable depth writes so billboards after this will not be occluded
 
-        textureShader->SetUniform("clipping", clipped ? 1.0f : -1.0f);
-        textureShader->SetUniform("clipZ", clipZ);
-        textureShader->SetUniform("alphaScale", 1.0f);
-
-        textureShader->SetTexture("colorTex", 4);
-
         glActiveTexture(GL_TEXTURE4);
         glEnable(GL_TEXTURE_2D);
         glBindTexture(GL_TEXTURE_2D, orbBillboardTex);
-    
 
-        glMatrixMode(GL_PROJECTION);
-        glLoadMatrixf(glm::value_ptr(proj));
 
+        // render pointlight orbs, each turned to face the eye in billboard.vert
+        if (!orbInstances.empty()) {
+            billboardShader->Bind();
 
-        GLint modelMatLocation = textureShader->GetUniformLocation("modelMat");
-        
-        // render pointlight orbs
-        for (int i = 4; i < NUMLIGHTS; i++) {
-        
-            // calculate phi, theta of direction to camera from light pos
-            glm::vec3 lightPos(lights[i].az, lights[i].el, lights[i].scale);
-            glm::vec3 toEye = glm::normalize(cameraPos - lightPos);
-            float phi = glm::degrees(glm::acos(toEye.z));
-            float theta = glm::degrees(glm::atan(toEye.y, toEye.x));
-
-            // calculate world matrix to aim the Z-axis of billboard space at 
-            glm::mat4 worldMat;
-            worldMat = glm::translate(worldMat, lightPos);                 // translate to lightpos
-            worldMat = glm::rotate(worldMat, theta, glm::vec3(0.0f, 0.0f, 1.0f));               // theta
-            worldMat = glm::rotate(worldMat, phi, glm::vec3(0.0f, 1.0f, 0.0f));    // phi
-        
-            glMatrixMode(GL_MODELVIEW);
-            glLoadMatrixf(glm::value_ptr(view * worldMat));
+            billboardShader->SetUniformMatrix("projMat", glm::value_ptr(sceneProj));
+            billboardShader->SetUniformMatrix("modelViewMat", glm::value_ptr(view));
 
-            glUniformMatrix4fv(modelMatLocation, 1, false, glm::value_ptr(worldMat));
+            billboardShader->SetUniform("alphaScale", 1.0f);
+            billboardShader->SetTexture("colorTex", 4);
+            billboardShader->SetUniform("eyePosWorld", STColor3f(cameraPos.x, cameraPos.y, cameraPos.z));
 
-            float s = 4.0f;
-            glBegin(GL_TRIANGLE_STRIP);
-            glTexCoord2f(1.0f, 0.0f);
-            glVertex3f(s, -s, 0.0f);
-            glTexCoord2f(1.0f, 1.0f);
-            glVertex3f(s, s, 0.0f);
-            glTexCoord2f(0.0f, 0.0f);
-            glVertex3f(-s, -s, 0.0f);
-            glTexCoord2f(0.0f, 1.0f);
-            glVertex3f(-s, s, 0.0f);
-            glEnd();
+            glBindBuffer(GL_ARRAY_BUFFER, billboardQuadBuffer);
+            glEnableVertexAttribArray(billboardCornerAttrib);
+            glVertexAttribPointer(billboardCornerAttrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+            glBindBuffer(GL_ARRAY_BUFFER, orbInstanceBuffer);
+            glEnableVertexAttribArray(billboardInstanceAttrib);
+            glVertexAttribPointer(billboardInstanceAttrib, 4, GL_FLOAT, GL_FALSE, 0, 0);
+            glVertexAttribDivisor(billboardInstanceAttrib, 1);
+
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)orbInstances.size());
+
+            glVertexAttribDivisor(billboardInstanceAttrib, 0);
+            glDisableVertexAttribArray(billboardInstanceAttrib);
+            glDisableVertexAttribArray(billboardCornerAttrib);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            billboardShader->UnBind();
         }
 
         
         // render spotlight beam
         {
+            textureShader->Bind();
+
+            textureShader->SetTexture("colorTex", 4);
             textureShader->SetUniform("alphaScale", 0.375f);
 
             // bind beam texture
@@ -899,9 +1750,8 @@ void DrawScene(bool drawAxes, bool clipped, float clipZ, bool drawWater,
                                 glm::vec4(zDir, 0.0f),
                                 glm::vec4(spotLightPosition, 1.0f));
 
-
-            glMatrixMode(GL_MODELVIEW);
-            glLoadMatrixf(glm::value_ptr(view * worldMat));
+            textureShader->SetUniformMatrix("projMat", glm::value_ptr(sceneProj));
+            textureShader->SetUniformMatrix("modelViewMat", glm::value_ptr(view * worldMat));
 
 
             float w_half = 60.0f;   // width at wide end
@@ -925,6 +1775,9 @@ void DrawScene(bool drawAxes, bool clipped, float clipZ, bool drawWater,
         glDisable(GL_BLEND);
 
         textureShader->UnBind();
+
+        if (profiled)
+            profiler->End();
     }
 }
 
@@ -938,6 +1791,47 @@ void DrawScene(bool drawAxes, bool clipped, float clipZ, bool drawWater,
 
 
 
+//
+// Write an input event to the recording, if one is being made.
+//
+void RecordInput(char type, int a, int b, int c, int d)
+{
+    if (!inputRecording)
+        return;
+    fprintf(inputRecording, "%u %.1f %c %d %d %d %d\n", recordingFrames, recordingTimer.GetElapsedMillis(), type, a, b, c, d);
+}
+
+//
+// Start recording input to filename, starting from the current camera. The
+// camera and the window size go into the header, so -bench starts where the
+// recording did.
+//
+void StartInputRecording(const std::string& filename)
+{
+    inputRecording = fopen(filename.c_str(), "w");
+    if (!inputRecording) {
+        printf("could not write %s\n", filename.c_str());
+        return;
+    }
+    glm::vec3 pos = camera.getPosition();
+    glm::vec3 look = camera.getLook();
+    fprintf(inputRecording, "# assignment2 input recording; events are: frame millis type args\n");
+    fprintf(inputRecording, "camera %.9g %.9g %.9g %.9g %.9g %.9g\n", pos.x, pos.y, pos.z, look.x, look.y, look.z);
+    fprintf(inputRecording, "window %d %d\n", gWindowSizeX, gWindowSizeY);
+    recordingFrames = 0;
+    recordingTimer.Reset();
+    srand(1);   // as in the replay, so added point lights land in the same places
+    printf("recording input to %s\n", filename.c_str());
+}
+
+void StopInputRecording()
+{
+    fprintf(inputRecording, "end %u\n", recordingFrames);
+    fclose(inputRecording);
+    inputRecording = NULL;
+    printf("recorded %u frames of input\n", recordingFrames);
+}
+
 //
 // Reshape the window and record the size so
 // that we can use it for screenshots.
@@ -953,6 +1847,8 @@ void ReshapeCallback(int w, int h)
 
 void SpecialKeyCallback(int key, int x, int y)
 {
+    RecordInput('s', key, x, y, 0);
+
     // handle sprint movement
     float moveSensitivity = 5.0f;
     switch(key) {
@@ -974,35 +1870,269 @@ void SpecialKeyCallback(int key, int x, int y)
 
 
 
+//
+// Gather all meshes of the selected object into one mesh.
+//
+void CopySelectedObjMeshes(STTriangleMesh& mesh)
+{
+    std::vector<STTriangleMesh*>& meshes = objs[selectedObj].stMeshes;
+    for (unsigned int i = 0; i < meshes.size(); i++) {
+        unsigned int base = mesh.NumVertices();
+        for (unsigned int v = 0; v < meshes[i]->NumVertices(); v++)
+            mesh.AddVertex(meshes[i]->mPositions[v], meshes[i]->mTexPos[v]);
+        for (unsigned int f = 0; f < meshes[i]->NumFaces(); f++)
+            mesh.AddFace(base + meshes[i]->mIndices[f*3], base + meshes[i]->mIndices[f*3+1], base + meshes[i]->mIndices[f*3+2]);
+    }
+    mesh.Build();
+}
+
+//
+// Time BuildTopology() on the selected object at increasing mesh sizes
+// (each size is one Loop subdivision of the previous, up to
+// MAX_SUBDIVIDED_FACES), then time LoopSubdivide() for 1 to 4 levels.
+// Everything is run with one thread and with every thread.
+//
+void BenchmarkMeshes()
+{
+    const int NUM_SIZES = 4;
+    const int NUM_RUNS = 5;
+    const int MAX_LEVELS = 4;
+    const unsigned int MAX_SUBDIVIDED_FACES = 32 << 20;
+    unsigned int maxThreads = STGetNumThreads();
+
+    STTriangleMesh mesh;
+    CopySelectedObjMeshes(mesh);
+    printf("BuildTopology benchmark, best of %d runs:\n", NUM_RUNS);
+    for (int size = 0; size < NUM_SIZES; size++) {
+        if (size > 0) {
+            // each subdivision has 4 times the faces
+            if (4ull * mesh.NumFaces() > MAX_SUBDIVIDED_FACES) {
+                printf("  larger sizes skipped, more than %u faces\n", MAX_SUBDIVIDED_FACES);
+                break;
+            }
+            mesh.LoopSubdivide();
+        }
+        float millis[2];
+        for (int t = 0; t < 2; t++) {
+            STSetNumThreads(t == 0 ? 1 : maxThreads);
+            millis[t] = 1e30f;
+            for (int run = 0; run < NUM_RUNS; run++) {
+                STTimer timer;
+                timer.Reset();
+                mesh.BuildTopology();
+                millis[t] = (std::min)(millis[t], timer.GetElapsedMillis());
+            }
+        }
+        STSetNumThreads(0);
+        printf("  %9u faces: %8.2f ms (1 thread) %8.2f ms (%u threads), %u boundary / %u non-manifold edges\n",
+            mesh.NumFaces(), millis[0], millis[1], maxThreads, mesh.mNumBoundaryEdges, mesh.mNumNonManifoldEdges);
+    }
+
+    printf("LoopSubdivide benchmark:\n");
+    for (int levels = 1; levels <= MAX_LEVELS; levels++) {
+        float millis[2];
+        unsigned int numFaces = 0;
+        for (int t = 0; t < 2; t++) {
+            STSetNumThreads(t == 0 ? 1 : maxThreads);
+            STTriangleMesh subdivided;
+            CopySelectedObjMeshes(subdivided);
+            if (((unsigned long long)subdivided.NumFaces() << (2*levels)) > MAX_SUBDIVIDED_FACES)
+                break;
+            STTimer timer;
+            timer.Reset();
+            subdivided.LoopSubdivide(levels);
+            millis[t] = timer.GetElapsedMillis();
+            numFaces = subdivided.NumFaces();
+        }
+        STSetNumThreads(0);
+        if (numFaces == 0) {
+            printf("  %d levels: skipped, more than %u faces\n", levels, MAX_SUBDIVIDED_FACES);
+            break;
+        }
+        printf("  %d levels: %9u faces, %8.2f ms (1 thread) %8.2f ms (%u threads)\n",
+            levels, numFaces, millis[0], millis[1], maxThreads);
+    }
+
+    // OBJ parsing: the original stream parser against the mapped parallel one.
+    const std::string& path = objFilePaths[selectedObj];
+    unsigned long long fileSize = 0;
+    if (!STMappedFile::GetFileInfo(path, &fileSize, NULL))
+        return;
+    float megabytes = fileSize / (1024.f * 1024.f);
+    std::vector<tinyobj::shape_t> streamShapes, mappedShapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string base = path.substr(0, path.find_last_of("/\\") + 1);
+    float millis[3];
+    STTimer timer;
+    timer.Reset();
+    tinyobj::LoadObj(streamShapes, materials, path.c_str(), base.c_str());
+    millis[0] = timer.GetElapsedMillis();
+    for (int t = 1; t < 3; t++) {
+        STSetNumThreads(t == 1 ? 1 : maxThreads);
+        materials.clear();
+        timer.Reset();
+        tinyobj::LoadObjMapped(mappedShapes, materials, path.c_str(), base.c_str());
+        millis[t] = timer.GetElapsedMillis();
+    }
+    STSetNumThreads(0);
+    bool identical = streamShapes.size() == mappedShapes.size();
+    for (size_t i = 0; identical && i < streamShapes.size(); i++) {
+        const tinyobj::mesh_t& a = streamShapes[i].mesh;
+        const tinyobj::mesh_t& b = mappedShapes[i].mesh;
+        identical = streamShapes[i].name == mappedShapes[i].name &&
+            a.positions == b.positions && a.normals == b.normals && a.texcoords == b.texcoords &&
+            a.indices == b.indices && a.material_ids == b.material_ids;
+    }
+    printf("LoadObj benchmark, %s (%.1f MB):\n", path.c_str(), megabytes);
+    printf("  stream: %8.2f ms (%6.1f MB/s)\n", millis[0], megabytes * 1000.f / millis[0]);
+    printf("  mapped: %8.2f ms (%6.1f MB/s, 1 thread) %8.2f ms (%6.1f MB/s, %u threads), %s\n",
+        millis[1], megabytes * 1000.f / millis[1], millis[2], megabytes * 1000.f / millis[2], maxThreads,
+        identical ? "identical shapes" : "SHAPES DIFFER");
+}
+
+//
+// Time decoding every texture of the selected object (best of a few runs)
+// and report the throughput in MB of RGBA output per second.
+//
+void BenchmarkTextures()
+{
+    const int NUM_RUNS = 5;
+    const std::string& path = objFilePaths[selectedObj];
+    std::string base = path.substr(0, path.find_last_of("/\\") + 1);
+    std::vector<std::string> files;
+    std::vector<STTriangleMesh*>& meshes = objs[selectedObj].stMeshes;
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const std::string* maps[2] = { &meshes[i]->mColorMapFile, &meshes[i]->mNormalMapFile };
+        for (int m = 0; m < 2; m++) {
+            if (*maps[m] != "" && std::find(files.begin(), files.end(), *maps[m]) == files.end())
+                files.push_back(*maps[m]);
+        }
+    }
+
+    printf("Texture decode benchmark, best of %d runs:\n", NUM_RUNS);
+    float totalMillis = 0.0f, totalMegabytes = 0.0f;
+    for (size_t i = 0; i < files.size(); i++) {
+        float millis = 1e30f;
+        float megabytes = 0.0f;
+        for (int run = 0; run < NUM_RUNS; run++) {
+            STTimer timer;
+            STImage image(base + files[i]);
+            millis = (std::min)(millis, timer.GetElapsedMillis());
+            megabytes = image.GetWidth() * image.GetHeight() * 4 / (1024.f * 1024.f);
+        }
+        printf("  %-50s %8.2f ms (%7.1f MB/s)\n", files[i].c_str(), millis, megabytes * 1000.f / millis);
+        totalMillis += millis;
+        totalMegabytes += megabytes;
+    }
+    if (!files.empty())
+        printf("  total: %.2f ms (%.1f MB/s)\n", totalMillis, totalMegabytes * 1000.f / totalMillis);
+
+    // video memory of the uploaded maps, against plain RGBA without mipmaps
+    size_t textureBytes = 0, rgbaBytes = 0;
+    for (size_t i = 0; i < meshes.size(); i++) {
+        meshes[i]->UploadTextures();
+        const STTexture* textures[2] = { meshes[i]->mHasColorMap ? meshes[i]->mSurfaceColorTex : NULL,
+                                         meshes[i]->mHasNormalMap ? meshes[i]->mSurfaceNormalTex : NULL };
+        for (int m = 0; m < 2; m++) {
+            if (textures[m]) {
+                textureBytes += textures[m]->GetMemoryUsage();
+                rgbaBytes += (size_t)textures[m]->GetWidth() * textures[m]->GetHeight() * 4;
+            }
+        }
+    }
+    printf("  texture memory: %.2f MB (%.2f MB as RGBA)\n",
+           textureBytes / (1024.f * 1024.f), rgbaBytes / (1024.f * 1024.f));
+}
+
 void KeyCallback(unsigned char key, int x, int y)
 {
+    // keys that write files or quit are left out of recordings
+    if (!strchr("RmpP`q", key))
+        RecordInput('k', key, x, y, 0);
+
     switch(key) {
-    case 'p': {
-            //
-            // Take a screenshot, and save as screenshot.jpg
-            //
-            STImage* screenshot = new STImage(gWindowSizeX, gWindowSizeY);
-            screenshot->Read(0,0);
-            screenshot->Save("screenshot.jpg");
-            delete screenshot;
+    case 'p':
+        //
+        // Take a screenshot of the next frame, and save as screenshotNNN.jpg
+        //
+        screenshotRequested = true;
+        break;
+    case 'P':
+        //
+        // Start or stop saving every frame as frameNNNNN.jpg
+        //
+        recording = !recording;
+        if (recording) {
+            printf("recording from frame%05d.jpg\n", recordedFrames);
+        } else {
+            frameCapture->Finish();
+            frameCapture->PrintStats("recording");
         }
         break;
     case 'r':
         resetCamera();
         break;
-    case 'm':   // write out world matrix of current object to file
-        //objs[selectedObj].writeWorldMatrix();
-        printf("writing scene files...\n");
-        for (int i=0; i<objs.size(); i++) {
-            objs[i].writeWorldMatrix();
-        }
-        for (int i=0; i<NUMLIGHTS; i++) {
-            lights[i].writeLightsFile(i);
-        }
-        writeCameraFile("camera.txt");
+    case 'm':   // save the camera, objects, lights and settings to the scene file
+        printf("saving %s...\n", sceneFilename.c_str());
+        saveScene();
         break;
     case 'f': // switch between smooth shading and flat shading
         smooth = !smooth;
+        sceneEdited = true;
+        break;
+    case 'i': // switch between buffer-object and immediate-mode mesh drawing, then time it
+        STTriangleMesh::sImmediateMode = !STTriangleMesh::sImmediateMode;
+        startTimedFrames(STTriangleMesh::sImmediateMode ? "drawing meshes in immediate mode" : "drawing meshes from buffer objects");
+        break;
+    case 'u': // switch uniform caching on and off, then time it
+        STShaderProgram::sCacheUniforms = !STShaderProgram::sCacheUniforms;
+        startTimedFrames(STShaderProgram::sCacheUniforms ? "cached uniforms" : "uniforms looked up by name");
+        break;
+    case 'v': // switch frustum culling off and on, then time it
+        frustumCulling = !frustumCulling;
+        startTimedFrames(frustumCulling ? "frustum culling on" : "frustum culling off");
+        break;
+    case 'h': // switch shadow map caching off and on, then time it
+        shadowMapCaching = !shadowMapCaching;
+        startTimedFrames(shadowMapCaching ? "shadow map caching on" : "shadow map caching off");
+        break;
+    case 'g': // cycle the reflection resolution, then time it
+        reflectionQuality = (reflectionQuality + 1) % NUM_REFLECTION_QUALITIES;
+        startTimedFrames("reflection at " + std::to_string(static_cast<long long>(100.0f * reflectionScales[reflectionQuality])) +
+                         "% of the window size");
+        break;
+    case 'j': // cycle the reflection update interval between 1, 2, 4 and 8 frames, then time it
+        reflectionUpdateInterval = reflectionUpdateInterval >= 8 ? 1 : 2 * reflectionUpdateInterval;
+        startTimedFrames("reflection updated every " + std::to_string(static_cast<long long>(reflectionUpdateInterval)) + " frames");
+        break;
+    case 'l': // switch skipping reflection updates while nothing moves, then time it
+        reflectionSkipStill = !reflectionSkipStill;
+        startTimedFrames(reflectionSkipStill ? "reflection updates skipped while still" : "reflection updates not skipped");
+        break;
+    case 'e': // cycle the spotlight's shadow filter, then time it
+        shadowFilter = (shadowFilter + 1) % NUM_SHADOW_FILTERS;
+        shadowMapValid = false;     // the variance shadow map needs the moments
+        sceneEdited = true;
+        startTimedFrames(shadowFilterNames[shadowFilter]);
+        break;
+    case 't': // cycle the number of Poisson disk shadow taps between 4, 8, 12 and 16, then time it
+        shadowTaps = shadowTaps >= MAX_SHADOW_TAPS ? 4 : shadowTaps + 4;
+        sceneEdited = true;
+        startTimedFrames(std::to_string(static_cast<long long>(shadowTaps)) + " Poisson disk shadow taps");
+        break;
+    case 'z': // cycle sun shadows between off, every cascade every frame and amortized, then time it
+        cascadeMode = (cascadeMode + 1) % NUM_CASCADE_MODES;
+        sceneEdited = true;
+        startTimedFrames(cascadeModeNames[cascadeMode]);
+        break;
+    case '+': // double the number of point lights, or go back to the scene's own, then time it
+        AddPointLights();
+        sceneEdited = true;
+        startTimedFrames(std::to_string(static_cast<long long>(lights.size() - NUM_DIRLIGHTS)) + " point lights");
+        break;
+    case 'k':   // benchmark mesh processing on the selected object
+        BenchmarkMeshes();
+        BenchmarkTextures();
         break;
     case 'o':   // center object's center of mass at origin
         objs[selectedObj].centerAtOrigin();
@@ -1011,7 +2141,30 @@ void KeyCallback(unsigned char key, int x, int y)
     case 'x':   // toggle axes
         axes = !axes;
         break;
+    case '\t':
+        showHud = !showHud;
+        hudFramesShown = 0;
+        break;
+    case '`':
+        if (profiler->IsWritingCSV()) {
+            profiler->StopCSV();
+            printf("stopped writing profile.csv\n");
+        } else if (profiler->StartCSV("profile.csv")) {
+            printf("writing pass timings to profile.csv\n");
+        }
+        break;
+    case 'R':
+        if (inputRecording)
+            StopInputRecording();
+        else
+            StartInputRecording("input.rec");
+        break;
 	case 'q':
+        if (inputRecording)
+            StopInputRecording();
+        profiler->StopCSV();
+        frameCapture->Finish();
+        sceneSaver.finish();
 		exit(0);
     default:
         break;
@@ -1042,7 +2195,6 @@ void KeyCallback(unsigned char key, int x, int y)
 
     // select which axis to rotate the currently-selected object
     // or rotate it around that axis
-    glm::mat4 &mat = objs[selectedObj].worldMat;
     switch (key) {
     case '1':
         axisOfRotation = glm::vec3(1.0f, 0.0f, 0.0f);
@@ -1100,14 +2252,12 @@ void KeyCallback(unsigned char key, int x, int y)
 
     // scale object
     float downFactor = 0.99f;
-    glm::vec3 downscaleVector(downFactor, downFactor, downFactor);
-    glm::vec3 upscaleVector(1.0f/downFactor, 1.0f/downFactor, 1.0f/downFactor);
     switch (key) {
     case ';':
-        objs[selectedObj].worldMat = glm::scale(downscaleVector) * objs[selectedObj].worldMat;
+        objs[selectedObj].scaleBy(downFactor);
         break;
     case '\'':
-        objs[selectedObj].worldMat = glm::scale(upscaleVector) * objs[selectedObj].worldMat;
+        objs[selectedObj].scaleBy(1.0f/downFactor);
         break;
     }
 
@@ -1136,12 +2286,12 @@ void KeyCallback(unsigned char key, int x, int y)
         }
         break;
     case 'b':
-        selectedLight = selectedLight == 0 ? NUMLIGHTS - 1 : selectedLight - 1;
+        selectedLight = selectedLight == 0 ? (int)lights.size() - 1 : selectedLight - 1;
         rightMouseControllLights = true;
         printf("light %d selected **************\n", selectedLight);
         break;
     case 'n':
-        selectedLight = selectedLight == NUMLIGHTS-1 ? 0 : selectedLight + 1;
+        selectedLight = selectedLight == (int)lights.size()-1 ? 0 : selectedLight + 1;
         rightMouseControllLights = true;
         printf("light %d selected **************\n", selectedLight);
         break;
@@ -1168,6 +2318,8 @@ void KeyCallback(unsigned char key, int x, int y)
  */
 void MouseCallback(int button, int state, int x, int y)
 {
+    RecordInput('b', button, state, x, y);
+
     if (button == GLUT_LEFT_BUTTON || button == GLUT_RIGHT_BUTTON)
     {
         gMouseButton = button;
@@ -1188,6 +2340,8 @@ void MouseCallback(int button, int state, int x, int y)
  */
 void MouseMotionCallback(int x, int y)
 {
+    RecordInput('m', x, y, 0, 0);
+
     if (gPreviousMouseX >= 0 && gPreviousMouseY >= 0)
     {
         //compute delta
@@ -1207,7 +2361,7 @@ void MouseMotionCallback(int x, int y)
         } else if (gMouseButton == GLUT_RIGHT_BUTTON) {
             if (!rightMouseControllLights) {
                 // translate selected object
-                objs[selectedObj].worldMat = glm::translate(-deltaY * axisOfTranslation) * objs[selectedObj].worldMat;
+                objs[selectedObj].translate(-deltaY * axisOfTranslation);
             } else {
                 // change selected light attribute
                 switch (selectedLightAttrib) {
@@ -1242,6 +2396,7 @@ void MouseMotionCallback(int x, int y)
                     printf("%f\n", lights[selectedLight].scale);
                     break;
                 }
+                sceneEdited = true;
             }
         }
     } else
@@ -1254,32 +2409,196 @@ void MouseMotionCallback(int x, int y)
 
 void usage()
 {
-	printf("usage: assignment2 sceneFile\n");
+	printf("usage: assignment2 sceneFile\n"
+	       "       assignment2 sceneFile -render pathFile width height outPrefix\n"
+	       "       assignment2 sceneFile -bench inputRecording\n");
 	exit(0);
 }
 
-int main(int argc, char** argv)
+bool readInputRecording(const std::string& filename) {
+    std::ifstream in(filename.c_str(), std::ios::in);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    int lineNumber = 0;
+    bool ended = false;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        std::istringstream fields(line);
+        std::string first;
+        if (!(fields >> first) || first[0] == '#')
+            continue;
+        bool ok;
+        if (first == "camera") {
+            ok = !!(fields >> benchCameraPos.x >> benchCameraPos.y >> benchCameraPos.z
+                           >> benchCameraLook.x >> benchCameraLook.y >> benchCameraLook.z) &&
+                 glm::length(benchCameraLook) > 0.0f;
+            benchHasCamera = true;
+        } else if (first == "window") {
+            ok = !!(fields >> benchWidth >> benchHeight) && benchWidth > 0 && benchHeight > 0;
+        } else if (first == "end") {
+            ok = !!(fields >> benchFrames);
+            ended = true;
+        } else {
+            InputEvent event;
+            event.frame = (unsigned int)atoi(first.c_str());
+            ok = !!(fields >> event.millis >> event.type >> event.args[0] >> event.args[1] >> event.args[2] >> event.args[3]) &&
+                 strchr("ksbm", event.type) && (benchEvents.empty() || event.frame >= benchEvents.back().frame);
+            benchEvents.push_back(event);
+        }
+        if (!ok) {
+            printf("%s:%d: not a valid line\n", filename.c_str(), lineNumber);
+            return false;
+        }
+    }
+    if (!ended)
+        printf("%s: no end line, the recording may be cut short\n", filename.c_str());
+    if (!benchEvents.empty())
+        benchFrames = (std::max)(benchFrames, benchEvents.back().frame + 1);
+    return benchFrames > 0;
+}
+
+//
+// Pass the recorded events that came before this frame to the callbacks.
+//
+void ReplayInput()
 {
-	if (argc != 2)
-		usage();
+    while (benchNextEvent < benchEvents.size() && benchEvents[benchNextEvent].frame <= benchFrame) {
+        const InputEvent& event = benchEvents[benchNextEvent++];
+        switch (event.type) {
+        case 'k':
+            KeyCallback((unsigned char)event.args[0], event.args[1], event.args[2]);
+            break;
+        case 's':
+            SpecialKeyCallback(event.args[0], event.args[1], event.args[2]);
+            break;
+        case 'b':
+            MouseCallback(event.args[0], event.args[1], event.args[2], event.args[3]);
+            break;
+        case 'm':
+            MouseMotionCallback(event.args[0], event.args[1]);
+            break;
+        }
+    }
+}
 
-    if (!readSceneFile(std::string(argv[1]))) {
-        printf("error reading scene file %s\n", std::string(argv[3]).c_str());
-        exit(1);
+//
+// Time a replayed frame, and print the results and quit after the last one.
+// The first frame is left out of the statistics, since it also uploads the
+// scene to the GPU.
+//
+void EndBenchFrame()
+{
+    benchFrameMillis.push_back(benchFrameTimer.GetElapsedMillis());
+    benchFrameTimer.Reset();
+    if (++benchFrame < benchFrames)
+        return;
+
+    std::vector<float> sorted(benchFrameMillis.begin() + 1, benchFrameMillis.end());
+    std::sort(sorted.begin(), sorted.end());
+    float total = 0.0f;
+    for (size_t i = 0; i < sorted.size(); i++)
+        total += sorted[i];
+    printf("bench: %u frames at %dx%d, %.1f ms in all, first frame %.1f ms (not counted)\n",
+        benchFrames, gWindowSizeX, gWindowSizeY, total + benchFrameMillis[0], benchFrameMillis[0]);
+    if (!sorted.empty()) {
+        size_t n = sorted.size();
+        printf("    frame ms: mean %.2f, median %.2f, p95 %.2f, p99 %.2f, max %.2f\n", total / n,
+            sorted[(n - 1) / 2], sorted[(n * 95 + 99) / 100 - 1], sorted[(n * 99 + 99) / 100 - 1], sorted.back());
     }
+    for (int i = 1; i < profiler->GetNumSections(); i++) {
+        STProfiler::Stats cpu = profiler->GetCPUStats(i);
+        printf("    %-11s cpu mean %.2f ms", profiler->GetName(i).c_str(), cpu.mean);
+        if (profiler->HasGPUTimes())
+            printf(", gpu mean %.2f ms", profiler->GetGPUStats(i).mean);
+        printf(" (last %u frames it ran in)\n", cpu.count);
+    }
+    frameCapture->Finish();
+    exit(0);
+}
 
-    //
-    // Initialize GLUT.
-    //
-    glutInit(&argc, argv);
-    glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
-    glutInitWindowPosition(20, 20);
-    glutInitWindowSize(1280, 720);
-    glutCreateWindow("CS148 Assignment 2");
-    
-    //
-    // Initialize GLEW.
-    //
+//
+// A camera path for -render: one keyframe per line, written as
+//   posX posY posZ lookX lookY lookZ [frames]
+// The camera moves from each keyframe to the next over frames frames (1 if
+// left out), and the last keyframe is rendered once. Blank lines and lines
+// starting with # are skipped.
+//
+struct CameraKey {
+    glm::vec3 pos;
+    glm::vec3 look;
+    int frames;
+};
+
+bool readCameraPath(const std::string& filename, std::vector<CameraKey>& keys) {
+    std::ifstream in(filename.c_str(), std::ios::in);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+        std::istringstream fields(line);
+        CameraKey key;
+        if (!(fields >> key.pos.x >> key.pos.y >> key.pos.z >> key.look.x >> key.look.y >> key.look.z)) {
+            printf("%s:%d: expected posX posY posZ lookX lookY lookZ [frames]\n", filename.c_str(), lineNumber);
+            return false;
+        }
+        if (!(fields >> key.frames))
+            key.frames = 1;
+        if (key.frames < 1 || glm::length(key.look) == 0.0f) {
+            printf("%s:%d: frames must be at least 1 and look must not be zero\n", filename.c_str(), lineNumber);
+            return false;
+        }
+        keys.push_back(key);
+    }
+    return !keys.empty();
+}
+
+//
+// Render every frame of the camera path and save frame i as
+// outPrefix followed by i in four digits and ".png", while the next frames
+// render. Returns the number of images that could not be saved.
+//
+int RenderCameraPath(const std::vector<CameraKey>& keys, const std::string& outPrefix) {
+    int frame = 0;
+    STTimer timer;
+    for (size_t k = 0; k < keys.size(); k++) {
+        bool last = k + 1 == keys.size();
+        int frames = last ? 1 : keys[k].frames;
+        for (int f = 0; f < frames; f++) {
+            float t = (float)f / frames;
+            if (last) {
+                camera.setPosition(keys[k].pos);
+                camera.setLook(glm::normalize(keys[k].look));
+            } else {
+                camera.setPosition(glm::mix(keys[k].pos, keys[k+1].pos, t));
+                camera.setLook(glm::normalize(glm::mix(glm::normalize(keys[k].look), glm::normalize(keys[k+1].look), t)));
+            }
+
+            DisplayCallback();
+
+            // the pbuffer is not swapped, so the frame can still be read back
+            char number[16];
+            sprintf(number, "%04d", frame);
+            frameCapture->Capture(gWindowSizeX, gWindowSizeY, outPrefix + number + ".png");
+            frame++;
+        }
+    }
+    frameCapture->Finish();
+    printf("rendered %d frames at %dx%d in %.1f ms\n", frame, gWindowSizeX, gWindowSizeY, timer.GetElapsedMillis());
+    int failed = (int)frameCapture->GetNumFailed();
+    frameCapture->PrintStats("saved");
+    return failed;
+}
+
+void InitGlew()
+{
 #ifndef __APPLE__
     glewInit();
     if(!GLEW_VERSION_2_0) {
@@ -1295,18 +2614,93 @@ int main(int argc, char** argv)
         }
     }
 #endif
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 2 && !(argc == 7 && strcmp(argv[2], "-render") == 0) && !(argc == 4 && strcmp(argv[2], "-bench") == 0))
+		usage();
+
+    sceneFilename = argv[1];
+    if (!readScene(sceneFilename)) {
+        printf("error reading scene file %s\n", sceneFilename.c_str());
+        exit(1);
+    }
+
+    //
+    // Render a camera path offscreen and exit, without opening a window.
+    //
+    if (argc == 7) {
+        std::vector<CameraKey> keys;
+        if (!readCameraPath(argv[3], keys)) {
+            printf("error reading camera path %s\n", argv[3]);
+            exit(1);
+        }
+        int width = atoi(argv[4]);
+        int height = atoi(argv[5]);
+        if (width <= 0 || height <= 0)
+            usage();
+
+        headless = true;
+        if (!CreateHeadlessContext(width, height))
+            exit(1);
+        InitGlew();
+        Setup();
+        ReshapeCallback(width, height);
+        int failed = RenderCameraPath(keys, argv[6]);
+        CleanUp();
+        DestroyHeadlessContext();
+        return failed > 0 ? 1 : 0;
+    }
+
+    //
+    // Replay recorded input from a fixed starting point, then print the frame times.
+    //
+    if (argc == 4) {
+        if (!readInputRecording(argv[3])) {
+            printf("error reading input recording %s\n", argv[3]);
+            exit(1);
+        }
+        benchmarking = true;
+    }
+
+    //
+    // Initialize GLUT.
+    //
+    glutInit(&argc, argv);
+    glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
+    glutInitWindowPosition(20, 20);
+    glutInitWindowSize(benchmarking ? benchWidth : 1280, benchmarking ? benchHeight : 720);
+    glutCreateWindow("CS148 Assignment 2");
+    
+    //
+    // Initialize GLEW.
+    //
+    InitGlew();
 
     // Be sure to initialize GLUT (and GLEW for this assignment) before
     // initializing your application.
 
     Setup();
 
+    // a replay ignores the keyboard and mouse, and always adds the same point lights
+    if (benchmarking) {
+        if (benchHasCamera) {
+            camera.setPosition(benchCameraPos);
+            camera.setLook(benchCameraLook);
+        }
+        srand(1);
+        benchFrameTimer.Reset();
+    }
+
     glutDisplayFunc(DisplayCallback);
     glutReshapeFunc(ReshapeCallback);
-    glutSpecialFunc(SpecialKeyCallback);
-    glutKeyboardFunc(KeyCallback);
-    glutMouseFunc(MouseCallback);
-    glutMotionFunc(MouseMotionCallback);
+    if (!benchmarking) {
+        glutSpecialFunc(SpecialKeyCallback);
+        glutKeyboardFunc(KeyCallback);
+        glutMouseFunc(MouseCallback);
+        glutMotionFunc(MouseMotionCallback);
+    }
     glutIdleFunc(DisplayCallback);
 
     glutMainLoop();
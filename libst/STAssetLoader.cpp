@@ -0,0 +1,101 @@
+// STAssetLoader.cpp
+#include "STAssetLoader.h"
+#include "STParallel.h"
+#include "STTimer.h"
+
+#include <stdio.h>
+
+STAssetLoader::STAssetLoader(unsigned int numThreads)
+    : mNumAdded(0), mNumFinished(0), mTotalLoadMillis(0.0f), mTotalUploadMillis(0.0f), mQuit(false)
+{
+    if (numThreads == 0)
+        numThreads = STGetNumThreads();
+    for (unsigned int i = 0; i < numThreads; i++)
+        mWorkers.push_back(std::thread(&STAssetLoader::WorkerLoop, this));
+}
+
+STAssetLoader::~STAssetLoader()
+{
+    Finish();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+    }
+    mWorkAvailable.notify_all();
+    for (size_t i = 0; i < mWorkers.size(); i++)
+        mWorkers[i].join();
+}
+
+void STAssetLoader::Add(const std::string& name, const Step& load, const Step& upload)
+{
+    Asset* asset = new Asset;
+    asset->name = name;
+    asset->load = load;
+    asset->upload = upload;
+    asset->loadMillis = 0.0f;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPending.push_back(asset);
+        mNumAdded++;
+    }
+    mWorkAvailable.notify_one();
+}
+
+void STAssetLoader::WorkerLoop()
+{
+    for (;;) {
+        Asset* asset;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while (!mQuit && mPending.empty())
+                mWorkAvailable.wait(lock);
+            if (mPending.empty())
+                return;
+            asset = mPending.front();
+            mPending.pop_front();
+        }
+        STTimer timer;
+        if (asset->load)
+            asset->load();
+        asset->loadMillis = timer.GetElapsedMillis();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mLoaded.push_back(asset);
+        }
+        mAssetLoaded.notify_one();
+    }
+}
+
+void STAssetLoader::Finish()
+{
+    if (mNumFinished == mNumAdded)
+        return;
+    STTimer wallTimer;
+    for (;;) {
+        Asset* asset;
+        unsigned int numAdded;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while (mLoaded.empty() && mNumFinished < mNumAdded)
+                mAssetLoaded.wait(lock);
+            if (mLoaded.empty())
+                break;
+            asset = mLoaded.front();
+            mLoaded.pop_front();
+            numAdded = mNumAdded;
+        }
+        STTimer timer;
+        if (asset->upload)
+            asset->upload();
+        float uploadMillis = timer.GetElapsedMillis();
+        mNumFinished++;
+        mTotalLoadMillis += asset->loadMillis;
+        mTotalUploadMillis += uploadMillis;
+        printf("[%u/%u] %s: loaded in %.1f ms, uploaded in %.1f ms\n",
+            mNumFinished, numAdded, asset->name.c_str(), asset->loadMillis, uploadMillis);
+        delete asset;
+    }
+    printf("Loaded %u assets in %.1f ms on %u threads (%.1f ms of loading, %.1f ms of uploads)\n",
+        mNumFinished, wallTimer.GetElapsedMillis(), (unsigned int)mWorkers.size(),
+        mTotalLoadMillis, mTotalUploadMillis);
+}
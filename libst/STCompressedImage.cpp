@@ -0,0 +1,553 @@
+// STCompressedImage.cpp
+#include "STCompressedImage.h"
+
+#include "STImage.h"
+#include "STMappedFile.h"
+#include "STParallel.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+//
+// Layout of the .dds files written by Save(), in native byte order:
+//
+//   "DDS " DDSHeader level0 level1 ... levelN
+//
+// This is a standard DXT1/DXT5/ATI2 .dds file, except that the rows are
+// stored bottom row first, as in STImage. The otherwise unused
+// dwReserved1 words of the header record what the file was made from:
+//
+//   [0] kCacheTag  [1] kCacheVersion  [2..3] source size
+//   [4..5] source time stamp  [6..7] source hash
+//
+static const unsigned int kDDSMagic = 0x20534444;  // "DDS "
+static const unsigned int kDDSFlags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;
+static const unsigned int kDDSPixelFormatFourCC = 0x4;
+static const unsigned int kDDSCaps = 0x1000 | 0x400000 | 0x8;
+static const unsigned int kCacheTag = 0x43425453;  // "STBC"
+static const unsigned int kCacheVersion = 1;
+
+struct DDSPixelFormat {
+    unsigned int size;
+    unsigned int flags;
+    unsigned int fourCC;
+    unsigned int rgbBitCount;
+    unsigned int bitMasks[4];
+};
+
+struct DDSHeader {
+    unsigned int size;
+    unsigned int flags;
+    unsigned int height;
+    unsigned int width;
+    unsigned int pitchOrLinearSize;
+    unsigned int depth;
+    unsigned int mipMapCount;
+    unsigned int reserved1[11];
+    DDSPixelFormat pixelFormat;
+    unsigned int caps[4];
+    unsigned int reserved2;
+};
+
+static unsigned int MakeFourCC(char a, char b, char c, char d)
+{
+    return (unsigned int)(unsigned char)a | ((unsigned int)(unsigned char)b << 8) |
+           ((unsigned int)(unsigned char)c << 16) | ((unsigned int)(unsigned char)d << 24);
+}
+
+static unsigned int GetFourCC(STCompressedImage::Format format)
+{
+    switch (format) {
+        case STCompressedImage::kBC1: return MakeFourCC('D', 'X', 'T', '1');
+        case STCompressedImage::kBC3: return MakeFourCC('D', 'X', 'T', '5');
+        default:                      return MakeFourCC('A', 'T', 'I', '2');
+    }
+}
+
+static size_t GetLevelSize(int width, int height, STCompressedImage::Format format)
+{
+    return (size_t)((width+3)/4) * ((height+3)/4) * STCompressedImage::GetBlockSize(format);
+}
+
+//
+// Block encoders. A block is 16 pixels, row by row, bottom row first.
+//
+
+//
+// BC4: one channel as two 8-bit endpoints and a 3-bit index per pixel.
+// With a0 > a1 the palette is a0, a1 and six values evenly in between.
+//
+static void EncodeChannelBlock(const unsigned char values[16], unsigned char* out)
+{
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; i++) {
+        lo = (std::min)(lo, (int)values[i]);
+        hi = (std::max)(hi, (int)values[i]);
+    }
+    out[0] = (unsigned char)hi;
+    out[1] = (unsigned char)lo;
+
+    unsigned long long bits = 0;
+    if (hi > lo) {
+        int range = hi - lo;
+        for (int i = 0; i < 16; i++) {
+            // step 0 is lo and step 7 is hi; palette entries 2..7 run from hi to lo
+            int step = ((values[i] - lo) * 14 + range) / (2 * range);
+            int index = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+            bits |= (unsigned long long)index << (3 * i);
+        }
+    }
+    for (int i = 0; i < 6; i++)
+        out[2 + i] = (unsigned char)(bits >> (8 * i));
+}
+
+static unsigned short PackColor565(const float c[3])
+{
+    int r = (int)((std::min)((std::max)(c[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    int g = (int)((std::min)((std::max)(c[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+    int b = (int)((std::min)((std::max)(c[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static void UnpackColor565(unsigned short c, int rgb[3])
+{
+    int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+//
+// Pick the nearest palette color for every pixel of a BC1 block with
+// endpoints c0 > c1 (four color mode). Returns the summed squared error.
+//
+static int SelectColorIndices(const unsigned char pixels[16][4], unsigned short c0, unsigned short c1,
+                              unsigned char indices[16])
+{
+    int palette[4][3];
+    UnpackColor565(c0, palette[0]);
+    UnpackColor565(c1, palette[1]);
+    for (int k = 0; k < 3; k++) {
+        palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+        palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+    }
+    int error = 0;
+    for (int i = 0; i < 16; i++) {
+        int best = 0, bestError = 0x7fffffff;
+        for (int j = 0; j < 4; j++) {
+            int dr = pixels[i][0] - palette[j][0];
+            int dg = pixels[i][1] - palette[j][1];
+            int db = pixels[i][2] - palette[j][2];
+            int e = dr * dr + dg * dg + db * db;
+            if (e < bestError) {
+                best = j;
+                bestError = e;
+            }
+        }
+        indices[i] = (unsigned char)best;
+        error += bestError;
+    }
+    return error;
+}
+
+//
+// Order the endpoints for four color mode (c0 == c1 is fine too: every
+// palette entry is then the same and all pixels pick index 0) and select
+// the indices.
+//
+static int FitColorEndpoints(const unsigned char pixels[16][4], unsigned short& c0, unsigned short& c1,
+                             unsigned char indices[16])
+{
+    if (c0 < c1)
+        std::swap(c0, c1);
+    return SelectColorIndices(pixels, c0, c1, indices);
+}
+
+//
+// BC1: two 565 endpoints and a 2-bit index per pixel. The endpoints start
+// at the extent of the colors along their principal axis (inset a little,
+// since the extremes are rarely hit exactly), and are then refit once by
+// least squares to the palette positions the pixels chose.
+//
+static void EncodeColorBlock(const unsigned char pixels[16][4], unsigned char* out)
+{
+    float mean[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++)
+        for (int k = 0; k < 3; k++)
+            mean[k] += pixels[i][k];
+    for (int k = 0; k < 3; k++)
+        mean[k] /= 16.0f;
+
+    float cov[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < 16; i++) {
+        float d[3] = { pixels[i][0] - mean[0], pixels[i][1] - mean[1], pixels[i][2] - mean[2] };
+        cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+        cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+    }
+
+    // principal axis by power iteration
+    float axis[3] = { 1, 1, 1 };
+    for (int iter = 0; iter < 8; iter++) {
+        float next[3] = {
+            cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+            cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+            cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2],
+        };
+        float len = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (len < 1e-6f)
+            break;
+        for (int k = 0; k < 3; k++)
+            axis[k] = next[k] / len;
+    }
+
+    float tMin = 1e30f, tMax = -1e30f;
+    for (int i = 0; i < 16; i++) {
+        float t = (pixels[i][0] - mean[0]) * axis[0] + (pixels[i][1] - mean[1]) * axis[1] +
+                  (pixels[i][2] - mean[2]) * axis[2];
+        tMin = (std::min)(tMin, t);
+        tMax = (std::max)(tMax, t);
+    }
+    float inset = (tMax - tMin) / 16.0f;
+    tMin += inset;
+    tMax -= inset;
+    float e0[3], e1[3];
+    for (int k = 0; k < 3; k++) {
+        e0[k] = mean[k] + axis[k] * tMax;
+        e1[k] = mean[k] + axis[k] * tMin;
+    }
+
+    unsigned short c0 = PackColor565(e0), c1 = PackColor565(e1);
+    unsigned char indices[16];
+    int error = FitColorEndpoints(pixels, c0, c1, indices);
+
+    if (error > 0 && c0 != c1) {
+        // weight of c0 for each palette entry
+        static const float kWeights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        float aa = 0, ab = 0, bb = 0, ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+        for (int i = 0; i < 16; i++) {
+            float a = kWeights[indices[i]], b = 1.0f - a;
+            aa += a * a; ab += a * b; bb += b * b;
+            for (int k = 0; k < 3; k++) {
+                ax[k] += a * pixels[i][k];
+                bx[k] += b * pixels[i][k];
+            }
+        }
+        float det = aa * bb - ab * ab;
+        if (fabsf(det) > 1e-6f) {
+            for (int k = 0; k < 3; k++) {
+                e0[k] = (bb * ax[k] - ab * bx[k]) / det;
+                e1[k] = (aa * bx[k] - ab * ax[k]) / det;
+            }
+            unsigned short r0 = PackColor565(e0), r1 = PackColor565(e1);
+            unsigned char refined[16];
+            int refinedError = FitColorEndpoints(pixels, r0, r1, refined);
+            if (refinedError < error) {
+                c0 = r0;
+                c1 = r1;
+                memcpy(indices, refined, 16);
+            }
+        }
+    }
+
+    unsigned int bits = 0;
+    for (int i = 0; i < 16; i++)
+        bits |= (unsigned int)indices[i] << (2 * i);
+    out[0] = (unsigned char)c0;
+    out[1] = (unsigned char)(c0 >> 8);
+    out[2] = (unsigned char)c1;
+    out[3] = (unsigned char)(c1 >> 8);
+    for (int i = 0; i < 4; i++)
+        out[4 + i] = (unsigned char)(bits >> (8 * i));
+}
+
+static void EncodeBlock(const unsigned char pixels[16][4], STCompressedImage::Format format, unsigned char* out)
+{
+    unsigned char channel[16];
+    switch (format) {
+        case STCompressedImage::kBC1:
+            EncodeColorBlock(pixels, out);
+            break;
+        case STCompressedImage::kBC3:
+            for (int i = 0; i < 16; i++)
+                channel[i] = pixels[i][3];
+            EncodeChannelBlock(channel, out);
+            EncodeColorBlock(pixels, out + 8);
+            break;
+        case STCompressedImage::kBC5:
+            for (int c = 0; c < 2; c++) {
+                for (int i = 0; i < 16; i++)
+                    channel[i] = pixels[i][c];
+                EncodeChannelBlock(channel, out + 8 * c);
+            }
+            break;
+    }
+}
+
+//
+// Encode one level, a row of blocks at a time on all cores. Blocks that
+// hang over the edge of the image repeat its last row and column.
+//
+static void EncodeLevel(const STColor4ub* pixels, int width, int height,
+                        STCompressedImage::Format format, std::vector<unsigned char>& out)
+{
+    int blockSize = STCompressedImage::GetBlockSize(format);
+    int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    out.resize(GetLevelSize(width, height, format));
+    STParallelFor(0, blocksY, [&](size_t begin, size_t end, size_t) {
+        unsigned char block[16][4];
+        for (size_t by = begin; by < end; by++) {
+            for (int bx = 0; bx < blocksX; bx++) {
+                for (int y = 0; y < 4; y++) {
+                    int py = (std::min)((int)by * 4 + y, height - 1);
+                    for (int x = 0; x < 4; x++) {
+                        int px = (std::min)(bx * 4 + x, width - 1);
+                        const STColor4ub& p = pixels[py * width + px];
+                        block[y * 4 + x][0] = p.r;
+                        block[y * 4 + x][1] = p.g;
+                        block[y * 4 + x][2] = p.b;
+                        block[y * 4 + x][3] = p.a;
+                    }
+                }
+                EncodeBlock(block, format, &out[(by * blocksX + bx) * blockSize]);
+            }
+        }
+    }, 4);
+}
+
+//
+// Halve an image with a 2x2 box filter (a 2x1 or 1x2 one along a side of
+// length 1). Normal maps are renormalized after filtering.
+//
+static void Downsample(const std::vector<STColor4ub>& src, int width, int height,
+                       std::vector<STColor4ub>& dst, bool normalMap)
+{
+    int dstWidth = (std::max)(width / 2, 1), dstHeight = (std::max)(height / 2, 1);
+    dst.resize((size_t)dstWidth * dstHeight);
+    STParallelFor(0, dstHeight, [&](size_t begin, size_t end, size_t) {
+        for (size_t y = begin; y < end; y++) {
+            int y0 = (std::min)((int)y * 2, height - 1), y1 = (std::min)((int)y * 2 + 1, height - 1);
+            for (int x = 0; x < dstWidth; x++) {
+                int x0 = (std::min)(x * 2, width - 1), x1 = (std::min)(x * 2 + 1, width - 1);
+                const STColor4ub* p[4] = { &src[y0 * width + x0], &src[y0 * width + x1],
+                                           &src[y1 * width + x0], &src[y1 * width + x1] };
+                STColor4ub& out = dst[y * dstWidth + x];
+                if (normalMap) {
+                    float n[3] = { 0, 0, 0 };
+                    for (int i = 0; i < 4; i++) {
+                        n[0] += p[i]->r / 127.5f - 1.0f;
+                        n[1] += p[i]->g / 127.5f - 1.0f;
+                        n[2] += p[i]->b / 127.5f - 1.0f;
+                    }
+                    float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                    float scale = len > 1e-6f ? 1.0f / len : 0.0f;
+                    out.r = (unsigned char)((n[0] * scale + 1.0f) * 127.5f + 0.5f);
+                    out.g = (unsigned char)((n[1] * scale + 1.0f) * 127.5f + 0.5f);
+                    out.b = (unsigned char)((n[2] * scale + 1.0f) * 127.5f + 0.5f);
+                }
+                else {
+                    out.r = (unsigned char)((p[0]->r + p[1]->r + p[2]->r + p[3]->r + 2) / 4);
+                    out.g = (unsigned char)((p[0]->g + p[1]->g + p[2]->g + p[3]->g + 2) / 4);
+                    out.b = (unsigned char)((p[0]->b + p[1]->b + p[2]->b + p[3]->b + 2) / 4);
+                }
+                out.a = (unsigned char)((p[0]->a + p[1]->a + p[2]->a + p[3]->a + 2) / 4);
+            }
+        }
+    }, 64);
+}
+
+STCompressedImage::STCompressedImage()
+    : mFormat(kBC1)
+{
+}
+
+STCompressedImage::STCompressedImage(const STImage* image, Format format)
+    : mFormat(format)
+{
+    int width = image->GetWidth(), height = image->GetHeight();
+    std::vector<STColor4ub> pixels(image->GetPixels(), image->GetPixels() + (size_t)width * height);
+    std::vector<STColor4ub> next;
+    for (;;) {
+        mLevels.push_back(Level());
+        Level& level = mLevels.back();
+        level.width = width;
+        level.height = height;
+        EncodeLevel(&pixels[0], width, height, format, level.data);
+        if (width == 1 && height == 1)
+            break;
+        Downsample(pixels, width, height, next, format == kBC5);
+        pixels.swap(next);
+        width = (std::max)(width / 2, 1);
+        height = (std::max)(height / 2, 1);
+    }
+}
+
+int STCompressedImage::GetBlockSize(Format format)
+{
+    return format == kBC1 ? 8 : 16;
+}
+
+size_t STCompressedImage::GetDataSize() const
+{
+    size_t size = 0;
+    for (size_t i = 0; i < mLevels.size(); i++)
+        size += mLevels[i].data.size();
+    return size;
+}
+
+bool STCompressedImage::Load(const std::string& filename, const std::string& sourceFilename)
+{
+    STMappedFile file;
+    if (!file.Open(filename) || file.GetSize() < sizeof(kDDSMagic) + sizeof(DDSHeader))
+        return false;
+    const char* data = file.GetData();
+    unsigned int magic;
+    DDSHeader header;
+    memcpy(&magic, data, sizeof(magic));
+    memcpy(&header, data + sizeof(magic), sizeof(header));
+    if (magic != kDDSMagic || header.size != sizeof(DDSHeader) ||
+        header.reserved1[0] != kCacheTag || header.reserved1[1] != kCacheVersion ||
+        !(header.pixelFormat.flags & kDDSPixelFormatFourCC) ||
+        header.width == 0 || header.height == 0 || header.mipMapCount == 0 || header.mipMapCount > 32)
+        return false;
+
+    Format format;
+    if (header.pixelFormat.fourCC == GetFourCC(kBC1))
+        format = kBC1;
+    else if (header.pixelFormat.fourCC == GetFourCC(kBC3))
+        format = kBC3;
+    else if (header.pixelFormat.fourCC == GetFourCC(kBC5))
+        format = kBC5;
+    else
+        return false;
+
+    if (sourceFilename != "") {
+        // same rule as the mesh cache: hash only if just the time stamp changed
+        unsigned long long size, hash;
+        long long modifiedTime;
+        memcpy(&size, &header.reserved1[2], sizeof(size));
+        memcpy(&modifiedTime, &header.reserved1[4], sizeof(modifiedTime));
+        memcpy(&hash, &header.reserved1[6], sizeof(hash));
+        unsigned long long sourceSize;
+        long long sourceTime;
+        if (!STMappedFile::GetFileInfo(sourceFilename, &sourceSize, &sourceTime) || sourceSize != size)
+            return false;
+        if (sourceTime != modifiedTime) {
+            STMappedFile source;
+            if (!source.Open(sourceFilename) || source.ComputeHash() != hash)
+                return false;
+        }
+    }
+
+    std::vector<Level> levels(header.mipMapCount);
+    size_t offset = sizeof(magic) + sizeof(header);
+    int width = (int)header.width, height = (int)header.height;
+    for (size_t i = 0; i < levels.size(); i++) {
+        size_t size = GetLevelSize(width, height, format);
+        if (file.GetSize() - offset < size)
+            return false;
+        levels[i].width = width;
+        levels[i].height = height;
+        levels[i].data.assign(data + offset, data + offset + size);
+        offset += size;
+        width = (std::max)(width / 2, 1);
+        height = (std::max)(height / 2, 1);
+    }
+    if (offset != file.GetSize()) {
+        fprintf(stderr, "STCompressedImage::Load() - %s is corrupt, ignoring it.\n", filename.c_str());
+        return false;
+    }
+    mFormat = format;
+    mLevels.swap(levels);
+    return true;
+}
+
+//
+// Written to a temporary file and renamed over the old one, like the
+// mesh cache, so a crash while writing never leaves a truncated file.
+//
+bool STCompressedImage::Save(const std::string& filename, const std::string& sourceFilename) const
+{
+    if (mLevels.empty())
+        return false;
+
+    DDSHeader header;
+    memset(&header, 0, sizeof(header));
+    header.size = sizeof(DDSHeader);
+    header.flags = kDDSFlags;
+    header.width = (unsigned int)mLevels[0].width;
+    header.height = (unsigned int)mLevels[0].height;
+    header.pitchOrLinearSize = (unsigned int)mLevels[0].data.size();
+    header.mipMapCount = (unsigned int)mLevels.size();
+    header.reserved1[0] = kCacheTag;
+    header.reserved1[1] = kCacheVersion;
+    header.pixelFormat.size = sizeof(DDSPixelFormat);
+    header.pixelFormat.flags = kDDSPixelFormatFourCC;
+    header.pixelFormat.fourCC = GetFourCC(mFormat);
+    header.caps[0] = kDDSCaps;
+
+    if (sourceFilename != "") {
+        unsigned long long size;
+        long long modifiedTime;
+        STMappedFile source;
+        if (!STMappedFile::GetFileInfo(sourceFilename, &size, &modifiedTime) || !source.Open(sourceFilename))
+            return false;
+        unsigned long long hash = source.ComputeHash();
+        memcpy(&header.reserved1[2], &size, sizeof(size));
+        memcpy(&header.reserved1[4], &modifiedTime, sizeof(modifiedTime));
+        memcpy(&header.reserved1[6], &hash, sizeof(hash));
+    }
+
+    std::string tempFilename = filename + ".tmp";
+    FILE* file = fopen(tempFilename.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite(&kDDSMagic, sizeof(kDDSMagic), 1, file) == 1 &&
+              fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i = 0; ok && i < mLevels.size(); i++)
+        ok = fwrite(&mLevels[i].data[0], 1, mLevels[i].data.size(), file) == mLevels[i].data.size();
+    return STMappedFile::CommitFile(file, tempFilename, filename, ok);
+}
+
+std::string STCompressedImage::GetCacheFilename(const std::string& imageFilename, Format format)
+{
+    static const char* kSuffixes[] = { ".bc1.dds", ".bc3.dds", ".bc5.dds" };
+    return imageFilename + kSuffixes[format];
+}
+
+STCompressedImage* STCompressedImage::LoadCached(const std::string& imageFilename, bool normalMap)
+{
+    STCompressedImage* compressed = new STCompressedImage();
+    if (normalMap ? compressed->Load(GetCacheFilename(imageFilename, kBC5), imageFilename)
+                  : compressed->Load(GetCacheFilename(imageFilename, kBC1), imageFilename) ||
+                    compressed->Load(GetCacheFilename(imageFilename, kBC3), imageFilename))
+        return compressed;
+    delete compressed;
+
+    STImage* image;
+    try {
+        image = new STImage(imageFilename);
+    }
+    catch (...) {
+        return NULL;
+    }
+
+    Format format = kBC5;
+    if (!normalMap) {
+        format = kBC1;
+        const STColor4ub* pixels = image->GetPixels();
+        size_t numPixels = (size_t)image->GetWidth() * image->GetHeight();
+        for (size_t i = 0; i < numPixels && format == kBC1; i++) {
+            if (pixels[i].a != 255)
+                format = kBC3;
+        }
+    }
+    compressed = new STCompressedImage(image, format);
+    delete image;
+
+    std::string cacheFilename = GetCacheFilename(imageFilename, format);
+    if (!compressed->Save(cacheFilename, imageFilename))
+        fprintf(stderr, "STCompressedImage::LoadCached() - could not write %s\n", cacheFilename.c_str());
+    return compressed;
+}
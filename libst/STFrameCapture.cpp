@@ -0,0 +1,219 @@
+// STFrameCapture.cpp
+
+/* Include-order dependency!
+*
+* GLEW must be included before the standard GL.h header.
+*/
+#ifdef __APPLE__
+#include <OpenGL/gl.h>
+#else
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GL/gl.h"
+#endif
+
+#include "STFrameCapture.h"
+#include "STImage.h"
+#include "STParallel.h"
+#include "STTimer.h"
+#include "STUtil.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// images waiting for an encoder, per encoder, before Capture() waits
+static const unsigned int MAX_PENDING_PER_THREAD = 4;
+
+STFrameCapture::STFrameCapture(unsigned int numBuffers, unsigned int numThreads)
+    : mReadbacks(numBuffers > 0 ? numBuffers : 1), mNext(0), mNumInFlight(0), mNumEncoding(0), mQuit(false),
+      mNumCaptured(0), mNumStalls(0), mNumFailed(0), mRenderThreadMillis(0.0f), mEncodeMillis(0.0f)
+{
+    for (size_t i = 0; i < mReadbacks.size(); i++) {
+        mReadbacks[i].buffer = 0;
+        mReadbacks[i].bufferSize = 0;
+        mReadbacks[i].fence = NULL;
+    }
+    if (numThreads == 0)
+        numThreads = STGetNumThreads() > 1 ? STGetNumThreads() - 1 : 1;
+    for (unsigned int i = 0; i < numThreads; i++)
+        mWorkers.push_back(std::thread(&STFrameCapture::WorkerLoop, this));
+}
+
+STFrameCapture::~STFrameCapture()
+{
+    Finish();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+    }
+    mWorkAvailable.notify_all();
+    for (size_t i = 0; i < mWorkers.size(); i++)
+        mWorkers[i].join();
+    for (size_t i = 0; i < mReadbacks.size(); i++) {
+        if (mReadbacks[i].buffer != 0)
+            glDeleteBuffers(1, &mReadbacks[i].buffer);
+    }
+}
+
+void STFrameCapture::Capture(int width, int height, const std::string& filename)
+{
+    STTimer timer;
+
+    // all buffers in flight: wait for the oldest
+    if (mNumInFlight == mReadbacks.size()) {
+        Readback& oldest = mReadbacks[mNext];
+        glClientWaitSync((GLsync)oldest.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        mNumStalls++;
+        Collect(oldest);
+        mNext = (mNext + 1) % mReadbacks.size();
+        mNumInFlight--;
+    }
+
+    Readback& readback = mReadbacks[(mNext + mNumInFlight) % mReadbacks.size()];
+    int size = width * height * (int)sizeof(STImage::Pixel);
+    if (readback.buffer == 0)
+        glGenBuffers(1, &readback.buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    if (readback.bufferSize != size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        readback.bufferSize = size;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.width = width;
+    readback.height = height;
+    readback.filename = filename;
+    mNumInFlight++;
+    mNumCaptured++;
+
+    mRenderThreadMillis += timer.GetElapsedMillis();
+}
+
+void STFrameCapture::Update()
+{
+    STTimer timer;
+    while (mNumInFlight > 0) {
+        Readback& oldest = mReadbacks[mNext];
+        GLenum status = glClientWaitSync((GLsync)oldest.fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+            break;
+        Collect(oldest);
+        mNext = (mNext + 1) % mReadbacks.size();
+        mNumInFlight--;
+    }
+    mRenderThreadMillis += timer.GetElapsedMillis();
+}
+
+//
+// Copy a finished readback into an image and queue it for an encoder. A
+// readback that cannot be mapped, or whose data was lost while it was mapped
+// (glUnmapBuffer() fails), is counted as failed and not saved.
+//
+void STFrameCapture::Collect(Readback& readback)
+{
+    glDeleteSync((GLsync)readback.fence);
+    readback.fence = NULL;
+
+    Encode encode;
+    encode.image = NULL;
+    encode.filename = readback.filename;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    const void* pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (pixels) {
+        encode.image = new STImage(readback.width, readback.height);
+        memcpy((void*)encode.image->GetPixels(), pixels, readback.bufferSize);
+        if (glUnmapBuffer(GL_PIXEL_PACK_BUFFER) == GL_FALSE) {
+            delete encode.image;
+            encode.image = NULL;
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!encode.image) {
+        printf("could not read back %s\n", readback.filename.c_str());
+        std::lock_guard<std::mutex> lock(mMutex);
+        mNumFailed++;
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mPending.size() >= MAX_PENDING_PER_THREAD * mWorkers.size()) {
+            mNumStalls++;
+            while (mPending.size() >= MAX_PENDING_PER_THREAD * mWorkers.size())
+                mEncodeDone.wait(lock);
+        }
+        mPending.push_back(encode);
+    }
+    mWorkAvailable.notify_one();
+}
+
+void STFrameCapture::WorkerLoop()
+{
+    for (;;) {
+        Encode encode;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while (!mQuit && mPending.empty())
+                mWorkAvailable.wait(lock);
+            if (mPending.empty())
+                return;
+            encode = mPending.front();
+            mPending.pop_front();
+            mNumEncoding++;
+        }
+        STTimer timer;
+        STStatus status = encode.image->Save(encode.filename);
+        delete encode.image;
+        float millis = timer.GetElapsedMillis();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mNumEncoding--;
+            mEncodeMillis += millis;
+            if (status != ST_OK) {
+                printf("could not save %s\n", encode.filename.c_str());
+                mNumFailed++;
+            }
+        }
+        mEncodeDone.notify_all();
+    }
+}
+
+void STFrameCapture::Finish()
+{
+    while (mNumInFlight > 0) {
+        Readback& oldest = mReadbacks[mNext];
+        glClientWaitSync((GLsync)oldest.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        Collect(oldest);
+        mNext = (mNext + 1) % mReadbacks.size();
+        mNumInFlight--;
+    }
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (!mPending.empty() || mNumEncoding > 0)
+        mEncodeDone.wait(lock);
+}
+
+unsigned int STFrameCapture::GetNumFailed()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mNumFailed;
+}
+
+void STFrameCapture::PrintStats(const char* label)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mNumCaptured > 0) {
+        printf("%s: %u frames captured, %.2f ms/frame on the render thread, %.1f ms/frame encoding on %u threads, %u stalls",
+            label, mNumCaptured, mRenderThreadMillis / mNumCaptured, mEncodeMillis / mNumCaptured,
+            (unsigned int)mWorkers.size(), mNumStalls);
+        if (mNumFailed > 0)
+            printf(", %u not saved", mNumFailed);
+        printf("\n");
+    }
+    mNumCaptured = 0;
+    mNumStalls = 0;
+    mNumFailed = 0;
+    mRenderThreadMillis = 0.0f;
+    mEncodeMillis = 0.0f;
+}
@@ -6,8 +6,21 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include <string>
 
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define ST_IMAGE_NEON
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(_M_X64)
+#define ST_IMAGE_SSE
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
 //
 // Load a new image from an image file (PPM, JPEG
 // and PNG formats are supported).
@@ -159,3 +172,136 @@ void STImage::SetPixel(int x, int y, Pixel value)
 
     mPixels[y*mWidth + x] = value;
 }
+
+//
+// Expanding in place works back to front: the RGBA output of a pixel never
+// lies before its packed input, so every block is loaded before anything
+// overwrites it.
+//
+static void ExpandRowScalar(unsigned char* row, int width, int numChannels)
+{
+    for (int i = width - 1; i >= 0; --i) {
+        const unsigned char* src = row + i * numChannels;
+        unsigned char r, g, b, a = 255;
+        switch (numChannels) {
+        case 1: r = g = b = src[0]; break;
+        case 2: r = g = b = src[0]; a = src[1]; break;
+        default: r = src[0]; g = src[1]; b = src[2]; break;
+        }
+        unsigned char* dst = row + i * 4;
+        dst[0] = r; dst[1] = g; dst[2] = b; dst[3] = a;
+    }
+}
+
+#ifdef ST_IMAGE_SSE
+
+#ifdef __GNUC__
+#define ST_TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define ST_TARGET_SSSE3
+#endif
+
+static bool HasSSSE3()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3") != 0;
+#endif
+}
+
+// Gray needs only SSE2: 16 pixels per step.
+static int ExpandGraySSE2(unsigned char* row, int width)
+{
+    const __m128i alpha = _mm_set1_epi8((char)0xff);
+    int i = width - 16;
+    for (; i >= 0; i -= 16) {
+        __m128i g = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i gg = _mm_unpacklo_epi8(g, g), ga = _mm_unpacklo_epi8(g, alpha);
+        __m128i gg2 = _mm_unpackhi_epi8(g, g), ga2 = _mm_unpackhi_epi8(g, alpha);
+        __m128i* dst = (__m128i*)(row + i * 4);
+        _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(gg2, ga2));
+        _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(gg2, ga2));
+        _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(gg, ga));
+        _mm_storeu_si128(dst + 0, _mm_unpacklo_epi16(gg, ga));
+    }
+    return i + 16;
+}
+
+// RGB and gray+alpha: 4 pixels per shuffle. The 16-byte load reads a few
+// bytes past the 4 pixels, which are still inside the RGBA row.
+ST_TARGET_SSSE3
+static int ExpandSSSE3(unsigned char* row, int width, int numChannels)
+{
+    if (width < 8)
+        return width;
+    const __m128i rgbShuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i gaShuffle = _mm_setr_epi8(0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7);
+    const __m128i alpha = _mm_setr_epi8(0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1);
+    int i = width - 4;
+    if (numChannels == 3) {
+        for (; i >= 0; i -= 4) {
+            __m128i src = _mm_loadu_si128((const __m128i*)(row + i * 3));
+            _mm_storeu_si128((__m128i*)(row + i * 4), _mm_or_si128(_mm_shuffle_epi8(src, rgbShuffle), alpha));
+        }
+    } else {
+        for (; i >= 0; i -= 4) {
+            __m128i src = _mm_loadu_si128((const __m128i*)(row + i * 2));
+            _mm_storeu_si128((__m128i*)(row + i * 4), _mm_shuffle_epi8(src, gaShuffle));
+        }
+    }
+    return i + 4;
+}
+
+#endif
+
+#ifdef ST_IMAGE_NEON
+
+// 16 pixels per step for every format.
+static int ExpandNEON(unsigned char* row, int width, int numChannels)
+{
+    const uint8x16_t alpha = vdupq_n_u8(255);
+    int i = width - 16;
+    for (; i >= 0; i -= 16) {
+        uint8x16x4_t rgba;
+        if (numChannels == 1) {
+            uint8x16_t g = vld1q_u8(row + i);
+            rgba.val[0] = rgba.val[1] = rgba.val[2] = g;
+            rgba.val[3] = alpha;
+        } else if (numChannels == 2) {
+            uint8x16x2_t ga = vld2q_u8(row + i * 2);
+            rgba.val[0] = rgba.val[1] = rgba.val[2] = ga.val[0];
+            rgba.val[3] = ga.val[1];
+        } else {
+            uint8x16x3_t rgb = vld3q_u8(row + i * 3);
+            rgba.val[0] = rgb.val[0];
+            rgba.val[1] = rgb.val[1];
+            rgba.val[2] = rgb.val[2];
+            rgba.val[3] = alpha;
+        }
+        vst4q_u8(row + i * 4, rgba);
+    }
+    return i + 16;
+}
+
+#endif
+
+void STImage::ExpandRowToRGBA(unsigned char* row, int width, int numChannels)
+{
+    if (numChannels == 4)
+        return;
+    // Pixels [0, remaining) are left for the scalar loop.
+    int remaining = width;
+#if defined(ST_IMAGE_SSE)
+    static const bool hasSSSE3 = HasSSSE3();
+    if (numChannels == 1)
+        remaining = ExpandGraySSE2(row, width);
+    else if (hasSSSE3)
+        remaining = ExpandSSSE3(row, width, numChannels);
+#elif defined(ST_IMAGE_NEON)
+    remaining = ExpandNEON(row, width, numChannels);
+#endif
+    ExpandRowScalar(row, remaining, numChannels);
+}
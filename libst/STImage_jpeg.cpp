@@ -59,48 +59,44 @@ void STImage::LoadJPG(const std::string& filename)
     jpeg_create_decompress(&cinfo);
     jpeg_stdio_src(&cinfo, imgFile);
     jpeg_read_header(&cinfo, TRUE);
+#ifdef JCS_EXTENSIONS
+    // libjpeg-turbo can convert color images straight to RGBA.
+    if (cinfo.out_color_space == JCS_RGB)
+        cinfo.out_color_space = JCS_EXT_RGBA;
+#endif
     jpeg_start_decompress(&cinfo);
 
-    int rowStride = cinfo.output_width * cinfo.output_components;
-
     // Create the STImage and get access to its raw pixel array.
     int width = cinfo.output_width;
     int height = cinfo.output_height;
+    int numChannels = cinfo.output_components;
+    bool supported = numChannels == 1 || numChannels == 3;
+#ifdef JCS_EXTENSIONS
+    supported = supported || cinfo.out_color_space == JCS_EXT_RGBA;
+#endif
+    if (!supported) {
+        fprintf(stderr, "STImage::LoadJPG() - Unsupported color space in '%s'.\n",
+                filename.c_str());
+        jpeg_destroy_decompress(&cinfo);
+        fclose(imgFile);
+        throw std::runtime_error("Error in LoadJPG");
+    }
 
     Initialize(width, height);
     STColor4ub* pixels = mPixels;
 
-    // temporary buffer to hold the decompressed data from the JPEG
-    // file before it is stuck into the mPixels array
-    JSAMPARRAY rowBuffer = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo,
-                                                      JPOOL_IMAGE,
-                                                      rowStride, 1);
-
-    // Load all rows of pixels.
+    // Decode rows straight into the pixel array, flipped so that the
+    // bottom row comes first, then expand them in place to RGBA.
+    const int kMaxRows = 16;
+    JSAMPROW rows[kMaxRows];
     while (cinfo.output_scanline < cinfo.output_height) {
-
-        STColor4ub* curPixel = &pixels[ width * (height-cinfo.output_scanline-1) ];
-
-        jpeg_read_scanlines(&cinfo, rowBuffer, 1);
-
-        unsigned char* buf = rowBuffer[0];
-        if (cinfo.output_components == 3) {
-            // RGB data
-            for (int ii = 0; ii < width; ++ii) {
-                curPixel->r = *buf++;
-                curPixel->g = *buf++;
-                curPixel->b = *buf++;
-                curPixel->a = 255;
-                curPixel++;
-            }
-        } else {
-            // Greyscale data
-            for (int ii = 0; ii < width; ++ii) {
-                curPixel->r = curPixel->g = curPixel->b = *buf++;
-                curPixel->a = 255;
-                curPixel++;
-            }
-        }
+        int numRows = 0;
+        for (; numRows < kMaxRows && (int)cinfo.output_scanline + numRows < height; ++numRows)
+            rows[numRows] = (JSAMPROW)&pixels[width * (height-cinfo.output_scanline-numRows-1)];
+        int first = cinfo.output_scanline;
+        int numRead = jpeg_read_scanlines(&cinfo, rows, numRows);
+        for (int i = 0; i < numRead; ++i)
+            ExpandRowToRGBA((unsigned char*)&pixels[width * (height-first-i-1)], width, numChannels);
     }
 
     // Clean up libjpeg.
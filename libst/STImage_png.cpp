@@ -74,91 +74,50 @@ void STImage::LoadPNG(const std::string& filename)
     png_init_io(pngPtr, imgFile);
     png_set_sig_bytes(pngPtr, 8);
 
-    // The following code used the libpng high level interface
-    // to read data from the file into the array of STColor4ub structs
-    // representing an image in this class.  Format conversion into 8-bit
-    // RGBA as currently required by this class, requires an additional
-    // buffer copy.  Using the libpng **low-level interface** this buffer
-    // copy and the associated buffer double allocation could be avoided.
-    // The code would be complicated slightly with additional libpng
-    // transform calls, so I will leave this for later if performance or
-    // memory footprint becomes an issue.
-
-    // These transforms get us very close to 8 bit per channel RGBA, but
-    // not quite (won't extend from 1 or 3 components to 4.  Must use low
-    // level interface to do this.
-    int transforms =            
-            PNG_TRANSFORM_PACKING |
-            PNG_TRANSFORM_PACKSWAP |
-            PNG_TRANSFORM_EXPAND |
-            PNG_TRANSFORM_SHIFT;
-
-    
-    // Tell libpng to load the image into memory
-    png_read_png(pngPtr, infoPtr, transforms, NULL);
-
-    
-    // libpng exposes the data as an array of arrays of bytes
-    png_bytepp pngRowPointers = png_get_rows(pngPtr, infoPtr);
+    // Use the libpng low-level interface so rows are decoded straight
+    // into the pixel array. These are the transforms png_read_png() used
+    // to apply (expand palettes, low bit depths and transparency to 8 bit
+    // gray, gray+alpha, RGB or RGBA), plus stripping 16 bit channels to 8.
+    png_read_info(pngPtr, infoPtr);
+    png_set_packing(pngPtr);
+    png_set_packswap(pngPtr);
+    png_set_expand(pngPtr);
+    if (png_get_valid(pngPtr, infoPtr, PNG_INFO_sBIT)) {
+        png_color_8p sigBit;
+        png_get_sBIT(pngPtr, infoPtr, &sigBit);
+        png_set_shift(pngPtr, sigBit);
+    }
+    png_set_strip_16(pngPtr);
+    png_set_interlace_handling(pngPtr);
+    png_read_update_info(pngPtr, infoPtr);
 
     int width = png_get_image_width(pngPtr, infoPtr);
     int height = png_get_image_height(pngPtr, infoPtr);
-    Initialize(width, height);
-    STColor4ub* pixels = mPixels;
-
     int numChannels = png_get_channels(pngPtr, infoPtr);
-
-    // Now copy the data read by libpng into the STImage class'
-    // contiguous allocation of pixel data.  In doing so, explode
-    // single channel images or images without an alpha channle
-    // into full RGBA pixels.  
-    //
-    // We also need to flip the order of the rows of data.  Data in
-    // the png file begins with the topmost row of the image.  The
-    // STImage class stores data bottom row first to be consistent
-    // with OpenGL pixel formats
-    for (int i = 0; i < height; ++i) {
-
-        png_bytep srcPtr = pngRowPointers[height-i-1]; 
-        STColor4ub* curPixel = &pixels[ i*width ];
-
-        for (int j = 0; j < width; ++j) {
-
-            switch (numChannels) {
-
-            // monochrome, no alpha
-            case 1:
-                curPixel->r = curPixel->g = curPixel->b = *srcPtr++;
-                curPixel->a = 255;
-                break;
-
-            // monochrome, with alpha
-            case 2:
-                curPixel->r = curPixel->g = curPixel->b = *srcPtr++;
-                curPixel->a = *srcPtr++;
-                break;
-
-            // RGB, no alpha
-            case 3:
-                curPixel->r = *srcPtr++;
-                curPixel->g = *srcPtr++;
-                curPixel->b = *srcPtr++;
-                curPixel->a = 255;
-                break;
-                
-            // RGBA
-            case 4:
-                curPixel->r = *srcPtr++;
-                curPixel->g = *srcPtr++;
-                curPixel->b = *srcPtr++;
-                curPixel->a = *srcPtr++;
-                break;
-            }
-
-            curPixel++;
-        }
+    if (numChannels < 1 || numChannels > 4 ||
+        png_get_rowbytes(pngPtr, infoPtr) != (png_size_t)width * numChannels) {
+        fprintf(stderr, "STImage::LoadPNG() - Unsupported pixel format in '%s'.\n",
+                filename.c_str());
+        png_destroy_read_struct(&pngPtr, &infoPtr, (png_infopp)NULL);
+        fclose(imgFile);
+        throw std::runtime_error("Error in LoadPNG");
     }
+    Initialize(width, height);
 
+    // The png file begins with the topmost row of the image, while the
+    // STImage class stores data bottom row first to be consistent with
+    // OpenGL pixel formats, so row i of the file goes to row height-i-1.
+    // Each row is decoded with its own number of channels into the start
+    // of its RGBA row and then expanded in place.
+    png_bytepp rowPointers = (png_bytepp)png_malloc(pngPtr, sizeof(png_bytep) * height);
+    for (int i = 0; i < height; ++i)
+        rowPointers[i] = (png_bytep)&mPixels[(height-i-1) * width];
+    png_read_image(pngPtr, rowPointers);
+    png_read_end(pngPtr, NULL);
+    png_free(pngPtr, rowPointers);
+
+    for (int i = 0; i < height; ++i)
+        ExpandRowToRGBA((unsigned char*)&mPixels[i * width], width, numChannels);
 
     // Clean up libpng.
     png_destroy_read_struct(&pngPtr, &infoPtr, (png_infopp)NULL);
@@ -0,0 +1,202 @@
+// STMappedFile.cpp
+#include "STMappedFile.h"
+#include "STParallel.h"
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Mapping an empty file fails on every platform, so empty files get this.
+static const char sEmpty[1] = { 0 };
+
+#ifdef _WIN32
+
+STMappedFile::STMappedFile()
+    : mData(sEmpty), mSize(0), mFile(INVALID_HANDLE_VALUE), mMapping(0)
+{
+}
+
+bool STMappedFile::Open(const std::string& filename)
+{
+    Close();
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+    mFile = file;
+    if (size.QuadPart == 0)
+        return true;
+    mMapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mMapping) {
+        Close();
+        return false;
+    }
+    const void* data = MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        Close();
+        return false;
+    }
+    mData = (const char*)data;
+    mSize = (size_t)size.QuadPart;
+    return true;
+}
+
+void STMappedFile::Close()
+{
+    if (mSize > 0)
+        UnmapViewOfFile(mData);
+    if (mMapping)
+        CloseHandle(mMapping);
+    if (mFile != INVALID_HANDLE_VALUE)
+        CloseHandle(mFile);
+    mData = sEmpty;
+    mSize = 0;
+    mFile = INVALID_HANDLE_VALUE;
+    mMapping = 0;
+}
+
+bool STMappedFile::GetFileInfo(const std::string& filename, unsigned long long* size, long long* modifiedTime)
+{
+    struct _stat64 info;
+    if (_stat64(filename.c_str(), &info) != 0)
+        return false;
+    if (size) *size = (unsigned long long)info.st_size;
+    if (modifiedTime) *modifiedTime = (long long)info.st_mtime;
+    return true;
+}
+
+bool STMappedFile::CommitFile(FILE* file, const std::string& tempFilename, const std::string& filename, bool ok)
+{
+    // the data has to be on disk before the rename makes it the file
+    ok = ok && fflush(file) == 0 && !ferror(file) && _commit(_fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    ok = ok && MoveFileExA(tempFilename.c_str(), filename.c_str(),
+                           MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+    if (!ok)
+        remove(tempFilename.c_str());
+    return ok;
+}
+
+#else
+
+STMappedFile::STMappedFile()
+    : mData(sEmpty), mSize(0), mFile(-1)
+{
+}
+
+bool STMappedFile::Open(const std::string& filename)
+{
+    Close();
+    int file = open(filename.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+    struct stat info;
+    if (fstat(file, &info) != 0) {
+        close(file);
+        return false;
+    }
+    mFile = file;
+    if (info.st_size == 0)
+        return true;
+    void* data = mmap(0, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (data == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+    mData = (const char*)data;
+    mSize = (size_t)info.st_size;
+    return true;
+}
+
+void STMappedFile::Close()
+{
+    if (mSize > 0)
+        munmap((void*)mData, mSize);
+    if (mFile >= 0)
+        close(mFile);
+    mData = sEmpty;
+    mSize = 0;
+    mFile = -1;
+}
+
+bool STMappedFile::GetFileInfo(const std::string& filename, unsigned long long* size, long long* modifiedTime)
+{
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+        return false;
+    if (size) *size = (unsigned long long)info.st_size;
+    if (modifiedTime) *modifiedTime = (long long)info.st_mtime;
+    return true;
+}
+
+bool STMappedFile::CommitFile(FILE* file, const std::string& tempFilename, const std::string& filename, bool ok)
+{
+    // the data has to be on disk before the rename makes it the file
+    ok = ok && fflush(file) == 0 && !ferror(file) && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(tempFilename.c_str(), filename.c_str()) == 0;
+    if (!ok)
+        remove(tempFilename.c_str());
+    return ok;
+}
+
+#endif
+
+STMappedFile::~STMappedFile()
+{
+    Close();
+}
+
+//
+// Every 1 MB block is hashed independently, 8 bytes at a time, and the
+// block hashes are then combined in order, so the result does not depend
+// on the number of threads.
+//
+static unsigned long long HashBlock(const char* data, size_t size, unsigned long long seed)
+{
+    const unsigned long long kPrime = 0x9E3779B97F4A7C15ull;
+    unsigned long long h = seed ^ (size * kPrime);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        unsigned long long word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * kPrime;
+        h ^= h >> 31;
+    }
+    for (; i < size; i++)
+        h = (h ^ (unsigned char)data[i]) * kPrime;
+    return h ^ (h >> 29);
+}
+
+unsigned long long STMappedFile::ComputeHash() const
+{
+    const size_t kBlockSize = 1 << 20;
+    size_t numBlocks = (mSize + kBlockSize - 1) / kBlockSize;
+    std::vector<unsigned long long> blockHashes(numBlocks);
+    STParallelFor(0, numBlocks, [&](size_t begin, size_t end, size_t) {
+        for (size_t b = begin; b < end; b++) {
+            size_t offset = b * kBlockSize;
+            blockHashes[b] = HashBlock(mData + offset, (std::min)(kBlockSize, mSize - offset), b);
+        }
+    }, 1);
+    return HashBlock(numBlocks ? (const char*)&blockHashes[0] : sEmpty,
+                     numBlocks * sizeof(unsigned long long), mSize);
+}
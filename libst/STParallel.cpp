@@ -0,0 +1,16 @@
+// STParallel.cpp
+#include "STParallel.h"
+
+static unsigned int sNumThreads=0;
+
+unsigned int STGetNumThreads()
+{
+    if(sNumThreads>0) return sNumThreads;
+    unsigned int n=std::thread::hardware_concurrency();
+    return n>0 ? n : 1;
+}
+
+void STSetNumThreads(unsigned int numThreads)
+{
+    sNumThreads=numThreads;
+}
@@ -0,0 +1,233 @@
+// STProfiler.cpp
+
+/* Include-order dependency!
+*
+* GLEW must be included before the standard GL.h header.
+*/
+#ifdef __APPLE__
+#define GLEW_VERSION_3_3 1
+#include <OpenGL/gl.h>
+#else
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GL/gl.h"
+#endif
+
+#include "STProfiler.h"
+
+#include <algorithm>
+#include <string.h>
+
+STProfiler::STProfiler(unsigned int window)
+    : mWindow(window > 0 ? window : 1), mCurrent(-1), mCurrentStart(0.0f), mFrame(0),
+      mGPUTimers(false), mGPUChecked(false), mNumDropped(0), mCSV(NULL)
+{
+    mSetFrames[0] = mSetFrames[1] = 0;
+    mSetStarts[0] = mSetStarts[1] = 0.0f;
+    FindSection("frame");
+}
+
+STProfiler::~STProfiler()
+{
+    StopCSV();
+    for (size_t i = 0; i < mSections.size(); i++) {
+        if (mSections[i].queries[0] != 0)
+            glDeleteQueries(2, mSections[i].queries);
+    }
+}
+
+int STProfiler::FindSection(const char* name)
+{
+    for (size_t i = 0; i < mSections.size(); i++) {
+        if (mSections[i].name == name)
+            return (int)i;
+    }
+    Section section;
+    section.name = name;
+    section.cpuSamples.resize(mWindow);
+    section.gpuSamples.resize(mWindow);
+    section.numCPUSamples = 0;
+    section.numGPUSamples = 0;
+    for (int set = 0; set < 2; set++) {
+        section.queries[set] = 0;
+        section.issued[set] = false;
+        section.cpuMillis[set] = -1.0f;
+    }
+    mSections.push_back(section);
+    return (int)mSections.size() - 1;
+}
+
+void STProfiler::BeginFrame()
+{
+    // the GL context has to be current by the first frame
+    if (!mGPUChecked) {
+        mGPUChecked = true;
+#ifdef __APPLE__
+        mGPUTimers = true;
+#else
+        mGPUTimers = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+#endif
+    }
+
+    // this frame reuses the queries of two frames ago
+    int set = mFrame & 1;
+    if (mFrame >= 2)
+        Collect(set);
+    mSetFrames[set] = mFrame;
+    mSetStarts[set] = mClock.GetElapsedMillis();
+    for (size_t i = 0; i < mSections.size(); i++) {
+        mSections[i].issued[set] = false;
+        mSections[i].cpuMillis[set] = -1.0f;
+    }
+    mFrameTimer.Reset();
+}
+
+void STProfiler::EndFrame()
+{
+    Section& frame = mSections[0];
+    float millis = mFrameTimer.GetElapsedMillis();
+    AddSample(frame.cpuSamples, frame.numCPUSamples, mWindow, millis);
+    frame.cpuMillis[mFrame & 1] = millis;
+    mFrame++;
+}
+
+void STProfiler::Begin(const char* name)
+{
+    mCurrent = FindSection(name);
+    Section& section = mSections[mCurrent];
+    int set = mFrame & 1;
+
+    // a section timed twice in a frame only gets GPU time the first time
+    if (mGPUTimers && !section.issued[set]) {
+        if (section.queries[0] == 0)
+            glGenQueries(2, section.queries);
+        glBeginQuery(GL_TIME_ELAPSED, section.queries[set]);
+    }
+    mCurrentStart = mFrameTimer.GetElapsedMillis();
+}
+
+void STProfiler::End()
+{
+    if (mCurrent < 0)
+        return;
+    Section& section = mSections[mCurrent];
+    int set = mFrame & 1;
+
+    float millis = mFrameTimer.GetElapsedMillis() - mCurrentStart;
+    if (mGPUTimers && !section.issued[set]) {
+        glEndQuery(GL_TIME_ELAPSED);
+        section.issued[set] = true;
+    }
+    if (section.cpuMillis[set] >= 0.0f) {
+        section.cpuMillis[set] += millis;
+        section.cpuSamples[(section.numCPUSamples - 1) % mWindow] += millis;
+    } else {
+        section.cpuMillis[set] = millis;
+        AddSample(section.cpuSamples, section.numCPUSamples, mWindow, millis);
+    }
+    mCurrent = -1;
+}
+
+//
+// Read the GPU times of the frame that used query set, if they are ready,
+// and write the frame to the CSV file.
+//
+void STProfiler::Collect(int set)
+{
+    unsigned int frameNumber = mSetFrames[set];
+    float sinceFrameStart = mClock.GetElapsedMillis() - mSetStarts[set];
+    float frameGPUMillis = 0.0f;
+    bool frameGPUComplete = mGPUTimers;
+    for (size_t i = 1; i < mSections.size(); i++) {
+        Section& section = mSections[i];
+        if (section.cpuMillis[set] < 0.0f)
+            continue;
+        float gpuMillis = -1.0f;
+        if (section.issued[set]) {
+            GLint available = 0;
+            glGetQueryObjectiv(section.queries[set], GL_QUERY_RESULT_AVAILABLE, &available);
+            GLuint64 nanos = 0;
+            if (available)
+                glGetQueryObjectui64v(section.queries[set], GL_QUERY_RESULT, &nanos);
+            if (available && nanos / 1.0e6 <= sinceFrameStart) {
+                gpuMillis = (float)(nanos / 1.0e6);
+                AddSample(section.gpuSamples, section.numGPUSamples, mWindow, gpuMillis);
+                frameGPUMillis += gpuMillis;
+            } else {
+                mNumDropped++;
+                frameGPUComplete = false;
+            }
+        }
+        if (mCSV) {
+            fprintf(mCSV, "%u,%s,%.3f,", frameNumber, section.name.c_str(), section.cpuMillis[set]);
+            if (gpuMillis >= 0.0f)
+                fprintf(mCSV, "%.3f", gpuMillis);
+            fprintf(mCSV, "\n");
+        }
+    }
+
+    Section& frame = mSections[0];
+    if (frame.cpuMillis[set] < 0.0f)
+        return;
+    if (frameGPUComplete)
+        AddSample(frame.gpuSamples, frame.numGPUSamples, mWindow, frameGPUMillis);
+    if (mCSV) {
+        fprintf(mCSV, "%u,%s,%.3f,", frameNumber, frame.name.c_str(), frame.cpuMillis[set]);
+        if (frameGPUComplete)
+            fprintf(mCSV, "%.3f", frameGPUMillis);
+        fprintf(mCSV, "\n");
+    }
+}
+
+void STProfiler::AddSample(std::vector<float>& samples, unsigned int& count, unsigned int window, float value)
+{
+    samples[count % window] = value;
+    count++;
+}
+
+STProfiler::Stats STProfiler::ComputeStats(const std::vector<float>& samples, unsigned int count)
+{
+    Stats stats;
+    stats.count = (std::min)(count, (unsigned int)samples.size());
+    stats.mean = stats.p95 = stats.max = 0.0f;
+    if (stats.count == 0)
+        return stats;
+
+    std::vector<float> sorted(samples.begin(), samples.begin() + stats.count);
+    std::sort(sorted.begin(), sorted.end());
+    float sum = 0.0f;
+    for (size_t i = 0; i < sorted.size(); i++)
+        sum += sorted[i];
+    stats.mean = sum / stats.count;
+    stats.p95 = sorted[(stats.count * 95 + 99) / 100 - 1];
+    stats.max = sorted.back();
+    return stats;
+}
+
+STProfiler::Stats STProfiler::GetCPUStats(int section) const
+{
+    return ComputeStats(mSections[section].cpuSamples, mSections[section].numCPUSamples);
+}
+
+STProfiler::Stats STProfiler::GetGPUStats(int section) const
+{
+    return ComputeStats(mSections[section].gpuSamples, mSections[section].numGPUSamples);
+}
+
+bool STProfiler::StartCSV(const std::string& filename)
+{
+    StopCSV();
+    mCSV = fopen(filename.c_str(), "w");
+    if (!mCSV)
+        return false;
+    fprintf(mCSV, "frame,section,cpu_ms,gpu_ms\n");
+    return true;
+}
+
+void STProfiler::StopCSV()
+{
+    if (mCSV) {
+        fclose(mCSV);
+        mCSV = NULL;
+    }
+}
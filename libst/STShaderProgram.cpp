@@ -24,10 +24,16 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <string.h>
 
 //
 
+unsigned int STShaderProgram::sNumGLCalls = 0;
+bool STShaderProgram::sCacheUniforms = true;
+STShaderProgram* STShaderProgram::sBound = NULL;
+
 STShaderProgram::STShaderProgram()
+    : hasPending(false)
 {
     if(GLEW_VERSION_2_0)
         programid = glCreateProgram();
@@ -39,6 +45,8 @@ STShaderProgram::STShaderProgram()
 
 STShaderProgram::~STShaderProgram()
 {
+    if (sBound == this)
+        sBound = NULL;
     if(GLEW_VERSION_2_0)
         glDeleteProgram(programid);
 #ifndef __APPLE__
@@ -80,7 +88,6 @@ void STShaderProgram::LoadVertexShader(const std::string& filename)
             assert(false);
         }
         glAttachShader(programid, shader);
-        glLinkProgram(programid);
     }
 #ifndef __APPLE__
     else
@@ -98,9 +105,9 @@ void STShaderProgram::LoadVertexShader(const std::string& filename)
             assert(false);
         }
         glAttachObjectARB(programid, shader);
-        glLinkProgramARB(programid);
     }
 #endif
+    Link();
 }
 
 void STShaderProgram::LoadFragmentShader(const std::string& filename)
@@ -136,7 +143,6 @@ void STShaderProgram::LoadFragmentShader(const std::string& filename)
             assert(false);
         }
         glAttachShader(programid, shader);
-        glLinkProgram(programid);
     }
 #ifndef __APPLE__
     else
@@ -154,124 +160,322 @@ void STShaderProgram::LoadFragmentShader(const std::string& filename)
             assert(false);
         }
         glAttachObjectARB(programid, shader);
-        glLinkProgramARB(programid);
     }
 #endif
+    Link();
 }
 
 
+// Link the program and resolve the location of every active uniform.
+// Array uniforms can be found both as "name" and "name[0]".
+void STShaderProgram::Link()
+{
+    uniforms.clear();
+    uniformIndices.clear();
+    textures.clear();
+    hasPending = false;
+
+    GLint numUniforms = 0;
+    GLint maxLength = 0;
+    if(GLEW_VERSION_2_0) {
+        glLinkProgram(programid);
+        glGetProgramiv(programid, GL_ACTIVE_UNIFORMS, &numUniforms);
+        glGetProgramiv(programid, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    }
+#ifndef __APPLE__
+    else {
+        glLinkProgramARB(programid);
+        glGetObjectParameterivARB(programid, GL_OBJECT_ACTIVE_UNIFORMS_ARB, &numUniforms);
+        glGetObjectParameterivARB(programid, GL_OBJECT_ACTIVE_UNIFORM_MAX_LENGTH_ARB, &maxLength);
+    }
+#endif
+
+    std::vector<char> buffer(maxLength + 1);
+    for (GLint i = 0; i < numUniforms; i++) {
+        GLint size = 0;
+        GLenum type = 0;
+        if(GLEW_VERSION_2_0)
+            glGetActiveUniform(programid, i, (GLsizei)buffer.size(), NULL, &size, &type, &buffer[0]);
+#ifndef __APPLE__
+        else
+            glGetActiveUniformARB(programid, i, (GLsizei)buffer.size(), NULL, &size, &type, &buffer[0]);
+#endif
+        std::string name(&buffer[0]);
+        UniformSlot slot;
+        slot.location = GetUniformLocation(name);
+        slot.type = kFloat1;
+        slot.count = 0;
+        slot.pending = false;
+        if (slot.location < 0)
+            continue;   // built-in gl_ uniforms
+        int index = (int)uniforms.size();
+        uniforms.push_back(slot);
+        uniformIndices[name] = index;
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            uniformIndices[name.substr(0, name.size() - 3)] = index;
+    }
+}
+
 /* Bind the program as the current program. */
 void STShaderProgram::Bind() {
+    sNumGLCalls++;
     if(GLEW_VERSION_2_0)
         glUseProgram(programid);    
 #ifndef __APPLE__
     else
         glUseProgramObjectARB(programid);
 #endif
+    sBound = this;
 
-    for (unsigned int i = 0; i < textures.size(); i++) {
-        if (GLEW_VERSION_2_0)
-            glUniform1i(textures[i].location, textures[i].tex_id);
-#ifndef __APPLE__
-        else
-            glUniform1iARB(textures[i].location, textures[i].tex_id);
-#endif
+    if (hasPending) {
+        for (unsigned int i = 0; i < uniforms.size(); i++) {
+            if (uniforms[i].pending)
+                Send(uniforms[i]);
+        }
+        hasPending = false;
     }
+    for (unsigned int i = 0; i < textures.size(); i++)
+        SetUniformInt(textures[i].uniform, textures[i].tex_id);
 }
 
 /* Un-bind the program. */
 void STShaderProgram::UnBind() {
+    sNumGLCalls++;
     if(GLEW_VERSION_2_0)
         glUseProgram(0);
+#ifndef __APPLE__
     else
         glUseProgramObjectARB(0);
+#endif
+    sBound = NULL;
 }
 
+// Sampler uniforms are set again on every Bind(), or right away if
+// the program is already bound.
 void STShaderProgram::SetTexture(const std::string& name, int tex_index) {
-    GLint location = glGetUniformLocation(programid, name.c_str());
-    UnboundTexture tex;
-    tex.location = location;
-    tex.tex_id   = tex_index;
-    textures.push_back(tex);
+    Uniform uniform = FindUniform(name);
+    if (!uniform.IsValid())
+        return;
+    unsigned int i = 0;
+    while (i < textures.size() && textures[i].uniform.index != uniform.index)
+        i++;
+    if (i == textures.size()) {
+        UnboundTexture tex;
+        tex.uniform = uniform;
+        textures.push_back(tex);
+    }
+    textures[i].tex_id = tex_index;
+    if (sBound == this)
+        SetUniformInt(uniform, tex_index);
 }
 
-// Set a uniform global parameter of the program by name.
-void STShaderProgram::SetUniform(const std::string& name, float value)
+STShaderProgram::Uniform STShaderProgram::GetUniform(const std::string& name) const
+{
+    std::unordered_map<std::string, int>::const_iterator it = uniformIndices.find(name);
+    return it == uniformIndices.end() ? Uniform() : Uniform(it->second);
+}
+
+// Handle for the setters that take a name. Without sCacheUniforms this
+// also makes the glGetUniformLocation() call every lookup used to cost.
+STShaderProgram::Uniform STShaderProgram::FindUniform(const std::string& name)
+{
+    if (!sCacheUniforms)
+        GetUniformLocation(name);
+    return GetUniform(name);
+}
+
+// Upload count values of the given type, unless they are the values
+// already in the uniform. glUniform*() sets the uniform of whichever
+// program is bound, so when that is another one the values are kept
+// and sent by the next Bind().
+void STShaderProgram::Upload(Uniform uniform, UniformType type, const void* data, int count)
 {
-    GLint location = GetUniformLocation(name);
+    if (!uniform.IsValid() || count <= 0)
+        return;
+    static const size_t kTypeSizes[] = {
+        sizeof(float), 2*sizeof(float), 3*sizeof(float), 4*sizeof(float), sizeof(GLint), 16*sizeof(float)
+    };
+    UniformSlot& slot = uniforms[uniform.index];
+    size_t bytes = kTypeSizes[type] * count;
+    if (sCacheUniforms && slot.value.size() == bytes && memcmp(&slot.value[0], data, bytes) == 0)
+        return;
+    const unsigned char* begin = (const unsigned char*)data;
+    slot.value.assign(begin, begin + bytes);
+    slot.type = type;
+    slot.count = count;
+    if (sBound == this) {
+        Send(slot);
+    } else {
+        slot.pending = true;
+        hasPending = true;
+    }
+}
+
+// Upload the value of a slot to the bound program.
+void STShaderProgram::Send(UniformSlot& slot)
+{
+    slot.pending = false;
+    sNumGLCalls++;
+    int count = slot.count;
+    UniformType type = slot.type;
+    const void* data = &slot.value[0];
+    const float* f = (const float*)data;
     if(GLEW_VERSION_2_0) {
-        glUniform1f(location, value);
+        switch (type) {
+            case kFloat1:  glUniform1fv(slot.location, count, f); break;
+            case kFloat2:  glUniform2fv(slot.location, count, f); break;
+            case kFloat3:  glUniform3fv(slot.location, count, f); break;
+            case kFloat4:  glUniform4fv(slot.location, count, f); break;
+            case kInt1:    glUniform1iv(slot.location, count, (const GLint*)data); break;
+            case kMatrix4: glUniformMatrix4fv(slot.location, count, GL_FALSE, f); break;
+        }
     }
+#ifndef __APPLE__
     else {
-        glUniform1fARB(location, value);
+        switch (type) {
+            case kFloat1:  glUniform1fvARB(slot.location, count, f); break;
+            case kFloat2:  glUniform2fvARB(slot.location, count, f); break;
+            case kFloat3:  glUniform3fvARB(slot.location, count, f); break;
+            case kFloat4:  glUniform4fvARB(slot.location, count, f); break;
+            case kInt1:    glUniform1ivARB(slot.location, count, (const GLint*)data); break;
+            case kMatrix4: glUniformMatrix4fvARB(slot.location, count, GL_FALSE, f); break;
+        }
     }
+#endif
+}
+
+void STShaderProgram::SetUniform(Uniform uniform, float value)
+{
+    Upload(uniform, kFloat1, &value, 1);
+}
+
+void STShaderProgram::SetUniform(Uniform uniform, float v0, float v1)
+{
+    float v[2] = { v0, v1 };
+    Upload(uniform, kFloat2, v, 1);
+}
+
+void STShaderProgram::SetUniform(Uniform uniform, float v0, float v1, float v2)
+{
+    float v[3] = { v0, v1, v2 };
+    Upload(uniform, kFloat3, v, 1);
+}
+
+void STShaderProgram::SetUniform(Uniform uniform, float v0, float v1, float v2, float v3)
+{
+    float v[4] = { v0, v1, v2, v3 };
+    Upload(uniform, kFloat4, v, 1);
+}
+
+void STShaderProgram::SetUniform(Uniform uniform, const STVector2& value)
+{
+    SetUniform(uniform, value.x, value.y);
+}
+
+void STShaderProgram::SetUniform(Uniform uniform, const STVector3& value)
+{
+    SetUniform(uniform, value.x, value.y, value.z);
+}
+
+void STShaderProgram::SetUniform(Uniform uniform, const STColor3f& value)
+{
+    SetUniform(uniform, value.r, value.g, value.b);
+}
+
+void STShaderProgram::SetUniform(Uniform uniform, const STColor4f& value)
+{
+    SetUniform(uniform, value.r, value.g, value.b, value.a);
+}
+
+void STShaderProgram::SetUniformInt(Uniform uniform, int value)
+{
+    GLint v = value;
+    Upload(uniform, kInt1, &v, 1);
+}
+
+void STShaderProgram::SetUniformArray(Uniform uniform, const float* values, int count, int components)
+{
+    if (components >= 1 && components <= 4)
+        Upload(uniform, (UniformType)(kFloat1 + components - 1), values, count);
+}
+
+void STShaderProgram::SetUniformMatrix(Uniform uniform, const float* matrix, int count)
+{
+    Upload(uniform, kMatrix4, matrix, count);
+}
+
+// Set a uniform global parameter of the program by name.
+void STShaderProgram::SetUniform(const std::string& name, float value)
+{
+    SetUniform(FindUniform(name), value);
 }
 
 // Set a uniform global parameter of the program by name.
 void STShaderProgram::SetUniform(const std::string& name, float v0, float v1)
 {
-    GLint location = GetUniformLocation(name);
-    if(GLEW_VERSION_2_0) {
-        glUniform2f(location, v0, v1);
-    }
-    else {
-        glUniform2fARB(location, v0, v1);
-    }
+    SetUniform(FindUniform(name), v0, v1);
 }
 
 // Set a uniform global parameter of the program by name.
 void STShaderProgram::SetUniform(const std::string& name,
                                  float v0, float v1, float v2)
 {
-    GLint location = GetUniformLocation(name);
-    if(GLEW_VERSION_2_0) {
-        glUniform3f(location, v0, v1, v2);
-    }
-    else {
-        glUniform3fARB(location, v0, v1, v2);
-    }
+    SetUniform(FindUniform(name), v0, v1, v2);
 }
 
 // Set a uniform global parameter of the program by name.
 void STShaderProgram::SetUniform(const std::string& name,
                                  float v0, float v1, float v2, float v3)
 {
-    GLint location = GetUniformLocation(name);
-    if(GLEW_VERSION_2_0) {
-        glUniform4f(location, v0, v1, v2, v3);
-    }
-    else {
-        glUniform4fARB(location, v0, v1, v2, v3);
-    }
+    SetUniform(FindUniform(name), v0, v1, v2, v3);
 }
 
 // Set a uniform global parameter of the program by name.
 void STShaderProgram::SetUniform(const std::string& name, const STVector2& value)
 {
-    SetUniform(name, value.x, value.y);
+    SetUniform(FindUniform(name), value);
 }
 
 // Set a uniform global parameter of the program by name.
 void STShaderProgram::SetUniform(const std::string& name, const STVector3& value)
 {
-    SetUniform(name, value.x, value.y, value.z);
+    SetUniform(FindUniform(name), value);
 }
 
 // Set a uniform global parameter of the program by name.
 void STShaderProgram::SetUniform(const std::string& name, const STColor3f& value)
 {
-    SetUniform(name, value.r, value.g, value.b);
+    SetUniform(FindUniform(name), value);
 }
 
 // Set a uniform global parameter of the program by name.
 void STShaderProgram::SetUniform(const std::string& name, const STColor4f& value)
 {
-    SetUniform(name, value.r, value.g, value.b, value.a);
+    SetUniform(FindUniform(name), value);
+}
+
+// Set a uniform global parameter of the program by name.
+void STShaderProgram::SetUniformInt(const std::string& name, int value)
+{
+    SetUniformInt(FindUniform(name), value);
+}
+
+// Set a uniform global parameter of the program by name.
+void STShaderProgram::SetUniformArray(const std::string& name, const float* values, int count, int components)
+{
+    SetUniformArray(FindUniform(name), values, count, components);
+}
+
+// Set a uniform global parameter of the program by name.
+void STShaderProgram::SetUniformMatrix(const std::string& name, const float* matrix, int count)
+{
+    SetUniformMatrix(FindUniform(name), matrix, count);
 }
 
 // Helper routine - get the location for a uniform shader parameter.
 GLint STShaderProgram::GetUniformLocation(const std::string& name)
 {
+    sNumGLCalls++;
     if(GLEW_VERSION_2_0) {
         return glGetUniformLocation(programid, name.c_str());
     }
@@ -281,3 +485,16 @@ GLint STShaderProgram::GetUniformLocation(const std::string& name)
     }
 #endif
 }
+
+GLint STShaderProgram::GetAttribLocation(const std::string& name)
+{
+    sNumGLCalls++;
+    if(GLEW_VERSION_2_0) {
+        return glGetAttribLocation(programid, name.c_str());
+    }
+#ifndef __APPLE__
+    else {
+        return glGetAttribLocationARB(programid, name.c_str());
+    }
+#endif
+}
@@ -1,9 +1,38 @@
 // STTexture.cpp
+
+/* Include-order dependency!
+*
+* GLEW must be included before the standard GL.h header.
+* In this case, it means we must violate the usual design
+* principle of always including Foo.h first in Foo.cpp.
+*/
+#ifdef __APPLE__
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+#else
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GL/gl.h"
+#endif
+
 #include "STTexture.h"
 
 #include "st.h"
 #include "stgl.h"
 
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RG_RGTC2
+#define GL_COMPRESSED_RG_RGTC2 0x8DBD
+#endif
+#ifndef GL_TEXTURE_MAX_LEVEL
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
+
 //
 
 // Create an "empty" STTexture with no image data. You will need
@@ -29,10 +58,22 @@ STTexture::STTexture(
     LoadImageData(image, options);
 }
 
+// Create a new STTexture from a block-compressed image and all of
+// its mipmap levels.
+STTexture::STTexture(const STCompressedImage* image)
+    : mWidth(-1)
+    , mHeight(-1)
+{
+    Initialize();
+    LoadCompressedData(image);
+}
+
 // Common initialization code, used by all constructors.
 void STTexture::Initialize()
 {
     mTexId = 0;
+    mTwoChannel = false;
+    mMemoryUsage = 0;
     glGenTextures(1, &mTexId);
 
     // Default filtering and addressing options:
@@ -61,10 +102,14 @@ void STTexture::LoadImageData(const STImage* image,
     mHeight = height;
     const STColor4ub* pixels = image->GetPixels();
 
+    mTwoChannel = false;
+    mMemoryUsage = (size_t)width * height * 4;
+
     if (options & kGenerateMipmaps) {
         gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGBA,
                           width, height,
                           GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        mMemoryUsage = mMemoryUsage * 4 / 3;
     }
     else {
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
@@ -74,6 +119,47 @@ void STTexture::LoadImageData(const STImage* image,
     UnBind();
 }
 
+// Load block-compressed data into the STTexture, one call per
+// mipmap level.
+void STTexture::LoadCompressedData(const STCompressedImage* image)
+{
+    static const GLenum kInternalFormats[] = {
+        GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+        GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+        GL_COMPRESSED_RG_RGTC2,
+    };
+    GLenum internalFormat = kInternalFormats[image->GetFormat()];
+
+    Bind();
+    mWidth = image->GetWidth();
+    mHeight = image->GetHeight();
+    mTwoChannel = image->GetFormat() == STCompressedImage::kBC5;
+    mMemoryUsage = image->GetDataSize();
+    for (int i = 0; i < image->GetNumLevels(); i++) {
+        const STCompressedImage::Level& level = image->GetLevel(i);
+        glCompressedTexImage2D(GL_TEXTURE_2D, i, internalFormat,
+                               level.width, level.height, 0,
+                               (GLsizei)level.data.size(), &level.data[0]);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image->GetNumLevels() - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    image->GetNumLevels() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    UnBind();
+}
+
+// Whether the OpenGL driver can sample textures in the given
+// compressed format.
+bool STTexture::IsFormatSupported(STCompressedImage::Format format)
+{
+#ifdef __APPLE__
+    return true;
+#else
+    if (format == STCompressedImage::kBC5)
+        return GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc || GLEW_EXT_texture_compression_rgtc;
+    return GLEW_EXT_texture_compression_s3tc != 0;
+#endif
+}
+
 // Bind this texture for use in subsequent OpenGL drawing.
 void STTexture::Bind()
 {
@@ -11,6 +11,7 @@ STTimer::STTimer()
     LARGE_INTEGER freq;
     QueryPerformanceFrequency(&freq);
     mFrequency = (float)freq.QuadPart;
+    Reset();
 }
 
 
@@ -45,6 +46,7 @@ STTimer::GetElapsedMillis()
 
 STTimer::STTimer()
 {
+    Reset();
 }
 
 /**
@@ -53,7 +55,7 @@ STTimer::STTimer()
 void
 STTimer::Reset()
 {
-    gettimeofday(&mStartTime, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &mStartTime);
 }
 
 
@@ -63,11 +65,11 @@ STTimer::Reset()
 float
 STTimer::GetElapsedMillis()
 {
-  struct timeval currentTime;
-  gettimeofday(&currentTime, NULL);
+  struct timespec currentTime;
+  clock_gettime(CLOCK_MONOTONIC, &currentTime);
 
   return (float)(currentTime.tv_sec - mStartTime.tv_sec)*1000.0f +
-    (float)(currentTime.tv_usec - mStartTime.tv_usec)/1000.0f;
+    (float)(currentTime.tv_nsec - mStartTime.tv_nsec)/1000000.0f;
 }
 
 #endif
@@ -17,12 +17,18 @@
 #endif
 
 #include "STTexture.h"
+#include "STCompressedImage.h"
+#include "STTimer.h"
+#include "STMappedFile.h"
 #include <iostream>
 #include <fstream>
 #include <map>
 #include <math.h>
 #include <string.h>
 #include <algorithm>
+#include <stddef.h>
+#include <stdio.h>
+#include <mutex>
 #define PI 3.14159265
 
 #include <tiny_obj_loader.h>
@@ -34,14 +40,20 @@ const float STTriangleMesh::blue[] ={0.0f,0.0f,1.0f,1.0f};
 const float STTriangleMesh::black[]={0.0f,0.0f,0.0f,1.0f};
 const float STTriangleMesh::white[]={1.0f,1.0f,1.0f,1.0f};
 int STTriangleMesh::instance_count=0;
+bool STTriangleMesh::sImmediateMode=false;
+bool STTriangleMesh::sCompressTextures=true;
 STImage STTriangleMesh::whiteImg=STImage(256, 256, STImage::Pixel(255,255,255,255));
 STTexture* STTriangleMesh::whiteTex = 0;
+// Meshes may be created and destroyed on loader threads.
+static std::mutex sInstanceMutex;
 //
 // Initialization
 //
 STTriangleMesh::STTriangleMesh()
 {
     mSimpleMesh = true;
+    mNumBoundaryEdges = 0;
+    mNumNonManifoldEdges = 0;
     for(int i=0;i<3;i++){
         mMaterialAmbient[i]=0.2f;
         mMaterialDiffuse[i]=0.8f;
@@ -58,12 +70,21 @@ STTriangleMesh::STTriangleMesh()
     mHasColorMap = false;
     mSurfaceColorImg=&whiteImg;
     mSurfaceNormalImg=&whiteImg;
-    if(instance_count==0){
-        whiteTex = new STTexture(&whiteImg);
+    {
+        std::lock_guard<std::mutex> lock(sInstanceMutex);
+        instance_count++;
+    }
+    mSurfaceColorTex=0;
+    mSurfaceNormalTex=0;
+    mSurfaceColorCompressed=0;
+    mSurfaceNormalCompressed=0;
+
+    for(int i=0;i<2;i++){
+        mVertexBuffers[i]=0;
+        mIndexBuffers[i]=0;
+        mIndexCounts[i]=0;
     }
-    instance_count++;
-    mSurfaceColorTex=whiteTex;
-    mSurfaceNormalTex=whiteTex;
+    mBuffersDirty=true;
 }
 
 STTriangleMesh::STTriangleMesh(const std::string& filename)
@@ -78,18 +99,19 @@ STTriangleMesh::STTriangleMesh(const std::string& filename)
 //
 STTriangleMesh::~STTriangleMesh()
 {
-    for(unsigned int i=0;i<mVertices.size();i++)delete mVertices[i];
-    for(unsigned int i=0;i<mTexPos.size();i++)delete mTexPos[i];
-    for(unsigned int i=0;i<mNormals.size();i++)delete mNormals[i];
-    for(unsigned int i=0;i<mFaces.size();i++)delete mFaces[i];
+    ReleaseBuffers();
 	if(mSurfaceColorTex!=whiteTex)delete mSurfaceColorTex;
 	if(mSurfaceColorImg!=&whiteImg)delete mSurfaceColorImg;
-    if(mSurfaceNormalTex!=whiteTex)delete mSurfaceColorTex;
-	if(mSurfaceNormalImg!=&whiteImg)delete mSurfaceColorImg;
+    if(mSurfaceNormalTex!=whiteTex)delete mSurfaceNormalTex;
+	if(mSurfaceNormalImg!=&whiteImg)delete mSurfaceNormalImg;
+    delete mSurfaceColorCompressed;
+    delete mSurfaceNormalCompressed;
 
+    std::lock_guard<std::mutex> lock(sInstanceMutex);
     instance_count--;
     if(instance_count==0){
         delete whiteTex;
+        whiteTex=0;
     }
 }
 
@@ -98,6 +120,7 @@ STTriangleMesh::~STTriangleMesh()
 //
 void STTriangleMesh::Draw(bool smooth) const
 {
+    UploadTextures();
     if(mDrawAxis){
         glPushAttrib(GL_LIGHTING_BIT);
         glActiveTexture(GL_TEXTURE2);
@@ -152,23 +175,31 @@ void STTriangleMesh::Draw(bool smooth) const
     glMaterialfv(GL_FRONT, GL_SPECULAR,  mMaterialSpecular);
     glMaterialfv(GL_FRONT, GL_SHININESS, &mShininess);
     
-    glBegin(GL_TRIANGLES);
-    for (unsigned int i = 0; i < mFaces.size(); i++) {
-        STFace* f=mFaces[i];
-        for (unsigned int j = 0; j < 3; j++) {
-            if(smooth)
-                if(!mSimpleMesh)
-                    glNormal3f(f->normals[j]->x,f->normals[j]->y,f->normals[j]->z);
-                else 
-                    glNormal3f(f->v[j]->normal.x,f->v[j]->normal.y,f->v[j]->normal.z);
-            else
-                glNormal3f(f->normal.x,f->normal.y,f->normal.z);
-            
-            glTexCoord2f(f->texPos[j]->x, f->texPos[j]->y);
-            glVertex3f(f->v[j]->pt.x,f->v[j]->pt.y,f->v[j]->pt.z);
-        }
+    if(sImmediateMode || !UploadBuffers()){
+        DrawImmediate(smooth);
+    }
+    else{
+        int which=smooth ? kSmoothBuffers : kFlatBuffers;
+        glBindBuffer(GL_ARRAY_BUFFER, mVertexBuffers[which]);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexBuffers[which]);
+
+        const GLsizei stride=sizeof(BufferVertex);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glClientActiveTexture(GL_TEXTURE0);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(3, GL_FLOAT, stride, (const GLvoid*)offsetof(BufferVertex, pt));
+        glNormalPointer(GL_FLOAT, stride, (const GLvoid*)offsetof(BufferVertex, normal));
+        glTexCoordPointer(2, GL_FLOAT, stride, (const GLvoid*)offsetof(BufferVertex, texPos));
+
+        glDrawElements(GL_TRIANGLES, mIndexCounts[which], GL_UNSIGNED_INT, 0);
+
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
-    glEnd();
 
     if (mHasNormalMap) {
         glActiveTexture(GL_TEXTURE0);
@@ -180,6 +211,93 @@ void STTriangleMesh::Draw(bool smooth) const
     }
 }
 
+//
+// Draw the triangle mesh with one immediate-mode call per vertex attribute.
+//
+void STTriangleMesh::DrawImmediate(bool smooth) const
+{
+    glBegin(GL_TRIANGLES);
+    for (unsigned int i = 0; i < mIndices.size(); i++) {
+        unsigned int v=mIndices[i];
+        const STVector3& n=smooth ? mNormals[v] : mFaceNormals[i/3];
+        glNormal3f(n.x,n.y,n.z);
+        glTexCoord2f(mTexPos[v].x, mTexPos[v].y);
+        glVertex3f(mPositions[v].x,mPositions[v].y,mPositions[v].z);
+    }
+    glEnd();
+}
+
+//
+// Build the interleaved vertex buffers and index buffers used by Draw().
+// The smooth variant is a straight interleaving of the vertex arrays and
+// uses mIndices as is; the flat variant gives every face its own three
+// vertices so that they can carry the face normal.
+// Returns false if buffer objects are not supported.
+//
+bool STTriangleMesh::UploadBuffers() const
+{
+    if(!mBuffersDirty)
+        return mVertexBuffers[kSmoothBuffers]!=0;
+    if(!GLEW_VERSION_2_0)
+        return false;
+    mBuffersDirty=false;
+
+    if(mVertexBuffers[kSmoothBuffers]==0){
+        glGenBuffers(2, mVertexBuffers);
+        glGenBuffers(2, mIndexBuffers);
+    }
+
+    // smooth: the vertex arrays interleaved, indexed by mIndices
+    std::vector<BufferVertex> vertices(NumVertices());
+    for(unsigned int i=0;i<NumVertices();i++){
+        BufferVertex& bv=vertices[i];
+        bv.pt[0]=mPositions[i].x; bv.pt[1]=mPositions[i].y; bv.pt[2]=mPositions[i].z;
+        bv.normal[0]=mNormals[i].x; bv.normal[1]=mNormals[i].y; bv.normal[2]=mNormals[i].z;
+        bv.texPos[0]=mTexPos[i].x; bv.texPos[1]=mTexPos[i].y;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, mVertexBuffers[kSmoothBuffers]);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(BufferVertex), vertices.empty() ? 0 : &vertices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexBuffers[kSmoothBuffers]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mIndices.size()*sizeof(unsigned int), mIndices.empty() ? 0 : &mIndices[0], GL_STATIC_DRAW);
+    mIndexCounts[kSmoothBuffers]=mIndices.size();
+
+    // flat: three vertices per face, all carrying the face normal
+    vertices.resize(mIndices.size());
+    std::vector<unsigned int> indices(mIndices.size());
+    for(unsigned int i=0;i<mIndices.size();i++){
+        unsigned int v=mIndices[i];
+        const STVector3& n=mFaceNormals[i/3];
+        BufferVertex& bv=vertices[i];
+        bv.pt[0]=mPositions[v].x; bv.pt[1]=mPositions[v].y; bv.pt[2]=mPositions[v].z;
+        bv.normal[0]=n.x; bv.normal[1]=n.y; bv.normal[2]=n.z;
+        bv.texPos[0]=mTexPos[v].x; bv.texPos[1]=mTexPos[v].y;
+        indices[i]=i;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, mVertexBuffers[kFlatBuffers]);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(BufferVertex), vertices.empty() ? 0 : &vertices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexBuffers[kFlatBuffers]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(unsigned int), indices.empty() ? 0 : &indices[0], GL_STATIC_DRAW);
+    mIndexCounts[kFlatBuffers]=indices.size();
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+}
+
+void STTriangleMesh::ReleaseBuffers() const
+{
+    if(mVertexBuffers[kSmoothBuffers]!=0){
+        glDeleteBuffers(2, mVertexBuffers);
+        glDeleteBuffers(2, mIndexBuffers);
+    }
+    for(int i=0;i<2;i++){
+        mVertexBuffers[i]=0;
+        mIndexBuffers[i]=0;
+        mIndexCounts[i]=0;
+    }
+    mBuffersDirty=true;
+}
+
 //
 // Read the triangle mesh from files.
 //
@@ -197,14 +315,16 @@ bool STTriangleMesh::Read(const std::string& filename)
             return false;
         }
 
-        for(unsigned int i=0;i<mVertices.size();i++)delete mVertices[i];
-        mVertices.clear();
-        for(unsigned int i=0;i<mTexPos.size();i++)delete mTexPos[i];
-        mVertices.clear();
-        for(unsigned int i=0;i<mNormals.size();i++)delete mNormals[i];
+        mPositions.clear();
         mNormals.clear();
-        for(unsigned int i=0;i<mFaces.size();i++)delete mFaces[i];
-        mFaces.clear();
+        mTexPos.clear();
+        mIndices.clear();
+
+        // Faces refer to positions and normals separately in the file;
+        // every distinct (position, normal) pair becomes one mesh vertex.
+        std::vector<STPoint3> filePositions;
+        std::vector<STVector3> fileNormals;
+        std::vector<std::pair<int,int> > corners;
 
         //std::string comments;
         //std::string token;
@@ -219,11 +339,11 @@ bool STTriangleMesh::Read(const std::string& filename)
             }
             else if(strcmp(token,"v")==0){
                 in>>x>>y>>z;
-                mVertices.push_back(new STVertex(x,y,z));
+                filePositions.push_back(STPoint3(x,y,z));
             }
             else if(strcmp(token,"vn")==0){
                 in>>x>>y>>z;
-                mNormals.push_back(new STVector3(x,y,z));
+                fileNormals.push_back(STVector3(x,y,z));
                 mSimpleMesh=false;
             }
             else if(strcmp(token,"f")==0){
@@ -231,17 +351,39 @@ bool STTriangleMesh::Read(const std::string& filename)
                     in>>p1; in.ignore(100, ' ');
                     in>>p2; in.ignore(100, ' ');
                     in>>p3; 
-                    mFaces.push_back(new STFace(mVertices[p1-1],mVertices[p2-1],mVertices[p3-1]));
+                    n1=n2=n3=0;
                 }
                 else{
                     in>>p1; in.ignore(100, '/'); in.ignore(100, '/'); in>>n1;
                     in>>p2; in.ignore(100, '/'); in.ignore(100, '/'); in>>n2;
                     in>>p3; in.ignore(100, '/'); in.ignore(100, '/'); in>>n3;
-                    mFaces.push_back(new STFace(mVertices[p1-1],mVertices[p2-1],mVertices[p3-1],
-                                mNormals[n1-1],mNormals[n2-1],mNormals[n3-1]));
                 }
+                corners.push_back(std::make_pair(p1-1,n1-1));
+                corners.push_back(std::make_pair(p2-1,n2-1));
+                corners.push_back(std::make_pair(p3-1,n3-1));
             }
         }
+
+        if(mSimpleMesh){
+            mPositions.swap(filePositions);
+            mIndices.resize(corners.size());
+            for(unsigned int i=0;i<corners.size();i++)
+                mIndices[i]=corners[i].first;
+        }
+        else{
+            std::map<std::pair<int,int>,unsigned int> corner2index;
+            mIndices.reserve(corners.size());
+            for(unsigned int i=0;i<corners.size();i++){
+                std::map<std::pair<int,int>,unsigned int>::iterator itr=corner2index.find(corners[i]);
+                if(itr==corner2index.end()){
+                    itr=corner2index.insert(std::make_pair(corners[i],(unsigned int)mPositions.size())).first;
+                    mPositions.push_back(filePositions[corners[i].first]);
+                    mNormals.push_back(corners[i].second>=0 ? fileNormals[corners[i].second] : STVector3(0,0,0));
+                }
+                mIndices.push_back(itr->second);
+            }
+        }
+        mTexPos.assign(mPositions.size(),STPoint2(0,0));
         return true;
     }
     else {
@@ -255,10 +397,6 @@ bool STTriangleMesh::Read(const std::string& filename)
 //
 // Write the triangle mesh to files.
 //
-unsigned int getIndex(std::vector<STVertex*>& mVertices, const STVertex* v){
-    return std::find(mVertices.begin(),mVertices.end(),v)-mVertices.begin()+1;
-}
-
 bool STTriangleMesh::Write(const std::string& filename)
 {
     // Determine the right routine based on the file's extension.
@@ -273,11 +411,11 @@ bool STTriangleMesh::Write(const std::string& filename)
             return false;
         }
 
-        for(unsigned int i=0;i<mVertices.size();i++){
-            out<<"v "<<mVertices[i]->pt.x<<" "<<mVertices[i]->pt.y<<" "<<mVertices[i]->pt.z<<" "<<std::endl;
+        for(unsigned int i=0;i<NumVertices();i++){
+            out<<"v "<<mPositions[i].x<<" "<<mPositions[i].y<<" "<<mPositions[i].z<<" "<<std::endl;
         }
-        for(unsigned int i=0;i<mFaces.size();i++){
-            out<<"f "<<getIndex(mVertices,mFaces[i]->v[0])<<" "<<getIndex(mVertices,mFaces[i]->v[1])<<" "<<getIndex(mVertices,mFaces[i]->v[2])<<" "<<std::endl;
+        for(unsigned int i=0;i<NumFaces();i++){
+            out<<"f "<<mIndices[i*3]+1<<" "<<mIndices[i*3+1]+1<<" "<<mIndices[i*3+2]+1<<" "<<std::endl;
         }
 
         return true;
@@ -301,62 +439,43 @@ bool STTriangleMesh::Build()
 }
 
 
-bool STTriangleMesh::BuildTopology()
-{
-    // this function only works for maniford mesh
-    if(!mSimpleMesh) return false;
-    //Build topology
-    std::map<std::pair<STVertex*,STVertex*>,STFace*> he2f;
-    for(unsigned int i=0;i<mFaces.size();i++){
-        for(unsigned int j=0;j<3;j++){
-            mFaces[i]->v[j]->f=mFaces[i];
-            he2f.insert(std::pair<std::pair<STVertex*,STVertex*>,STFace*>(std::pair<STVertex*,STVertex*>(mFaces[i]->v[j],mFaces[i]->v[(j+1)%3]),mFaces[i]));
-        }
-    }
-    for(unsigned int i=0;i<mFaces.size();i++){
-        for(unsigned int j=0;j<3;j++){
-            std::map<std::pair<STVertex*,STVertex*>,STFace*>::iterator itr=he2f.find(std::pair<STVertex*,STVertex*>(mFaces[i]->v[(j+2)%3],mFaces[i]->v[(j+1)%3]));
-            if(itr!=he2f.end())
-                mFaces[i]->adjF[j]=itr->second;
-            else
-                mFaces[i]->adjF[j]=0;
-        }
-    }
-    return true;
-}
-
 bool STTriangleMesh::UpdateGeometry()
 {
+    mBuffersDirty = true;
     mMassCenter = STPoint3(0.0f,0.0f,0.0f);
     mSurfaceArea = 0.0f;
-    if(mVertices.size()>0){
-        mBoundingBoxMin=mBoundingBoxMax=mVertices[0]->pt;
-        for(unsigned int i=1;i<mVertices.size();i++){
-            mBoundingBoxMin=STPoint3::Min(mBoundingBoxMin,mVertices[i]->pt);
-            mBoundingBoxMax=STPoint3::Max(mBoundingBoxMax,mVertices[i]->pt);
+    if(NumVertices()>0){
+        mBoundingBoxMin=mBoundingBoxMax=mPositions[0];
+        for(unsigned int i=1;i<NumVertices();i++){
+            mBoundingBoxMin=STPoint3::Min(mBoundingBoxMin,mPositions[i]);
+            mBoundingBoxMax=STPoint3::Max(mBoundingBoxMax,mPositions[i]);
         }
     }
     else{
         mBoundingBoxMin=STPoint3(0.0f,0.0f,0.0f);
         mBoundingBoxMax=STPoint3(1.0f,1.0f,1.0f);
     }
-    for(unsigned int i=0;i<mFaces.size();i++){
-        STFace* face=mFaces[i];
-        face->normal=STVector3::Cross(face->v[0]->pt-face->v[1]->pt,face->v[0]->pt-face->v[2]->pt);
-        float area=face->normal.Length();
+    mFaceNormals.resize(NumFaces());
+    if(mSimpleMesh)
+        mNormals.assign(NumVertices(),STVector3(0.0f,0.0f,0.0f));
+    for(unsigned int i=0;i<NumFaces();i++){
+        const unsigned int* v=&mIndices[i*3];
+        STVector3& normal=mFaceNormals[i];
+        normal=STVector3::Cross(mPositions[v[0]]-mPositions[v[1]],mPositions[v[0]]-mPositions[v[2]]);
+        float area=normal.Length();
         mSurfaceArea+=area;
-        mMassCenter=mMassCenter+(face->v[0]->pt+face->v[1]->pt+face->v[2]->pt)*(area/3.0f);
+        mMassCenter=mMassCenter+(mPositions[v[0]]+mPositions[v[1]]+mPositions[v[2]])*(area/3.0f);
         if(mSimpleMesh)
             for(unsigned int j=0;j<3;j++)
-                face->v[j]->normal+=face->normal;
+                mNormals[v[j]]+=normal;
     }
     mMassCenter=mMassCenter/mSurfaceArea;
-    for(unsigned int i=0;i<mFaces.size();i++){
-        mFaces[i]->normal.Normalize();
+    for(unsigned int i=0;i<NumFaces();i++){
+        mFaceNormals[i].Normalize();
     }
     if(mSimpleMesh){
-        for(unsigned int i=0;i<mVertices.size();i++){
-            mVertices[i]->normal.Normalize();
+        for(unsigned int i=0;i<NumVertices();i++){
+            mNormals[i].Normalize();
         }
     }
     return true;
@@ -364,306 +483,308 @@ bool STTriangleMesh::UpdateGeometry()
 
 bool STTriangleMesh::CalculateTextureCoordinatesViaSphericalProxy()
 {
-	for(unsigned int i=0;i<mFaces.size();i++){
-		STFace* face=mFaces[i];		
+	mBuffersDirty=true;
+	for(unsigned int i=0;i<NumFaces();i++){
+		const unsigned int* face=&mIndices[i*3];
 		for(int v=0;v<3;v++){
-			STPoint3 point=face->v[v]->pt;
+			STPoint3 point=mPositions[face[v]];
 			float r=sqrt(pow(point.x,2)+pow(point.y,2)+pow(point.z,2));
 			float theta=(float)PI-acos(point.z/r);
 			float phi=atan2(point.y,point.x)+(float)PI;
-			face->texPos[v]->x=phi/(float)2/(float)PI;
-			face->texPos[v]->y=theta/PI;
+			mTexPos[face[v]].x=phi/(float)2/(float)PI;
+			mTexPos[face[v]].y=theta/PI;
 		}
-		if(face->texPos[1]->x-face->texPos[0]->x>.5) face->texPos[1]->x-=1;
-		else if(face->texPos[1]->x-face->texPos[0]->x<-.5) face->texPos[1]->x+=1;
+		if(mTexPos[face[1]].x-mTexPos[face[0]].x>.5) mTexPos[face[1]].x-=1;
+		else if(mTexPos[face[1]].x-mTexPos[face[0]].x<-.5) mTexPos[face[1]].x+=1;
 
-		if(face->texPos[2]->x-face->texPos[0]->x>.5) face->texPos[2]->x-=1;
-		else if(face->texPos[2]->x-face->texPos[0]->x<-.5) face->texPos[2]->x+=1;
+		if(mTexPos[face[2]].x-mTexPos[face[0]].x>.5) mTexPos[face[2]].x-=1;
+		else if(mTexPos[face[2]].x-mTexPos[face[0]].x<-.5) mTexPos[face[2]].x+=1;
 	}
 	return true;
 }
 
 bool STTriangleMesh::CalculateTextureCoordinatesViaCylindricalProxy(float h_min,float h_max,float center_x,float center_y,int axis_direction)
 {
-	for(unsigned int i=0;i<mFaces.size();i++){
-		STFace* face=mFaces[i];		
+	mBuffersDirty=true;
+	for(unsigned int i=0;i<NumFaces();i++){
+		const unsigned int* face=&mIndices[i*3];
 		for(int v=0;v<3;v++){
-			STPoint3 point=face->v[v]->pt;
+			STPoint3 point=mPositions[face[v]];
 			float phi;
 			switch(axis_direction){
 			case 1:
 				phi=atan2(point.z-center_y,point.y-center_x)+(float)PI;
-				face->texPos[v]->x=phi/(float)2/(float)PI;
-				face->texPos[v]->y=(point.x-h_min)/(h_max-h_min);
+				mTexPos[face[v]].x=phi/(float)2/(float)PI;
+				mTexPos[face[v]].y=(point.x-h_min)/(h_max-h_min);
 				break;
 			case 2:
 				phi=atan2(point.x-center_y,point.z-center_x)+(float)PI;
-				face->texPos[v]->x=phi/(float)2/(float)PI;
-				face->texPos[v]->y=(point.y-h_min)/(h_max-h_min);
+				mTexPos[face[v]].x=phi/(float)2/(float)PI;
+				mTexPos[face[v]].y=(point.y-h_min)/(h_max-h_min);
 				break;
 			case 3:
 				phi=atan2(point.y-center_y,point.x-center_x)+(float)PI;
-				face->texPos[v]->x=phi/(float)2/(float)PI;
-				face->texPos[v]->y=(point.z-h_min)/(h_max-h_min);
+				mTexPos[face[v]].x=phi/(float)2/(float)PI;
+				mTexPos[face[v]].y=(point.z-h_min)/(h_max-h_min);
 				break;
 			default:
 				break;
 			}
 		}
-		if(face->texPos[1]->x-face->texPos[0]->x>.5) face->texPos[1]->x-=1;
-		else if(face->texPos[1]->x-face->texPos[0]->x<-.5) face->texPos[1]->x+=1;
+		if(mTexPos[face[1]].x-mTexPos[face[0]].x>.5) mTexPos[face[1]].x-=1;
+		else if(mTexPos[face[1]].x-mTexPos[face[0]].x<-.5) mTexPos[face[1]].x+=1;
 
-		if(face->texPos[2]->x-face->texPos[0]->x>.5) face->texPos[2]->x-=1;
-		else if(face->texPos[2]->x-face->texPos[0]->x<-.5) face->texPos[2]->x+=1;
+		if(mTexPos[face[2]].x-mTexPos[face[0]].x>.5) mTexPos[face[2]].x-=1;
+		else if(mTexPos[face[2]].x-mTexPos[face[0]].x<-.5) mTexPos[face[2]].x+=1;
 	}
 	return true;
 }
 
-STFace* STTriangleMesh::NextAdjFace(STVertex *v, STFace *f)
+int STTriangleMesh::NextAdjFace(unsigned int v, int f) const
 {
-    if( v == f->v[0] ) 
-        return f->adjF[1];
-    else if( v == f->v[1] ) 
-        return f->adjF[2];
-    else if( v == f->v[2] ) 
-        return f->adjF[0];
+    const unsigned int* fv=&mIndices[f*3];
+    if( v == fv[0] ) 
+        return mAdjFaces[f*3+1];
+    else if( v == fv[1] ) 
+        return mAdjFaces[f*3+2];
+    else if( v == fv[2] ) 
+        return mAdjFaces[f*3];
     else 
-        return 0;
+        return -1;
 }
 
-STFace* STTriangleMesh::NextAdjFaceReverse(STVertex *v, STFace *f)
+int STTriangleMesh::NextAdjFaceReverse(unsigned int v, int f) const
 {
-    if( v == f->v[0] ) 
-        return f->adjF[2];
-    else if( v == f->v[1] ) 
-        return f->adjF[0];
-    else if( v == f->v[2] ) 
-        return f->adjF[1];
+    const unsigned int* fv=&mIndices[f*3];
+    if( v == fv[0] ) 
+        return mAdjFaces[f*3+2];
+    else if( v == fv[1] ) 
+        return mAdjFaces[f*3];
+    else if( v == fv[2] ) 
+        return mAdjFaces[f*3+1];
     else 
-        return 0;
-}
-
-void STTriangleMesh::LoopSubdivide()
-{
-    if(!mSimpleMesh) return;
-    unsigned int newVerticesStart=mVertices.size();
-
-    // Add Odd Vertices
-    std::map<STFace*,std::vector<STVertex *> > oldFaces2newVertices;
-    std::vector<STVertex *> empty_vertices_3;for(unsigned int i=0;i<3;i++)empty_vertices_3.push_back(0);
-    for(unsigned int i=0;i<mFaces.size();i++){
-        oldFaces2newVertices.insert(std::pair<STFace*,std::vector<STVertex *> >(mFaces[i],empty_vertices_3) );
-    }
-    for(unsigned int i=0;i<mFaces.size();i++){
-        for(unsigned int j=0;j<3;j++){
-            if(oldFaces2newVertices[mFaces[i]][j]==0){
-                if(mFaces[i]->adjF[j]!=0){
-                    int adjF_j;
-                    for(unsigned int k=0;k<3;k++){
-                        if(mFaces[i]->adjF[j]->adjF[k]==mFaces[i]){
-                            adjF_j=k;
-                            break;
-                        }
-                    }
-                    STPoint3 newPoint=(mFaces[i]->v[(j+1)%3]->pt+mFaces[i]->v[(j+2)%3]->pt)*0.375f
-                        +(mFaces[i]->v[j]->pt+mFaces[i]->adjF[j]->v[adjF_j]->pt)*0.125f;
-                    STPoint2 newTexPos=(mFaces[i]->v[(j+1)%3]->texPos+mFaces[i]->v[(j+2)%3]->texPos)*0.5f;
-                    STVertex* newVertex=new STVertex(newPoint,newTexPos);
-                    mVertices.push_back(newVertex);
-                    oldFaces2newVertices[mFaces[i]][j]=oldFaces2newVertices[mFaces[i]->adjF[j]][adjF_j]=newVertex;
-                }
-                else{
-                    STPoint3 newPoint=(mFaces[i]->v[(j+1)%3]->pt+mFaces[i]->v[(j+2)%3]->pt)*0.5f;
-                    STPoint2 newTexPos=(mFaces[i]->v[(j+1)%3]->texPos+mFaces[i]->v[(j+2)%3]->texPos)*0.5f;
-                    STVertex* newVertex=new STVertex(newPoint,newTexPos);
-                    mVertices.push_back(newVertex);
-                    oldFaces2newVertices[mFaces[i]][j]=newVertex;
-                }
-            }
-        }
-    }
-
-    std::vector<STPoint3> newEvenVerticesPoints;newEvenVerticesPoints.resize(newVerticesStart);
-    // Adjust Even Vertices
-    for(unsigned int i=0;i<newVerticesStart;i++){
-        STVertex* vertex=mVertices[i];
-        STFace* nextface=vertex->f;
-        std::vector<STPoint3> neighborPoints;
-        bool boundary=false;
-        do {
-            if(nextface==0){
-                boundary=true;
-                break;
-            }
-            for(int j=0;j<3;j++){
-                if(nextface->v[j]==vertex){
-                    neighborPoints.push_back(nextface->v[(j+2)%3]->pt);
-                    break;
-                }
-            }
-        } while((nextface=NextAdjFace(vertex,nextface))!=vertex->f);
-
-        if(boundary){
-            STPoint3 temp=neighborPoints.back();
-            neighborPoints.clear();
-            neighborPoints.push_back(temp);
-            nextface=vertex->f;
-            do {
-                if(nextface==0)
-                    break;
-                for(int j=0;j<3;j++){
-                    if(nextface->v[j]==vertex){
-                        temp=nextface->v[(j+1)%3]->pt;
-                        break;
-                    }
-                }
-            } while((nextface=NextAdjFaceReverse(vertex,nextface))!=vertex->f);
-            neighborPoints.push_back(temp);
-        }
-
-        if(neighborPoints.size()>3){
-            float weight=3.0f/8.0f/(float)neighborPoints.size();
-            newEvenVerticesPoints[i]=vertex->pt*(5.0f/8.0f);
-            for(unsigned j=0;j<neighborPoints.size();j++)
-                newEvenVerticesPoints[i]=newEvenVerticesPoints[i]+neighborPoints[j]*weight;
-        }
-        else if(neighborPoints.size()==3){
-            float weight=3.0f/16.0f;
-            newEvenVerticesPoints[i]=vertex->pt*(7.0f/16.0f);
-            for(unsigned j=0;j<neighborPoints.size();j++)
-                newEvenVerticesPoints[i]=newEvenVerticesPoints[i]+neighborPoints[j]*weight;
-        }
-        else{ // assert(neighborPoints.size()==2) boundary vertex
-            newEvenVerticesPoints[i]=vertex->pt*0.75f+neighborPoints[0]*0.125f+neighborPoints[1]*0.125f;
-        }
-    }
-    for(unsigned int i=0;i<newVerticesStart;i++)
-        mVertices[i]->pt=newEvenVerticesPoints[i];
-
-    // Rebuild faces
-    std::vector<STFace*> newFaces;
-    for(unsigned int i=0;i<mFaces.size();i++){
-        for(unsigned int j=0;j<3;j++){
-            STFace* newFace=new STFace(mFaces[i]->v[j],oldFaces2newVertices[mFaces[i]][(j+2)%3],oldFaces2newVertices[mFaces[i]][(j+1)%3]);
-            newFaces.push_back(newFace);
-        }
-        STFace* newFace=new STFace(oldFaces2newVertices[mFaces[i]][0],oldFaces2newVertices[mFaces[i]][1],oldFaces2newVertices[mFaces[i]][2]);
-        newFaces.push_back(newFace);
-    }
-    std::swap(mFaces,newFaces);
-    for(unsigned int i=0;i<newFaces.size();i++)delete newFaces[i];
-    
-    Build();
+        return -1;
 }
 
 unsigned int STTriangleMesh::AddVertex(float x, float y, float z, float u, float v)
 {
-    mVertices.push_back(new STVertex(x,y,z,u,v));
-    return mVertices.size()-1;
+    return AddVertex(STPoint3(x,y,z),STPoint2(u,v));
 }
 
 unsigned int STTriangleMesh::AddVertex(const STPoint3& pt, const STPoint2& texPos)
 {
-    mVertices.push_back(new STVertex(pt,texPos));
-    return mVertices.size()-1;
+    mPositions.push_back(pt);
+    mNormals.push_back(STVector3(0.0f,0.0f,0.0f));
+    mTexPos.push_back(texPos);
+    return NumVertices()-1;
 }
 
 unsigned int STTriangleMesh::AddFace(unsigned int id0,unsigned int id1,unsigned int id2)
 {
-    STFace* newFace = new STFace(mVertices[id0],mVertices[id1],mVertices[id2]);
-    mFaces.push_back(newFace);
-    return mFaces.size()-1;
+    mIndices.push_back(id0);
+    mIndices.push_back(id1);
+    mIndices.push_back(id2);
+    return NumFaces()-1;
 }
 
-std::ostream& operator <<(std::ostream& stream, const STVertex& v) {
-    stream<<"["<<v.pt.x<<" "<<v.pt.y<<" "<<v.pt.z<<"]";
-    return stream;
+size_t STTriangleMesh::GetMemoryUsage() const
+{
+    return mPositions.capacity()*sizeof(STPoint3)
+        +mNormals.capacity()*sizeof(STVector3)
+        +mTexPos.capacity()*sizeof(STPoint2)
+        +mVertexFace.capacity()*sizeof(int)
+        +mIndices.capacity()*sizeof(unsigned int)
+        +mFaceNormals.capacity()*sizeof(STVector3)
+        +mAdjFaces.capacity()*sizeof(int);
 }
 
-std::ostream& operator <<(std::ostream& stream, const STFace& f) {
-    stream<<"{"<<*(f.v[0])<<" "<<*(f.v[1])<<" "<<*(f.v[2])<<"}";
-    return stream;
-}
+//
+// MaterialFileReader that remembers which .mtl files it has read, each once,
+// so they can be listed as sources of the mesh cache.
+//
+class RecordingMaterialReader : public MaterialFileReader
+{
+public:
+    RecordingMaterialReader(const std::string& base) : MaterialFileReader(base) {}
+
+    virtual std::string operator() (
+        const std::string& matId,
+        std::vector<material_t>& materials,
+        std::map<std::string, int>& matMap)
+    {
+        if(std::find(mFiles.begin(), mFiles.end(), matId) == mFiles.end())
+            mFiles.push_back(matId);
+        return MaterialFileReader::operator()(matId, materials, matMap);
+    }
+
+    std::vector<std::string> mFiles;
+};
 
 std::string STTriangleMesh::LoadObj(std::vector<STTriangleMesh*>& output_meshes, const std::string& filename){
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
+    size_t firstMesh = output_meshes.size();
+    std::string err = LoadObjData(output_meshes, filename);
+    for(size_t i=firstMesh; i<output_meshes.size(); i++){
+        output_meshes[i]->UploadBuffers();
+        output_meshes[i]->UploadTextures();
+    }
+    return err;
+}
+
+std::string STTriangleMesh::LoadObjData(std::vector<STTriangleMesh*>& output_meshes, const std::string& filename){
+    STTimer timer;
+    timer.Reset();
 	std::string base;
 	size_t l;
 	if ((l = filename.find_last_of('/')) != std::string::npos)
 		base = filename.substr(0, l+1);
 	else if ((l = filename.find_last_of('\\')) != std::string::npos)
 		base = filename.substr(0, l+1);
-	std::string err = tinyobj::LoadObj(shapes, materials, filename.c_str(), base.c_str());
-    
-    std::cout<<"#shapes="<<shapes.size()<<" #materials="<<materials.size()<<std::endl;
-    
 
-    for(unsigned int mesh_id=0; mesh_id<shapes.size(); mesh_id++)
-    {
-        tinyobj::mesh_t& mesh=shapes[mesh_id].mesh;
-        STTriangleMesh* stmesh = new STTriangleMesh();
-        for(unsigned int vertex_id=0; vertex_id<mesh.positions.size()/3; vertex_id++)
-            stmesh->mVertices.push_back(new STVertex(mesh.positions[vertex_id*3],
-                                                     mesh.positions[vertex_id*3+1],
-                                                     mesh.positions[vertex_id*3+2]));
-        for(unsigned int face_id=0; face_id<mesh.indices.size()/3; face_id++){
-            int indices[3];for(int j=0;j<3;j++)indices[j]=mesh.indices[face_id*3+j];
-            stmesh->mFaces.push_back(new STFace(stmesh->mVertices[indices[0]],
-                                                stmesh->mVertices[indices[1]],
-                                                stmesh->mVertices[indices[2]]));
-        }
-        if(mesh.normals.size()>0){
-            stmesh->mSimpleMesh=false;
-            for(unsigned int normal_id=0; normal_id<mesh.normals.size()/3; normal_id++)
-                stmesh->mNormals.push_back(new STVector3(mesh.normals[normal_id*3],
-                                                         mesh.normals[normal_id*3+1],
-                                                         mesh.normals[normal_id*3+2]));
-            for(unsigned int face_id=0; face_id<mesh.indices.size()/3; face_id++){
-                for(int j=0;j<3;j++)
-                    stmesh->mFaces[face_id]->normals[j]=stmesh->mNormals[mesh.indices[face_id*3+j]];
-            }
-        }
-        if(mesh.texcoords.size()>0){
-            for(unsigned int texpos_id=0; texpos_id<mesh.texcoords.size()/2; texpos_id++)
-                stmesh->mTexPos.push_back(new STPoint2(mesh.texcoords[texpos_id*2],
-                                                         mesh.texcoords[texpos_id*2+1]));
-            for(unsigned int face_id=0; face_id<mesh.indices.size()/3; face_id++){
-                for(int j=0;j<3;j++)
-                    stmesh->mFaces[face_id]->texPos[j]=stmesh->mTexPos[mesh.indices[face_id*3+j]];
+    std::string cacheFilename = GetMeshCacheFilename(filename);
+    size_t firstMesh = output_meshes.size();
+    bool cached = sUseMeshCache && ReadMeshCache(output_meshes, cacheFilename);
+    std::string err;
+
+    if(!cached){
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        STMappedFile file;
+        RecordingMaterialReader matFileReader(base);
+        if(!file.Open(filename))
+            return "Cannot open file [" + filename + "]\n";
+        err = tinyobj::LoadObjFromMemory(shapes, materials, file.GetData(), file.GetSize(), matFileReader);
+
+        std::cout<<"#shapes="<<shapes.size()<<" #materials="<<materials.size()<<std::endl;
+
+        std::vector<std::string> sources(1, filename);
+        for(size_t i=0;i<matFileReader.mFiles.size();i++)
+            sources.push_back(base+matFileReader.mFiles[i]);
+
+        for(unsigned int mesh_id=0; mesh_id<shapes.size(); mesh_id++)
+        {
+            tinyobj::mesh_t& mesh=shapes[mesh_id].mesh;
+            STTriangleMesh* stmesh = new STTriangleMesh();
+            unsigned int numVertices=mesh.positions.size()/3;
+            stmesh->mPositions.resize(numVertices);
+            for(unsigned int vertex_id=0; vertex_id<numVertices; vertex_id++)
+                stmesh->mPositions[vertex_id]=STPoint3(mesh.positions[vertex_id*3],
+                                                       mesh.positions[vertex_id*3+1],
+                                                       mesh.positions[vertex_id*3+2]);
+            stmesh->mIndices.swap(mesh.indices);
+            if(mesh.normals.size()>0){
+                stmesh->mSimpleMesh=false;
+                stmesh->mNormals.resize(numVertices);
+                for(unsigned int normal_id=0; normal_id<numVertices; normal_id++)
+                    stmesh->mNormals[normal_id]=STVector3(mesh.normals[normal_id*3],
+                                                          mesh.normals[normal_id*3+1],
+                                                          mesh.normals[normal_id*3+2]);
             }
-        }
-        stmesh->Build();
-		if(mesh.material_ids[0]>=0){
-            tinyobj::material_t& material=materials[mesh.material_ids[0]];
-            for(int i=0;i<3;i++){
-                stmesh->mMaterialAmbient[i]=material.ambient[i];
-                stmesh->mMaterialDiffuse[i]=material.diffuse[i];
-                stmesh->mMaterialSpecular[i]=material.specular[i];
+            stmesh->mTexPos.resize(numVertices);
+            if(mesh.texcoords.size()>0){
+                for(unsigned int texpos_id=0; texpos_id<numVertices; texpos_id++)
+                    stmesh->mTexPos[texpos_id]=STPoint2(mesh.texcoords[texpos_id*2],
+                                                        mesh.texcoords[texpos_id*2+1]);
             }
-			std::string colorMap = material.diffuse_texname;
-			if (colorMap != "") {
-                printf(" has color map! %s\n", colorMap.c_str());
-                stmesh->mHasColorMap = true;
-				stmesh->mSurfaceColorImg = new STImage(base+colorMap);
-		        stmesh->mSurfaceColorTex = new STTexture(stmesh->mSurfaceColorImg,STTexture::kNone);
-			}
-            std::string normalMap = material.normal_texname;
-            if (normalMap != "") {
-                printf(" has normal map! %s\n", normalMap.c_str());
-                stmesh->mHasNormalMap = true;
-                stmesh->mSurfaceNormalImg = new STImage(base+normalMap);
-                stmesh->mSurfaceNormalTex = new STTexture(stmesh->mSurfaceNormalImg,STTexture::kNone);
+            stmesh->Build();
+            if(mesh.material_ids[0]>=0){
+                tinyobj::material_t& material=materials[mesh.material_ids[0]];
+                for(int i=0;i<3;i++){
+                    stmesh->mMaterialAmbient[i]=material.ambient[i];
+                    stmesh->mMaterialDiffuse[i]=material.diffuse[i];
+                    stmesh->mMaterialSpecular[i]=material.specular[i];
+                }
+                stmesh->mColorMapFile = material.diffuse_texname;
+                stmesh->mNormalMapFile = material.normal_texname;
+                stmesh->mShininess = 8.;  // # between 1 and 128.
             }
-            stmesh->mShininess = 8.;  // # between 1 and 128.
+            output_meshes.push_back(stmesh);
         }
 
-        output_meshes.push_back(stmesh);
+        if(sUseMeshCache && err.empty()){
+            std::vector<STTriangleMesh*> loaded(output_meshes.begin()+firstMesh, output_meshes.end());
+            if(!WriteMeshCache(loaded, cacheFilename, sources))
+                fprintf(stderr, "STTriangleMesh::LoadObj() - could not write mesh cache %s\n", cacheFilename.c_str());
+        }
     }
 
+    unsigned int numFaces=0;
+    size_t numBytes=0;
+    for(size_t i=firstMesh; i<output_meshes.size(); i++){
+        STTriangleMesh* stmesh=output_meshes[i];
+        stmesh->LoadTextureMaps(base);
+        numFaces+=stmesh->NumFaces();
+        numBytes+=stmesh->GetMemoryUsage();
+    }
+
+    printf("Loaded %s%s: %u faces in %.1f ms, %.1f MB of mesh data\n",
+        filename.c_str(), cached ? " from cache" : "", numFaces, timer.GetElapsedMillis(), numBytes/(1024.0f*1024.0f));
     return err;
 }
 
+//
+// Decode the color and normal maps named by mColorMapFile and
+// mNormalMapFile, or with sCompressTextures, load their compressed
+// versions. The textures are created later by UploadTextures().
+// Support for the compressed formats cannot be checked here, since
+// this may run before OpenGL is initialized.
+//
+void STTriangleMesh::LoadTextureMaps(const std::string& base)
+{
+    mMapDirectory = base;
+    if (mColorMapFile != "") {
+        printf(" has color map! %s\n", mColorMapFile.c_str());
+        mHasColorMap = true;
+        if (sCompressTextures)
+            mSurfaceColorCompressed = STCompressedImage::LoadCached(base+mColorMapFile, false);
+        if (!mSurfaceColorCompressed)
+            mSurfaceColorImg = new STImage(base+mColorMapFile);
+    }
+    if (mNormalMapFile != "") {
+        printf(" has normal map! %s\n", mNormalMapFile.c_str());
+        mHasNormalMap = true;
+        if (sCompressTextures)
+            mSurfaceNormalCompressed = STCompressedImage::LoadCached(base+mNormalMapFile, true);
+        if (!mSurfaceNormalCompressed)
+            mSurfaceNormalImg = new STImage(base+mNormalMapFile);
+    }
+}
+
+//
+// Create a texture for one map: from its compressed image if there is one
+// the driver supports (which is then freed), and otherwise from the
+// decoded image, decoding it now if only the compressed image was loaded.
+//
+static STTexture* CreateMapTexture(STCompressedImage*& compressed, const STImage* image,
+                                   const std::string& filename)
+{
+    if (!compressed)
+        return new STTexture(image,STTexture::kNone);
+    STTexture* texture = 0;
+    if (STTexture::IsFormatSupported(compressed->GetFormat()))
+        texture = new STTexture(compressed);
+    delete compressed;
+    compressed = 0;
+    if (!texture) {
+        STImage decoded(filename);
+        texture = new STTexture(&decoded,STTexture::kNone);
+    }
+    return texture;
+}
+
+//
+// Create the textures for the decoded maps, or use the shared white
+// texture for the maps the mesh does not have.
+//
+void STTriangleMesh::UploadTextures() const
+{
+    if(!whiteTex)
+        whiteTex = new STTexture(&whiteImg);
+    if(!mSurfaceColorTex)
+        mSurfaceColorTex = mHasColorMap ? CreateMapTexture(mSurfaceColorCompressed, mSurfaceColorImg, mMapDirectory+mColorMapFile) : whiteTex;
+    if(!mSurfaceNormalTex)
+        mSurfaceNormalTex = mHasNormalMap ? CreateMapTexture(mSurfaceNormalCompressed, mSurfaceNormalImg, mMapDirectory+mNormalMapFile) : whiteTex;
+}
+
 STPoint3 STTriangleMesh::GetMassCenter(const std::vector<STTriangleMesh*>& input_meshes)
 {
     STPoint3 massCenter=STPoint3(0.0,0.0,0.0);
@@ -693,8 +814,9 @@ std::pair<STPoint3,STPoint3> STTriangleMesh::GetBoundingBox(const std::vector<ST
 void STTriangleMesh::Recenter(const STPoint3& center)
 {
     STVector3 translate = STPoint3::Origin - center;
-    for(unsigned int i=0;i<mVertices.size();i++){
-        mVertices[i]->pt+=translate;
+    mBuffersDirty = true;
+    for(unsigned int i=0;i<NumVertices();i++){
+        mPositions[i]+=translate;
     }
     mMassCenter+=translate;
     mBoundingBoxMax+=translate;
@@ -0,0 +1,289 @@
+// STTriangleMesh_cache.cpp
+#include "STTriangleMesh.h"
+#include "STMappedFile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//
+// Layout of a .stmesh file, in native byte order:
+//
+//   MeshCacheHeader
+//   numSources x { string name, MeshCacheSource }
+//   numMeshes  x { MeshCacheMesh, string colorMap, string normalMap,
+//                  positions, normals, texPos, vertexFace,
+//                  indices, faceNormals, adjFaces }
+//
+// where a string is a 32-bit length followed by the characters, and every
+// array is stored as raw elements whose count follows from MeshCacheMesh.
+// Source names are relative to the directory of the .obj file.
+//
+static const char kMeshCacheMagic[8] = { 'S', 'T', 'M', 'E', 'S', 'H', '\r', '\n' };
+static const unsigned int kMeshCacheVersion = 1;
+static const unsigned int kMeshCacheByteOrder = 0x01020304;
+
+struct MeshCacheHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int byteOrder;
+    unsigned int numSources;
+    unsigned int numMeshes;
+};
+
+struct MeshCacheSource {
+    unsigned long long size;
+    long long modifiedTime;
+    unsigned long long hash;
+};
+
+struct MeshCacheMesh {
+    unsigned int numVertices;
+    unsigned int numFaces;
+    unsigned int simpleMesh;
+    unsigned int numBoundaryEdges;
+    unsigned int numNonManifoldEdges;
+    unsigned int hasNormals;
+    float materialAmbient[4];
+    float materialDiffuse[4];
+    float materialSpecular[4];
+    float shininess;
+    float surfaceArea;
+    float massCenter[3];
+    float boundingBoxMin[3];
+    float boundingBoxMax[3];
+};
+
+//
+// Bounds-checked reader over the mapped cache file.
+//
+class MeshCacheReader
+{
+public:
+    MeshCacheReader(const char* data, size_t size) : mData(data), mEnd(data+size), mOk(true) {}
+
+    bool Read(void* dst, size_t bytes) {
+        if (!mOk || (size_t)(mEnd-mData) < bytes)
+            return mOk = false;
+        if (bytes > 0)
+            memcpy(dst, mData, bytes);
+        mData += bytes;
+        return true;
+    }
+
+    template<class T>
+    bool ReadArray(std::vector<T>& dst, size_t count) {
+        if (!mOk || (size_t)(mEnd-mData)/sizeof(T) < count)
+            return mOk = false;
+        dst.resize(count);
+        return Read(count ? &dst[0] : NULL, count*sizeof(T));
+    }
+
+    bool ReadString(std::string& dst) {
+        unsigned int length;
+        if (!Read(&length, sizeof(length)) || (size_t)(mEnd-mData) < length)
+            return mOk = false;
+        dst.assign(mData, length);
+        mData += length;
+        return true;
+    }
+
+    bool AtEnd() const { return mOk && mData == mEnd; }
+
+private:
+    const char* mData;
+    const char* mEnd;
+    bool mOk;
+};
+
+static void WriteBytes(FILE* file, const void* data, size_t bytes, bool& ok)
+{
+    if (ok && bytes > 0)
+        ok = fwrite(data, 1, bytes, file) == bytes;
+}
+
+template<class T>
+static void WriteArray(FILE* file, const std::vector<T>& data, bool& ok)
+{
+    WriteBytes(file, data.empty() ? NULL : &data[0], data.size()*sizeof(T), ok);
+}
+
+static void WriteString(FILE* file, const std::string& str, bool& ok)
+{
+    unsigned int length = (unsigned int)str.size();
+    WriteBytes(file, &length, sizeof(length), ok);
+    WriteBytes(file, str.data(), length, ok);
+}
+
+static std::string GetDirectory(const std::string& filename)
+{
+    size_t l = filename.find_last_of("/\\");
+    return l == std::string::npos ? std::string() : filename.substr(0, l+1);
+}
+
+//
+// Check that a source file still matches what the cache was built from.
+// Only files whose time stamp changed while their size did not are hashed.
+//
+static bool IsSourceUnchanged(const std::string& filename, const MeshCacheSource& source)
+{
+    unsigned long long size;
+    long long modifiedTime;
+    if (!STMappedFile::GetFileInfo(filename, &size, &modifiedTime) || size != source.size)
+        return false;
+    if (modifiedTime == source.modifiedTime)
+        return true;
+    STMappedFile file;
+    return file.Open(filename) && file.ComputeHash() == source.hash;
+}
+
+bool STTriangleMesh::sUseMeshCache = true;
+
+std::string STTriangleMesh::GetMeshCacheFilename(const std::string& objFilename)
+{
+    size_t dot = objFilename.find_last_of('.');
+    size_t slash = objFilename.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return objFilename + ".stmesh";
+    return objFilename.substr(0, dot) + ".stmesh";
+}
+
+bool STTriangleMesh::ReadMeshCache(std::vector<STTriangleMesh*>& output_meshes, const std::string& cacheFilename)
+{
+    STMappedFile file;
+    if (!file.Open(cacheFilename))
+        return false;
+    MeshCacheReader reader(file.GetData(), file.GetSize());
+
+    MeshCacheHeader header;
+    if (!reader.Read(&header, sizeof(header)) ||
+        memcmp(header.magic, kMeshCacheMagic, sizeof(kMeshCacheMagic)) != 0 ||
+        header.version != kMeshCacheVersion || header.byteOrder != kMeshCacheByteOrder)
+        return false;
+
+    std::string base = GetDirectory(cacheFilename);
+    for (unsigned int i = 0; i < header.numSources; i++) {
+        std::string name;
+        MeshCacheSource source;
+        if (!reader.ReadString(name) || !reader.Read(&source, sizeof(source)) ||
+            !IsSourceUnchanged(base+name, source))
+            return false;
+    }
+
+    std::vector<STTriangleMesh*> meshes;
+    bool ok = true;
+    for (unsigned int i = 0; ok && i < header.numMeshes; i++) {
+        MeshCacheMesh info;
+        if (!reader.Read(&info, sizeof(info))) {
+            ok = false;
+            break;
+        }
+        STTriangleMesh* mesh = new STTriangleMesh();
+        meshes.push_back(mesh);
+        mesh->mSimpleMesh = info.simpleMesh != 0;
+        mesh->mNumBoundaryEdges = info.numBoundaryEdges;
+        mesh->mNumNonManifoldEdges = info.numNonManifoldEdges;
+        memcpy(mesh->mMaterialAmbient, info.materialAmbient, sizeof(info.materialAmbient));
+        memcpy(mesh->mMaterialDiffuse, info.materialDiffuse, sizeof(info.materialDiffuse));
+        memcpy(mesh->mMaterialSpecular, info.materialSpecular, sizeof(info.materialSpecular));
+        mesh->mShininess = info.shininess;
+        mesh->mSurfaceArea = info.surfaceArea;
+        mesh->mMassCenter = STPoint3(info.massCenter[0], info.massCenter[1], info.massCenter[2]);
+        mesh->mBoundingBoxMin = STPoint3(info.boundingBoxMin[0], info.boundingBoxMin[1], info.boundingBoxMin[2]);
+        mesh->mBoundingBoxMax = STPoint3(info.boundingBoxMax[0], info.boundingBoxMax[1], info.boundingBoxMax[2]);
+
+        size_t numNormals = info.hasNormals ? info.numVertices : 0;
+        ok = reader.ReadString(mesh->mColorMapFile) &&
+             reader.ReadString(mesh->mNormalMapFile) &&
+             reader.ReadArray(mesh->mPositions, info.numVertices) &&
+             reader.ReadArray(mesh->mNormals, numNormals) &&
+             reader.ReadArray(mesh->mTexPos, info.numVertices) &&
+             reader.ReadArray(mesh->mVertexFace, info.numVertices) &&
+             reader.ReadArray(mesh->mIndices, (size_t)info.numFaces*3) &&
+             reader.ReadArray(mesh->mFaceNormals, info.numFaces) &&
+             reader.ReadArray(mesh->mAdjFaces, (size_t)info.numFaces*3);
+    }
+
+    if (!ok || !reader.AtEnd()) {
+        fprintf(stderr, "STTriangleMesh::ReadMeshCache() - %s is corrupt, ignoring it.\n", cacheFilename.c_str());
+        for (size_t i = 0; i < meshes.size(); i++)
+            delete meshes[i];
+        return false;
+    }
+    output_meshes.insert(output_meshes.end(), meshes.begin(), meshes.end());
+    return true;
+}
+
+//
+// The cache is written to a temporary file, which then replaces the old one
+// (see STMappedFile::CommitFile), so a crash while writing never leaves a
+// truncated cache behind.
+//
+bool STTriangleMesh::WriteMeshCache(const std::vector<STTriangleMesh*>& meshes, const std::string& cacheFilename,
+                                    const std::vector<std::string>& sourceFiles)
+{
+    std::string base = GetDirectory(cacheFilename);
+    std::string tempFilename = cacheFilename + ".tmp";
+    FILE* file = fopen(tempFilename.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = true;
+    MeshCacheHeader header;
+    memcpy(header.magic, kMeshCacheMagic, sizeof(kMeshCacheMagic));
+    header.version = kMeshCacheVersion;
+    header.byteOrder = kMeshCacheByteOrder;
+    header.numSources = (unsigned int)sourceFiles.size();
+    header.numMeshes = (unsigned int)meshes.size();
+    WriteBytes(file, &header, sizeof(header), ok);
+
+    for (size_t i = 0; ok && i < sourceFiles.size(); i++) {
+        MeshCacheSource source;
+        STMappedFile sourceFile;
+        ok = STMappedFile::GetFileInfo(sourceFiles[i], &source.size, &source.modifiedTime) &&
+             sourceFile.Open(sourceFiles[i]);
+        if (!ok)
+            break;
+        source.hash = sourceFile.ComputeHash();
+        std::string name = sourceFiles[i];
+        if (name.compare(0, base.size(), base) == 0)
+            name = name.substr(base.size());
+        WriteString(file, name, ok);
+        WriteBytes(file, &source, sizeof(source), ok);
+    }
+
+    for (size_t i = 0; ok && i < meshes.size(); i++) {
+        const STTriangleMesh* mesh = meshes[i];
+        MeshCacheMesh info;
+        memset(&info, 0, sizeof(info));
+        info.numVertices = mesh->NumVertices();
+        info.numFaces = mesh->NumFaces();
+        info.simpleMesh = mesh->mSimpleMesh ? 1 : 0;
+        info.numBoundaryEdges = mesh->mNumBoundaryEdges;
+        info.numNonManifoldEdges = mesh->mNumNonManifoldEdges;
+        info.hasNormals = mesh->mNormals.empty() ? 0 : 1;
+        memcpy(info.materialAmbient, mesh->mMaterialAmbient, sizeof(info.materialAmbient));
+        memcpy(info.materialDiffuse, mesh->mMaterialDiffuse, sizeof(info.materialDiffuse));
+        memcpy(info.materialSpecular, mesh->mMaterialSpecular, sizeof(info.materialSpecular));
+        info.shininess = mesh->mShininess;
+        info.surfaceArea = mesh->mSurfaceArea;
+        const STPoint3* points[3] = { &mesh->mMassCenter, &mesh->mBoundingBoxMin, &mesh->mBoundingBoxMax };
+        float* dst[3] = { info.massCenter, info.boundingBoxMin, info.boundingBoxMax };
+        for (int j = 0; j < 3; j++) {
+            dst[j][0] = points[j]->x;
+            dst[j][1] = points[j]->y;
+            dst[j][2] = points[j]->z;
+        }
+        WriteBytes(file, &info, sizeof(info), ok);
+        WriteString(file, mesh->mColorMapFile, ok);
+        WriteString(file, mesh->mNormalMapFile, ok);
+        WriteArray(file, mesh->mPositions, ok);
+        WriteArray(file, mesh->mNormals, ok);
+        WriteArray(file, mesh->mTexPos, ok);
+        WriteArray(file, mesh->mVertexFace, ok);
+        WriteArray(file, mesh->mIndices, ok);
+        WriteArray(file, mesh->mFaceNormals, ok);
+        WriteArray(file, mesh->mAdjFaces, ok);
+    }
+
+    return STMappedFile::CommitFile(file, tempFilename, cacheFilename, ok);
+}
@@ -0,0 +1,386 @@
+// STTriangleMesh_subdivide.cpp
+#include "STTriangleMesh.h"
+#include "STParallel.h"
+
+#include <algorithm>
+
+static const unsigned int kNone = (unsigned int)-1;
+
+//
+// Turn per-chunk counts into exclusive prefix sums, returning the total.
+//
+static unsigned int ExclusiveScan(std::vector<unsigned int>& counts)
+{
+    unsigned int total=0;
+    for(unsigned int i=0;i<counts.size();i++){
+        unsigned int count=counts[i];
+        counts[i]=total;
+        total+=count;
+    }
+    return total;
+}
+
+//
+// Corner of face f that holds vertex v, or -1.
+//
+static int CornerOf(const std::vector<unsigned int>& indices, int f, unsigned int v)
+{
+    for(int k=0;k<3;k++)
+        if(indices[f*3+k]==v) return k;
+    return -1;
+}
+
+//
+// The half-edge on the other side of the edge opposite corner j of face f
+// (as 3*face+corner, like the edge it is paired with), or kNone.
+//
+unsigned int STTriangleMesh::OppositeHalfEdge(unsigned int f, unsigned int j) const
+{
+    int g=mAdjFaces[f*3+j];
+    if(g<0) return kNone;
+    unsigned int a=mIndices[f*3+(j+1)%3];
+    unsigned int b=mIndices[f*3+(j+2)%3];
+    for(unsigned int k=0;k<3;k++){
+        if(mIndices[g*3+(k+1)%3]==b && mIndices[g*3+(k+2)%3]==a)
+            return g*3+k;
+    }
+    return kNone;
+}
+
+void STTriangleMesh::LoopSubdivide(int levels)
+{
+    if(!mSimpleMesh) return;
+    if(mAdjFaces.size()!=mIndices.size()) BuildTopology();
+    for(int level=0;level<levels;level++)
+        SubdivideLevel(0);
+    UpdateGeometry();
+}
+
+void STTriangleMesh::LoopSubdivide(const std::vector<char>& selectedFaces, int levels)
+{
+    if(!mSimpleMesh) return;
+    if(mAdjFaces.size()!=mIndices.size()) BuildTopology();
+    std::vector<char> selected(selectedFaces);
+    selected.resize(NumFaces(),0);
+    for(int level=0;level<levels;level++)
+        SubdivideLevel(&selected);
+    UpdateGeometry();
+}
+
+void STTriangleMesh::LoopSubdivideToScreenSize(const float modelViewProj[16], float viewportWidth, float viewportHeight,
+                                               float maxEdgePixels, int maxLevels)
+{
+    if(!mSimpleMesh) return;
+    if(mAdjFaces.size()!=mIndices.size()) BuildTopology();
+    std::vector<char> selected;
+    for(int level=0;level<maxLevels;level++){
+        if(SelectFacesByScreenSize(selected,modelViewProj,viewportWidth,viewportHeight,maxEdgePixels)==0)
+            break;
+        SubdivideLevel(&selected);
+    }
+    UpdateGeometry();
+}
+
+unsigned int STTriangleMesh::SelectFacesByScreenSize(std::vector<char>& selectedFaces, const float modelViewProj[16],
+                                                     float viewportWidth, float viewportHeight, float maxEdgePixels) const
+{
+    const float* m=modelViewProj;
+    // window-space x, y and a flag for vertices in front of the eye
+    std::vector<STPoint3> projected(NumVertices());
+    STParallelFor(0,NumVertices(),[&](size_t begin,size_t end,size_t){
+        for(size_t i=begin;i<end;i++){
+            const STPoint3& p=mPositions[i];
+            float x=m[0]*p.x+m[4]*p.y+m[8]*p.z+m[12];
+            float y=m[1]*p.x+m[5]*p.y+m[9]*p.z+m[13];
+            float w=m[3]*p.x+m[7]*p.y+m[11]*p.z+m[15];
+            if(w>1e-6f)
+                projected[i]=STPoint3(0.5f*viewportWidth*x/w,0.5f*viewportHeight*y/w,1.0f);
+            else
+                projected[i]=STPoint3(0.0f,0.0f,0.0f);
+        }
+    });
+
+    float maxSquared=maxEdgePixels*maxEdgePixels;
+    selectedFaces.assign(NumFaces(),0);
+    std::vector<unsigned int> counts(STGetNumThreads(),0);
+    STParallelFor(0,NumFaces(),[&](size_t begin,size_t end,size_t chunk){
+        float halfW=0.5f*viewportWidth, halfH=0.5f*viewportHeight;
+        for(size_t f=begin;f<end;f++){
+            const STPoint3& p0=projected[mIndices[f*3]];
+            const STPoint3& p1=projected[mIndices[f*3+1]];
+            const STPoint3& p2=projected[mIndices[f*3+2]];
+            if(p0.z==0.0f || p1.z==0.0f || p2.z==0.0f)
+                continue;
+            // skip faces entirely off one side of the viewport
+            if((p0.x<-halfW && p1.x<-halfW && p2.x<-halfW) || (p0.x>halfW && p1.x>halfW && p2.x>halfW) ||
+               (p0.y<-halfH && p1.y<-halfH && p2.y<-halfH) || (p0.y>halfH && p1.y>halfH && p2.y>halfH))
+                continue;
+            float e0=(p1.x-p0.x)*(p1.x-p0.x)+(p1.y-p0.y)*(p1.y-p0.y);
+            float e1=(p2.x-p1.x)*(p2.x-p1.x)+(p2.y-p1.y)*(p2.y-p1.y);
+            float e2=(p0.x-p2.x)*(p0.x-p2.x)+(p0.y-p2.y)*(p0.y-p2.y);
+            if(e0>maxSquared || e1>maxSquared || e2>maxSquared){
+                selectedFaces[f]=1;
+                counts[chunk]++;
+            }
+        }
+    });
+    return ExclusiveScan(counts);
+}
+
+//
+// One level of Loop subdivision. With selected==0 every face is split in
+// four and the new adjacency is derived directly from the old one.
+// Otherwise only the selected faces are split in four; any other face that
+// ends up with two or three split edges is split in four as well, and a
+// face with exactly one split edge is split in two so the mesh stays
+// conforming. Even vertices are only smoothed when they belong to a face
+// that is split in four. On return, selected marks the children of the
+// faces that were selected.
+//
+void STTriangleMesh::SubdivideLevel(std::vector<char>* selected)
+{
+    const bool uniform=(selected==0);
+    const unsigned int numFaces=NumFaces();
+    const unsigned int numVertices=NumVertices();
+    const unsigned int numHalfEdges=numFaces*3;
+    const unsigned int numThreads=STGetNumThreads();
+
+    // Faces split in four: the selection, closed over faces with two or
+    // more split edges.
+    std::vector<char> red;
+    if(!uniform){
+        red=*selected;
+        std::vector<char> next;
+        std::vector<unsigned int> changed(numThreads);
+        for(;;){
+            next=red;
+            changed.assign(numThreads,0);
+            STParallelFor(0,numFaces,[&](size_t begin,size_t end,size_t chunk){
+                for(size_t f=begin;f<end;f++){
+                    if(red[f]) continue;
+                    int numSplit=0;
+                    for(int j=0;j<3;j++){
+                        int g=mAdjFaces[f*3+j];
+                        if(g>=0 && red[g]) numSplit++;
+                    }
+                    if(numSplit>=2){
+                        next[f]=1;
+                        changed[chunk]++;
+                    }
+                }
+            });
+            red.swap(next);
+            if(ExclusiveScan(changed)==0) break;
+        }
+    }
+
+    // Add Odd Vertices. The edge vertex of a split edge is created by the
+    // lower-numbered of its two half-edges; edgeVertices[3*f+j] is the new
+    // vertex on the edge opposite corner j of face f, or kNone.
+    std::vector<unsigned int> opposite(numHalfEdges);
+    std::vector<unsigned int> edgeVertices(numHalfEdges,kNone);
+    std::vector<unsigned int> offsets(numThreads,0);
+    STParallelFor(0,numHalfEdges,[&](size_t begin,size_t end,size_t chunk){
+        unsigned int count=0;
+        for(size_t h=begin;h<end;h++){
+            opposite[h]=OppositeHalfEdge(h/3,h%3);
+            bool split=uniform || red[h/3] || (opposite[h]!=kNone && red[opposite[h]/3]);
+            if(split && (opposite[h]==kNone || h<opposite[h]))
+                count++;
+        }
+        offsets[chunk]=count;
+    });
+    unsigned int numNewVertices=ExclusiveScan(offsets);
+    mPositions.resize(numVertices+numNewVertices);
+    mTexPos.resize(numVertices+numNewVertices);
+    STParallelFor(0,numHalfEdges,[&](size_t begin,size_t end,size_t chunk){
+        unsigned int newVertex=numVertices+offsets[chunk];
+        for(size_t h=begin;h<end;h++){
+            unsigned int f=h/3, j=h%3;
+            unsigned int o=opposite[h];
+            bool split=uniform || red[f] || (o!=kNone && red[o/3]);
+            if(!split || (o!=kNone && o<h))
+                continue;
+            unsigned int a=mIndices[f*3+(j+1)%3];
+            unsigned int b=mIndices[f*3+(j+2)%3];
+            if(o!=kNone){
+                mPositions[newVertex]=(mPositions[a]+mPositions[b])*0.375f
+                    +(mPositions[mIndices[h]]+mPositions[mIndices[o]])*0.125f;
+                edgeVertices[o]=newVertex;
+            }
+            else{
+                mPositions[newVertex]=(mPositions[a]+mPositions[b])*0.5f;
+            }
+            mTexPos[newVertex]=(mTexPos[a]+mTexPos[b])*0.5f;
+            edgeVertices[h]=newVertex;
+            newVertex++;
+        }
+    });
+
+    // Adjust Even Vertices
+    std::vector<char> smoothed;
+    if(!uniform){
+        smoothed.assign(numVertices,0);
+        for(unsigned int f=0;f<numFaces;f++){
+            if(red[f])
+                for(int j=0;j<3;j++) smoothed[mIndices[f*3+j]]=1;
+        }
+    }
+    std::vector<STPoint3> newEvenVerticesPoints(numVertices);
+    STParallelFor(0,numVertices,[&](size_t begin,size_t end,size_t){
+        for(size_t i=begin;i<end;i++){
+            const STPoint3& p=mPositions[i];
+            int firstface=mVertexFace[i];
+            if((!uniform && !smoothed[i]) || firstface<0){
+                newEvenVerticesPoints[i]=p;
+                continue;
+            }
+            // walk forward around the vertex summing the neighbours
+            STPoint3 sum(0.0f,0.0f,0.0f), last;
+            unsigned int valence=0;
+            bool boundary=false;
+            int nextface=firstface;
+            do {
+                if(nextface<0){
+                    boundary=true;
+                    break;
+                }
+                int j=CornerOf(mIndices,nextface,i);
+                last=mPositions[mIndices[nextface*3+(j+2)%3]];
+                sum=sum+last;
+                valence++;
+            } while((nextface=NextAdjFace(i,nextface))!=firstface);
+
+            if(boundary){
+                // the two boundary neighbours are at the ends of the fan
+                STPoint3 first=last;
+                nextface=firstface;
+                do {
+                    int j=CornerOf(mIndices,nextface,i);
+                    first=mPositions[mIndices[nextface*3+(j+1)%3]];
+                } while((nextface=NextAdjFaceReverse(i,nextface))>=0 && nextface!=firstface);
+                newEvenVerticesPoints[i]=p*0.75f+last*0.125f+first*0.125f;
+            }
+            else if(valence>3){
+                newEvenVerticesPoints[i]=p*(5.0f/8.0f)+sum*(3.0f/8.0f/(float)valence);
+            }
+            else{
+                newEvenVerticesPoints[i]=p*(7.0f/16.0f)+sum*(3.0f/16.0f);
+            }
+        }
+    });
+
+    // Rebuild faces
+    std::vector<unsigned int> newIndices;
+    std::vector<char> newSelected;
+    if(uniform){
+        newIndices.resize(numFaces*12);
+        STParallelFor(0,numFaces,[&](size_t begin,size_t end,size_t){
+            for(size_t i=begin;i<end;i++){
+                unsigned int* newFaces=&newIndices[i*12];
+                const unsigned int* e=&edgeVertices[i*3];
+                for(unsigned int j=0;j<3;j++){
+                    newFaces[j*3]=mIndices[i*3+j];
+                    newFaces[j*3+1]=e[(j+2)%3];
+                    newFaces[j*3+2]=e[(j+1)%3];
+                }
+                newFaces[9]=e[0];
+                newFaces[10]=e[1];
+                newFaces[11]=e[2];
+            }
+        });
+    }
+    else{
+        offsets.assign(numThreads,0);
+        STParallelFor(0,numFaces,[&](size_t begin,size_t end,size_t chunk){
+            unsigned int count=0;
+            for(size_t i=begin;i<end;i++){
+                if(red[i]) count+=4;
+                else if(edgeVertices[i*3]!=kNone || edgeVertices[i*3+1]!=kNone || edgeVertices[i*3+2]!=kNone) count+=2;
+                else count+=1;
+            }
+            offsets[chunk]=count;
+        });
+        unsigned int numNewFaces=ExclusiveScan(offsets);
+        newIndices.resize(numNewFaces*3);
+        newSelected.assign(numNewFaces,0);
+        STParallelFor(0,numFaces,[&](size_t begin,size_t end,size_t chunk){
+            unsigned int face=offsets[chunk];
+            for(size_t i=begin;i<end;i++){
+                const unsigned int* v=&mIndices[i*3];
+                const unsigned int* e=&edgeVertices[i*3];
+                unsigned int* newFaces=&newIndices[face*3];
+                if(red[i]){
+                    for(unsigned int j=0;j<3;j++){
+                        newFaces[j*3]=v[j];
+                        newFaces[j*3+1]=e[(j+2)%3];
+                        newFaces[j*3+2]=e[(j+1)%3];
+                    }
+                    newFaces[9]=e[0];
+                    newFaces[10]=e[1];
+                    newFaces[11]=e[2];
+                    if((*selected)[i])
+                        for(int k=0;k<4;k++) newSelected[face+k]=1;
+                    face+=4;
+                    continue;
+                }
+                int j=0;
+                while(j<3 && e[j]==kNone) j++;
+                if(j<3){
+                    // split in two through the edge vertex opposite corner j
+                    newFaces[0]=v[j]; newFaces[1]=v[(j+1)%3]; newFaces[2]=e[j];
+                    newFaces[3]=v[j]; newFaces[4]=e[j];       newFaces[5]=v[(j+2)%3];
+                    face+=2;
+                }
+                else{
+                    newFaces[0]=v[0]; newFaces[1]=v[1]; newFaces[2]=v[2];
+                    face+=1;
+                }
+            }
+        });
+    }
+
+    // Derive the adjacency of the four children of every face from the
+    // adjacency of the parents. Corner child j of face i is 4*i+j, the
+    // middle child is 4*i+3.
+    if(uniform){
+        std::vector<int> newAdjFaces(numFaces*12);
+        std::vector<int> newVertexFace(numVertices+numNewVertices);
+        STParallelFor(0,numFaces,[&](size_t begin,size_t end,size_t){
+            for(size_t i=begin;i<end;i++){
+                int* adj=&newAdjFaces[i*12];
+                for(unsigned int j=0;j<3;j++){
+                    unsigned int v=mIndices[i*3+j];
+                    adj[j*3]=i*4+3;
+                    int g=mAdjFaces[i*3+(j+1)%3];
+                    int k=g>=0 ? CornerOf(mIndices,g,v) : -1;
+                    adj[j*3+1]=k>=0 ? g*4+k : -1;
+                    g=mAdjFaces[i*3+(j+2)%3];
+                    k=g>=0 ? CornerOf(mIndices,g,v) : -1;
+                    adj[j*3+2]=k>=0 ? g*4+k : -1;
+                    adj[9+j]=i*4+j;
+                    unsigned int o=opposite[i*3+j];
+                    if(o==kNone || i*3+j<o)
+                        newVertexFace[edgeVertices[i*3+j]]=i*4+3;
+                }
+            }
+        });
+        STParallelFor(0,numVertices,[&](size_t begin,size_t end,size_t){
+            for(size_t v=begin;v<end;v++){
+                int f=mVertexFace[v];
+                newVertexFace[v]=f>=0 ? f*4+CornerOf(mIndices,f,v) : -1;
+            }
+        });
+        mAdjFaces.swap(newAdjFaces);
+        mVertexFace.swap(newVertexFace);
+        mNumBoundaryEdges*=2;
+        mNumNonManifoldEdges*=2;
+    }
+
+    std::copy(newEvenVerticesPoints.begin(),newEvenVerticesPoints.end(),mPositions.begin());
+    mIndices.swap(newIndices);
+    if(!uniform){
+        selected->swap(newSelected);
+        BuildTopology();
+    }
+}
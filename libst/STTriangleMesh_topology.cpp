@@ -0,0 +1,144 @@
+// STTriangleMesh_topology.cpp
+#include "STTriangleMesh.h"
+#include "STParallel.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+//
+// One half-edge in the edge table: the undirected edge it lies on (smaller
+// vertex id in the high 32 bits) and the half-edge id 3*face+corner, where
+// half-edge 3*f+j runs from corner j to corner j+1 of face f.
+//
+struct HalfEdgeEntry {
+    unsigned long long edge;
+    unsigned int halfEdge;
+
+    bool operator<(const HalfEdgeEntry& other) const {
+        return edge<other.edge || (edge==other.edge && halfEdge<other.halfEdge);
+    }
+};
+
+//
+// Sort entries in parallel: every thread sorts one slice, then neighbouring
+// slices are merged pairwise (also in parallel) until one run is left.
+//
+static void ParallelSort(std::vector<HalfEdgeEntry>& entries)
+{
+    size_t count=entries.size();
+    std::vector<size_t> runs;
+    unsigned int numRuns=STGetNumThreads();
+    if(numRuns>count/4096+1) numRuns=(unsigned int)(count/4096+1);
+    for(unsigned int i=0;i<=numRuns;i++)
+        runs.push_back(count*i/numRuns);
+
+    STParallelFor(0,numRuns,[&](size_t begin,size_t end,size_t){
+        for(size_t r=begin;r<end;r++)
+            std::sort(entries.begin()+runs[r],entries.begin()+runs[r+1]);
+    },1);
+
+    std::vector<HalfEdgeEntry> scratch(count);
+    std::vector<HalfEdgeEntry>* src=&entries;
+    std::vector<HalfEdgeEntry>* dst=&scratch;
+    while(runs.size()>2){
+        size_t numPairs=runs.size()/2;
+        STParallelFor(0,numPairs,[&](size_t begin,size_t end,size_t){
+            for(size_t p=begin;p<end;p++){
+                size_t lo=runs[p*2];
+                size_t mid=runs[(std::min)(p*2+1,runs.size()-1)];
+                size_t hi=runs[(std::min)(p*2+2,runs.size()-1)];
+                std::merge(src->begin()+lo,src->begin()+mid,
+                           src->begin()+mid,src->begin()+hi,
+                           dst->begin()+lo);
+            }
+        },1);
+        std::vector<size_t> merged;
+        for(size_t i=0;i<runs.size();i+=2)
+            merged.push_back(runs[i]);
+        if(merged.back()!=count)
+            merged.push_back(count);
+        runs.swap(merged);
+        std::swap(src,dst);
+    }
+    if(src!=&entries)
+        entries.swap(scratch);
+}
+
+//
+// Build face adjacency from a table of all half-edges sorted by their
+// undirected edge. Each run of equal edges is either a boundary edge (one
+// half-edge), a manifold edge (two half-edges running in opposite
+// directions, which become adjacent), or non-manifold (anything else:
+// three or more faces on the edge, two faces with inconsistent winding, or
+// a degenerate edge). Non-manifold edges are left unconnected.
+//
+bool STTriangleMesh::BuildTopology()
+{
+    mAdjFaces.assign(mIndices.size(),-1);
+    mVertexFace.assign(NumVertices(),-1);
+    mNumBoundaryEdges=0;
+    mNumNonManifoldEdges=0;
+    // this function only works for maniford mesh
+    if(!mSimpleMesh) return false;
+
+    for(unsigned int i=0;i<NumFaces();i++){
+        for(unsigned int j=0;j<3;j++)
+            mVertexFace[mIndices[i*3+j]]=i;
+    }
+
+    size_t numHalfEdges=mIndices.size();
+    std::vector<HalfEdgeEntry> entries(numHalfEdges);
+    STParallelFor(0,numHalfEdges,[&](size_t begin,size_t end,size_t){
+        for(size_t h=begin;h<end;h++){
+            unsigned long long a=mIndices[h];
+            unsigned long long b=mIndices[h-h%3+(h+1)%3];
+            entries[h].edge=a<b ? (a<<32)|b : (b<<32)|a;
+            entries[h].halfEdge=(unsigned int)h;
+        }
+    });
+    ParallelSort(entries);
+
+    unsigned int numChunks=STGetNumThreads();
+    std::vector<unsigned int> boundaryCounts(numChunks,0);
+    std::vector<unsigned int> nonManifoldCounts(numChunks,0);
+    STParallelFor(0,numHalfEdges,[&](size_t begin,size_t end,size_t chunk){
+        // only handle the runs that start inside this chunk
+        while(begin<end && begin>0 && entries[begin].edge==entries[begin-1].edge)
+            begin++;
+        size_t runEnd;
+        for(size_t run=begin;run<end;run=runEnd){
+            runEnd=run+1;
+            while(runEnd<numHalfEdges && entries[runEnd].edge==entries[run].edge)
+                runEnd++;
+            if(runEnd-run==1){
+                boundaryCounts[chunk]++;
+                continue;
+            }
+            if(runEnd-run==2){
+                unsigned int h0=entries[run].halfEdge;
+                unsigned int h1=entries[run+1].halfEdge;
+                unsigned int f0=h0/3, f1=h1/3;
+                unsigned int j0=h0%3, j1=h1%3;
+                unsigned int from0=mIndices[h0], to0=mIndices[f0*3+(j0+1)%3];
+                unsigned int from1=mIndices[h1], to1=mIndices[f1*3+(j1+1)%3];
+                if(from0!=to0 && from0==to1 && to0==from1){
+                    mAdjFaces[f0*3+(j0+2)%3]=f1;
+                    mAdjFaces[f1*3+(j1+2)%3]=f0;
+                    continue;
+                }
+            }
+            nonManifoldCounts[chunk]++;
+        }
+    });
+    for(unsigned int i=0;i<numChunks;i++){
+        mNumBoundaryEdges+=boundaryCounts[i];
+        mNumNonManifoldEdges+=nonManifoldCounts[i];
+    }
+
+    if(mNumNonManifoldEdges>0){
+        fprintf(stderr,
+            "STTriangleMesh::BuildTopology() - %u non-manifold edges left unconnected (%u boundary edges).\n",
+            mNumNonManifoldEdges, mNumBoundaryEdges);
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+// STAssetLoader.h
+#ifndef __STASSETLOADER_H__
+#define __STASSETLOADER_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+* Loads assets on a pool of worker threads. Every asset has a load step,
+* which runs on a worker and must not touch OpenGL (parsing meshes,
+* decoding images), and an optional upload step, which runs on the thread
+* that calls Finish() once the load step is done (creating buffers and
+* textures). For example:
+*
+*   STImage* image = NULL;
+*   STAssetLoader loader;
+*   loader.Add("orb.png",
+*              [&]() { image = new STImage("orb.png"); },
+*              [&]() { texture = new STTexture(image); });
+*   loader.Finish();
+*
+* Finish() prints a line per asset as it completes and a summary at the end.
+*/
+class STAssetLoader
+{
+public:
+    typedef std::function<void()> Step;
+
+    //
+    // Start numThreads workers (0 = one per hardware thread).
+    //
+    explicit STAssetLoader(unsigned int numThreads = 0);
+
+    //
+    // Waits for every queued asset, like Finish().
+    //
+    ~STAssetLoader();
+
+    //
+    // Queue an asset. Its load step may start right away.
+    //
+    void Add(const std::string& name, const Step& load, const Step& upload = Step());
+
+    //
+    // Run the upload steps on the calling thread in the order the loads
+    // complete, and return once every queued asset is loaded and uploaded.
+    //
+    void Finish();
+
+private:
+    // Not copyable.
+    STAssetLoader(const STAssetLoader&);
+    STAssetLoader& operator=(const STAssetLoader&);
+
+    struct Asset {
+        std::string name;
+        Step load;
+        Step upload;
+        float loadMillis;
+    };
+
+    void WorkerLoop();
+
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mWorkAvailable;
+    std::condition_variable mAssetLoaded;
+    std::deque<Asset*> mPending;
+    std::deque<Asset*> mLoaded;
+    unsigned int mNumAdded;
+    unsigned int mNumFinished;
+    float mTotalLoadMillis;
+    float mTotalUploadMillis;
+    bool mQuit;
+};
+
+#endif  // __STASSETLOADER_H__
@@ -0,0 +1,99 @@
+// STCompressedImage.h
+#ifndef __STCOMPRESSEDIMAGE_H__
+#define __STCOMPRESSEDIMAGE_H__
+
+#include "stForward.h"
+
+#include <string>
+#include <vector>
+
+/**
+* The STCompressedImage class holds an image encoded in one of the GPU
+* block-compressed formats, together with its full chain of mipmaps, so
+* that it can be handed to OpenGL as it is:
+*
+*   kBC1 (DXT1)  RGB color maps, 8 bytes per 4x4 block.
+*   kBC3 (DXT5)  RGBA color maps, 16 bytes per 4x4 block.
+*   kBC5 (RGTC2) tangent-space normal maps, 16 bytes per 4x4 block. Only
+*                x and y are kept; shaders rebuild z from them.
+*
+* Like STImage, rows are stored bottom row first, so the blocks are
+* ordered the way glCompressedTexImage2D() expects them.
+*
+* Encoding takes a while, so images are usually obtained with LoadCached(),
+* which keeps the encoded image in a .dds file next to the source image:
+*
+*   STCompressedImage* normals = STCompressedImage::LoadCached("./bumps.png", true);
+*   STTexture* texture = new STTexture(normals);
+*/
+class STCompressedImage
+{
+public:
+    enum Format {
+        kBC1,
+        kBC3,
+        kBC5,
+    };
+
+    //
+    // One mipmap level: its size in pixels and its compressed blocks.
+    //
+    struct Level {
+        int width;
+        int height;
+        std::vector<unsigned char> data;
+    };
+
+    //
+    // Construct an empty image. Use Load() to fill it in.
+    //
+    STCompressedImage();
+
+    //
+    // Encode image and its mipmaps in the given format, on all cores.
+    // The mipmaps are box filtered; for kBC5 the filtered normals are
+    // renormalized.
+    //
+    STCompressedImage(const STImage* image, Format format);
+
+    //
+    // Read and write .dds files. Save() records the size, time stamp and
+    // hash of sourceFilename (if not empty) in the header, and Load()
+    // fails if sourceFilename no longer matches what was recorded.
+    // Only files written by Save() are understood by Load().
+    //
+    bool Load(const std::string& filename, const std::string& sourceFilename = "");
+    bool Save(const std::string& filename, const std::string& sourceFilename = "") const;
+
+    //
+    // Return the compressed version of imageFilename, encoded as a normal
+    // map (kBC5) or as a color map (kBC1, or kBC3 if the image has any
+    // transparent pixels). The result is read from the cache file if it is
+    // up to date, and otherwise encoded and written to the cache.
+    // Returns NULL if the image cannot be read.
+    //
+    static STCompressedImage* LoadCached(const std::string& imageFilename, bool normalMap);
+    static std::string GetCacheFilename(const std::string& imageFilename, Format format);
+
+    Format GetFormat() const { return mFormat; }
+    int GetWidth() const { return mLevels.empty() ? 0 : mLevels[0].width; }
+    int GetHeight() const { return mLevels.empty() ? 0 : mLevels[0].height; }
+    int GetNumLevels() const { return (int)mLevels.size(); }
+    const Level& GetLevel(int level) const { return mLevels[level]; }
+
+    //
+    // Bytes of compressed data in all levels.
+    //
+    size_t GetDataSize() const;
+
+    //
+    // Bytes per 4x4 block of the given format.
+    //
+    static int GetBlockSize(Format format);
+
+private:
+    Format mFormat;
+    std::vector<Level> mLevels;
+};
+
+#endif  // __STCOMPRESSEDIMAGE_H__
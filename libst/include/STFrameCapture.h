@@ -0,0 +1,116 @@
+// STFrameCapture.h
+#ifndef __STFRAMECAPTURE_H__
+#define __STFRAMECAPTURE_H__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stForward.h"
+
+/**
+* Saves frames to image files without stalling the render loop. Capture()
+* starts an asynchronous glReadPixels into one of a ring of pixel buffer
+* objects; Update(), called once a frame, copies out the readbacks the GPU
+* has finished, a frame or two later, and hands them to worker threads that
+* encode and save them. For example:
+*
+*   STFrameCapture capture;
+*   ...draw the frame...
+*   capture.Capture(width, height, "screenshot.jpg");
+*   capture.Update();
+*   glutSwapBuffers();
+*
+* Capture() never drops a frame: when every buffer is still in flight it
+* waits for the oldest, and when too many images are waiting to be encoded it
+* waits for the workers. Both count as stalls.
+*/
+class STFrameCapture
+{
+public:
+    //
+    // numBuffers readbacks can be in flight at once. Start numThreads
+    // encoders (0 = one per hardware thread, less one for rendering).
+    //
+    explicit STFrameCapture(unsigned int numBuffers = 3, unsigned int numThreads = 0);
+
+    //
+    // Saves everything captured so far, like Finish().
+    //
+    ~STFrameCapture();
+
+    //
+    // Start reading back the width x height pixels at the lower left of the
+    // current read buffer; they are saved as filename (PPM, JPEG or PNG, by
+    // extension). Call after drawing the frame and before swapping buffers.
+    // Frames are saved on several threads at once, so give each its own
+    // filename.
+    //
+    void Capture(int width, int height, const std::string& filename);
+
+    //
+    // Pass finished readbacks on to the encoders. Does not wait on the GPU.
+    //
+    void Update();
+
+    //
+    // Return once every captured frame has been saved.
+    //
+    void Finish();
+
+    //
+    // Number of images that could not be saved since the last PrintStats().
+    //
+    unsigned int GetNumFailed();
+
+    //
+    // Print and reset the counts and times since the last report.
+    //
+    void PrintStats(const char* label);
+
+private:
+    // Not copyable.
+    STFrameCapture(const STFrameCapture&);
+    STFrameCapture& operator=(const STFrameCapture&);
+
+    struct Readback {
+        unsigned int buffer;
+        int bufferSize;
+        void* fence;
+        int width;
+        int height;
+        std::string filename;
+    };
+
+    struct Encode {
+        STImage* image;
+        std::string filename;
+    };
+
+    void Collect(Readback& readback);
+    void WorkerLoop();
+
+    std::vector<Readback> mReadbacks;
+    unsigned int mNext;             // next readback to use, the oldest one in flight
+    unsigned int mNumInFlight;
+
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mWorkAvailable;
+    std::condition_variable mEncodeDone;
+    std::deque<Encode> mPending;
+    unsigned int mNumEncoding;
+    bool mQuit;
+
+    // stats since the last PrintStats()
+    unsigned int mNumCaptured;
+    unsigned int mNumStalls;
+    unsigned int mNumFailed;
+    float mRenderThreadMillis;
+    float mEncodeMillis;
+};
+
+#endif  // __STFRAMECAPTURE_H__
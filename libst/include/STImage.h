@@ -133,6 +133,13 @@ private:
     //
     void Initialize(int width, int height);
 
+    //
+    // Expand a row of width pixels with 1 (gray), 2 (gray, alpha) or
+    // 3 (RGB) 8-bit channels, packed at the start of row, in place into
+    // width RGBA pixels. Uses SSE or NEON where available.
+    //
+    static void ExpandRowToRGBA(unsigned char* row, int width, int numChannels);
+
     //
     // Format-specific routines for loading/saving
     // particular image file formats.
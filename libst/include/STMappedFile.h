@@ -0,0 +1,76 @@
+// STMappedFile.h
+#ifndef __STMAPPEDFILE_H__
+#define __STMAPPEDFILE_H__
+
+#include <stdio.h>
+#include <string>
+
+/**
+* Read-only memory mapping of a whole file. The contents stay valid until
+* Close() or destruction.
+*/
+class STMappedFile
+{
+public:
+    //
+    // Construct an empty mapping.
+    //
+    STMappedFile();
+
+    //
+    // Unmap the file, if any.
+    //
+    ~STMappedFile();
+
+    //
+    // Map filename into memory, replacing any previous mapping.
+    // Returns false if the file cannot be opened or mapped.
+    //
+    bool Open(const std::string& filename);
+    void Close();
+
+    const char* GetData() const { return mData; }
+    size_t GetSize() const { return mSize; }
+
+    //
+    // 64-bit hash of the mapped contents, computed on all cores. Used to
+    // tell whether a file has really changed when only its time stamp has.
+    //
+    unsigned long long ComputeHash() const;
+
+    //
+    // Size in bytes and last modification time (seconds since the epoch)
+    // of a file without mapping it. Returns false if the file is missing.
+    //
+    static bool GetFileInfo(const std::string& filename, unsigned long long* size, long long* modifiedTime);
+
+    //
+    // Finish a file written to tempFilename and make it replace filename
+    // atomically: the data is flushed to disk, then the file is closed and
+    // renamed over filename, so readers see the old file or the new one,
+    // never a partly written one. ok tells whether the writes so far
+    // succeeded. On any failure the temporary file is removed. Returns
+    // whether filename was replaced.
+    //
+    static bool CommitFile(FILE* file, const std::string& tempFilename, const std::string& filename, bool ok = true);
+
+private:
+    // Not copyable.
+    STMappedFile(const STMappedFile&);
+    STMappedFile& operator=(const STMappedFile&);
+
+    const char* mData;
+    size_t mSize;
+
+    //
+    // The implementation of mappings is platform-dependent.
+    //
+#ifdef _WIN32
+    void* mFile;
+    void* mMapping;
+#else
+    int mFile;
+#endif
+};
+
+#endif  // __STMAPPEDFILE_H__
@@ -0,0 +1,46 @@
+// STParallel.h
+#ifndef __STPARALLEL_H__
+#define __STPARALLEL_H__
+
+#include <thread>
+#include <vector>
+
+/**
+* Minimal helpers for running a loop across all cores with std::thread.
+*/
+
+//
+// Number of threads STParallelFor() splits work across. Defaults to the
+// number of hardware threads; STSetNumThreads(0) restores the default.
+//
+unsigned int STGetNumThreads();
+void STSetNumThreads(unsigned int numThreads);
+
+//
+// Split [begin, end) into at most STGetNumThreads() contiguous chunks of
+// at least minChunk items, and call fn(chunkBegin, chunkEnd, chunk) for
+// each chunk on its own thread. The calling thread runs the first chunk.
+// Returns once every chunk has finished.
+//
+template <class Fn>
+void STParallelFor(size_t begin, size_t end, const Fn& fn, size_t minChunk=4096)
+{
+    if(end<=begin) return;
+    size_t count=end-begin;
+    size_t numChunks=STGetNumThreads();
+    if(minChunk<1) minChunk=1;
+    if(numChunks>(count+minChunk-1)/minChunk) numChunks=(count+minChunk-1)/minChunk;
+    if(numChunks<=1){
+        fn(begin,end,(size_t)0);
+        return;
+    }
+    std::vector<std::thread> threads;
+    threads.reserve(numChunks-1);
+    for(size_t i=1;i<numChunks;i++)
+        threads.push_back(std::thread(fn,begin+count*i/numChunks,begin+count*(i+1)/numChunks,i));
+    fn(begin,begin+count/numChunks,(size_t)0);
+    for(size_t i=0;i<threads.size();i++)
+        threads[i].join();
+}
+
+#endif  // __STPARALLEL_H__
@@ -0,0 +1,139 @@
+// STProfiler.h
+#ifndef __STPROFILER_H__
+#define __STPROFILER_H__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "STTimer.h"
+
+/**
+* Times the sections of a frame (render passes, for instance) on the CPU
+* and on the GPU, and keeps rolling statistics of each. Sections must not
+* nest or overlap, since GL_TIME_ELAPSED queries cannot. For example:
+*
+*   STProfiler profiler;
+*   ...every frame:
+*   profiler.BeginFrame();
+*   profiler.Begin("shadow");
+*   ...draw the shadow map...
+*   profiler.End();
+*   {
+*       STProfileScope scope(profiler, "main");
+*       ...draw the scene...
+*   }
+*   profiler.EndFrame();
+*
+* GPU times come from two sets of timer queries used on alternate frames, so
+* a frame's queries are read two frames later and reading them never waits
+* on the GPU. A result that is still not ready then is dropped.
+*/
+class STProfiler
+{
+public:
+    struct Stats {
+        float mean;
+        float p95;
+        float max;
+        unsigned int count;     // samples the stats are over
+    };
+
+    //
+    // Keep the last window samples of every section for the stats.
+    //
+    explicit STProfiler(unsigned int window = 120);
+
+    ~STProfiler();
+
+    //
+    // Start and end a frame. BeginFrame() also collects the GPU times of two
+    // frames ago.
+    //
+    void BeginFrame();
+    void EndFrame();
+
+    //
+    // Start and end a section of the current frame. A section that is not
+    // timed in a frame does not get a sample for it.
+    //
+    void Begin(const char* name);
+    void End();
+
+    //
+    // Sections in the order they were first timed. The frame as a whole is
+    // section 0, named "frame"; its GPU time is the sum of its sections.
+    //
+    int GetNumSections() const { return (int)mSections.size(); }
+    const std::string& GetName(int section) const { return mSections[section].name; }
+    Stats GetCPUStats(int section) const;
+    Stats GetGPUStats(int section) const;
+    bool HasGPUTimes() const { return mGPUTimers; }
+
+    //
+    // GPU results that were dropped, because they were not ready two frames
+    // later or were longer than the time since their frame began (which
+    // some drivers report for the first queries of a context).
+    //
+    unsigned int GetNumDropped() const { return mNumDropped; }
+
+    //
+    // Write every sample to a CSV file, one line per section per frame:
+    // frame,section,cpu_ms,gpu_ms. gpu_ms is empty without GPU timing.
+    //
+    bool StartCSV(const std::string& filename);
+    void StopCSV();
+    bool IsWritingCSV() const { return mCSV != NULL; }
+
+private:
+    // Not copyable.
+    STProfiler(const STProfiler&);
+    STProfiler& operator=(const STProfiler&);
+
+    struct Section {
+        std::string name;
+        std::vector<float> cpuSamples;      // ring buffers of the last window samples
+        std::vector<float> gpuSamples;
+        unsigned int numCPUSamples;
+        unsigned int numGPUSamples;
+        unsigned int queries[2];
+        bool issued[2];                     // queries[i] was used in the frame of set i
+        float cpuMillis[2];                 // the CPU time of that frame, for the CSV
+    };
+
+    int FindSection(const char* name);
+    void Collect(int set);
+    static void AddSample(std::vector<float>& samples, unsigned int& count, unsigned int window, float value);
+    static Stats ComputeStats(const std::vector<float>& samples, unsigned int count);
+
+    unsigned int mWindow;
+    std::vector<Section> mSections;
+    int mCurrent;                   // section being timed, or -1
+    float mCurrentStart;
+    STTimer mFrameTimer;
+    STTimer mClock;                 // time since construction
+    unsigned int mFrame;
+    unsigned int mSetFrames[2];     // frame number that used each query set
+    float mSetStarts[2];            // and when that frame began, by mClock
+    bool mGPUTimers;
+    bool mGPUChecked;
+    unsigned int mNumDropped;
+    FILE* mCSV;
+};
+
+//
+// Times the enclosing block as a section of profiler.
+//
+class STProfileScope
+{
+public:
+    STProfileScope(STProfiler& profiler, const char* name) : mProfiler(profiler) { mProfiler.Begin(name); }
+    ~STProfileScope() { mProfiler.End(); }
+
+private:
+    STProfileScope& operator=(const STProfileScope&);
+
+    STProfiler& mProfiler;
+};
+
+#endif  // __STPROFILER_H__
@@ -5,6 +5,7 @@
 #include "stgl.h"
 #include <string>
 #include <vector>
+#include <unordered_map>
 
 
 // Forward-declare libst types.
@@ -33,19 +34,76 @@ public:
     void UnBind();
 
     //
-    // Set a uniform global parameter of the program by name.
+    // Handle to a uniform of the program, looked up once with GetUniform()
+    // and then passed to the setters instead of the name. All uniform
+    // locations are resolved when the program is linked, so looking up a
+    // handle does not call into OpenGL. Handles to uniforms the program
+    // does not have (or that the compiler removed) are ignored by the
+    // setters. Handles stay valid until another shader is loaded.
+    //
+    class Uniform {
+    public:
+        Uniform() : index(-1) {}
+        bool IsValid() const { return index >= 0; }
+    private:
+        friend class STShaderProgram;
+        explicit Uniform(int i) : index(i) {}
+        int index;
+    };
+
+    Uniform GetUniform(const std::string& name) const;
+
+    //
+    // Location of a vertex attribute of the program, for
+    // glVertexAttribPointer(), or -1 if it has no such attribute.
+    //
+    GLint GetAttribLocation(const std::string& name);
+
+    //
+    // Set a uniform global parameter of the program by handle or by name.
+    // Values set while another program is bound are uploaded by the next
+    // Bind(). Values equal to the ones last set are not uploaded again. Arrays take the number of elements and the
+    // number of components (1 to 4) per element; matrices are 4x4 and
+    // column-major, as used by OpenGL.
     //
     void SetTexture(const std::string& name, int tex_index);
 
+    void SetUniform(Uniform uniform, float value);
+    void SetUniform(Uniform uniform, float v0, float v1);
+    void SetUniform(Uniform uniform, float v0, float v1, float v2);
+    void SetUniform(Uniform uniform, float v0, float v1, float v2, float v3);
+    void SetUniform(Uniform uniform, const STVector2& value);
+    void SetUniform(Uniform uniform, const STVector3& value);
+    void SetUniform(Uniform uniform, const STColor3f& value);
+    void SetUniform(Uniform uniform, const STColor4f& value);
+    void SetUniformInt(Uniform uniform, int value);
+    void SetUniformArray(Uniform uniform, const float* values, int count, int components);
+    void SetUniformMatrix(Uniform uniform, const float* matrix, int count = 1);
+
     void SetUniform(const std::string& name, float value);
     void SetUniform(const std::string& name, float v0, float v1);
     void SetUniform(const std::string& name, float v0, float v1, float v2);
     void SetUniform(const std::string& name, float v0, float v1, float v2, float v3);
-
     void SetUniform(const std::string& name, const STVector2& value);
     void SetUniform(const std::string& name, const STVector3& value);
     void SetUniform(const std::string& name, const STColor3f& value);
     void SetUniform(const std::string& name, const STColor4f& value);
+    void SetUniformInt(const std::string& name, int value);
+    void SetUniformArray(const std::string& name, const float* values, int count, int components);
+    void SetUniformMatrix(const std::string& name, const float* matrix, int count = 1);
+
+    //
+    // Number of OpenGL calls made by all shader programs (program binds,
+    // uniform uploads and uniform lookups), for profiling. Reset it at
+    // the start of a frame and read it at the end.
+    //
+    static unsigned int sNumGLCalls;
+
+    //
+    // Set to false to go back to looking up every uniform by name with
+    // glGetUniformLocation() and uploading every value, for comparison.
+    //
+    static bool sCacheUniforms;
 
 //private:
     //
@@ -57,11 +115,40 @@ public:
     unsigned int programid;
 
     struct UnboundTexture {
-        GLint location;
+        Uniform uniform;
         GLint tex_id;
     };
 
     std::vector<UnboundTexture> textures;
+
+private:
+    enum UniformType {
+        kFloat1, kFloat2, kFloat3, kFloat4, kInt1, kMatrix4
+    };
+
+    // Location of one active uniform and the value last set, which is
+    // pending until the program is bound to upload it.
+    struct UniformSlot {
+        GLint location;
+        std::vector<unsigned char> value;
+        UniformType type;
+        int count;
+        bool pending;
+    };
+
+    // Link the program and resolve the location of every active uniform.
+    void Link();
+    Uniform FindUniform(const std::string& name);
+    void Upload(Uniform uniform, UniformType type, const void* data, int count);
+    void Send(UniformSlot& slot);
+
+    std::vector<UniformSlot> uniforms;
+    std::unordered_map<std::string, int> uniformIndices;
+    bool hasPending;                // some uniform has a pending value
+
+    // The program last bound by Bind(), shared by all programs since
+    // OpenGL has one current program; NULL after UnBind().
+    static STShaderProgram* sBound;
 };
 
 
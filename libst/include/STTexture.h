@@ -4,6 +4,7 @@
 
 #include "stgl.h"
 #include "STImage.h"
+#include "STCompressedImage.h"
 
 /**
 * The STTexture class allows use of an STImage as an OpenGL texture.
@@ -48,6 +49,13 @@ public:
     STTexture(const STImage* image,
               ImageOptions options = kGenerateMipmaps);
 
+    //
+    // Create a new STTexture from a block-compressed image and all of
+    // its mipmap levels, which are uploaded without decompressing them.
+    // Check IsFormatSupported() first.
+    //
+    STTexture(const STCompressedImage* image);
+
     //
     // Create an "empty" STTexture with no image data. You will need
     // to load an image before you can use this texture for
@@ -68,6 +76,18 @@ public:
     void LoadImageData(const STImage* image,
                        ImageOptions options = kGenerateMipmaps);
 
+    //
+    // Load block-compressed data into the STTexture. If the image has
+    // mipmaps, the minification filter is switched to use them.
+    //
+    void LoadCompressedData(const STCompressedImage* image);
+
+    //
+    // Whether the OpenGL driver can sample textures in the given
+    // compressed format.
+    //
+    static bool IsFormatSupported(STCompressedImage::Format format);
+
     //
     // Bind this texture for use in subsequent OpenGL drawing.
     //
@@ -105,6 +125,17 @@ public:
     //
     int GetHeight() const { return mHeight; }
 
+    //
+    // Whether the texture only has red and green channels (a kBC5
+    // normal map, whose z has to be rebuilt in the shader).
+    //
+    bool IsTwoChannel() const { return mTwoChannel; }
+
+    //
+    // Bytes of video memory used by the texture data, including mipmaps.
+    //
+    size_t GetMemoryUsage() const { return mMemoryUsage; }
+
 private:
     // Common initialization code, used by all constructors.
     void Initialize();
@@ -115,6 +146,9 @@ private:
     // The width and height of the image data.
     int mWidth;
     int mHeight;
+
+    bool mTwoChannel;
+    size_t mMemoryUsage;
 };
 
 #endif // __STTEXTURE_H__
@@ -6,12 +6,13 @@
 #ifdef _WIN32
 #include <windows.h>
 #else
-#include <sys/time.h>
+#include <time.h>
 #endif
 
 /**
 * Platform independent timer class.
 * Keeps track of elapsed wall clock time and returns values in milliseconds.
+* The clock is monotonic, so it never jumps when the system time is set.
 */
 class STTimer
 {
@@ -40,7 +41,7 @@ private:
     LARGE_INTEGER mStartTime;
     float          mFrequency;
 #else
-    struct timeval mStartTime;
+    struct timespec mStartTime;
 #endif
 };
 
@@ -9,55 +9,12 @@
 #include <vector>
 #include <iostream>
 
-struct STFace;
-
-struct STVertex{
-    STVertex(float x, float y, float z, float u=0, float v=0){
-        pt=STPoint3(x,y,z);
-        texPos=STPoint2(u,v);
-    }
-    STVertex(const STPoint3& pt, const STPoint2& texPos=STPoint2(0, 0)){
-        this->pt=pt;
-        this->texPos=texPos;
-        f=0;
-    }
-    STPoint3 pt;
-    STVector3 normal;
-    STPoint2 texPos;
-    STFace *f;
-};
-inline std::ostream& operator <<(std::ostream& stream, const STVertex& v);
-
-struct STFace{
-    STFace(STVertex* v0, STVertex* v1, STVertex* v2){
-        v[0]=v0;
-        v[1]=v1;
-        v[2]=v2;
-        texPos[0] = &(v0->texPos);
-        texPos[1] = &(v1->texPos);
-        texPos[2] = &(v2->texPos);
-    }
-    STFace(STVertex* v0, STVertex* v1, STVertex* v2, STVector3* n1, STVector3* n2, STVector3* n3){
-        v[0]=v0;
-        v[1]=v1;
-        v[2]=v2;
-        texPos[0] = &(v0->texPos);
-        texPos[1] = &(v1->texPos);
-        texPos[2] = &(v2->texPos);
-        normals[0]=n1;
-        normals[1]=n2;
-        normals[2]=n3;
-    }
-    STVertex *v[3];
-    STFace *adjF[3];
-    STVector3 normal;
-    STVector3 *normals[3];
-    STPoint2 *texPos[3];
-};
-inline std::ostream& operator <<(std::ostream& stream, const STFace& f);
-
 /**
 * STTriangleMesh use a simple data structure to represent a triangle mesh.
+* Vertex attributes live in contiguous arrays indexed by vertex id, and each
+* face is a triple of vertex ids in mIndices. Face adjacency is stored the
+* same way: mAdjFaces[3*f+j] is the face across the edge opposite corner j
+* of face f, or -1 if that edge is on the boundary.
 */
 class STTriangleMesh
 {
@@ -77,9 +34,40 @@ public:
 
     //
     // Draw the triangle mesh to the OpenGL window using GL_TRIANGLES.
+    // The mesh is drawn from GPU-resident vertex and index buffers,
+    // which are (re)built on demand whenever the geometry has changed.
     //
     void Draw(bool smooth) const;
 
+    //
+    // Build the interleaved vertex buffers and index buffers used by
+    // Draw(), one set for smooth and one for flat shading. LoadObj()
+    // calls this once at load time.
+    //
+    bool UploadBuffers() const;
+    void ReleaseBuffers() const;
+
+    //
+    // Create the color and normal map textures from the decoded images.
+    // Draw() calls this if it has not been done yet.
+    //
+    void UploadTextures() const;
+
+    //
+    // Set to false to upload the texture maps as plain RGBA images. When
+    // true (the default), they are block compressed (kBC1/kBC3 for color
+    // maps, kBC5 for normal maps) through STCompressedImage::LoadCached(),
+    // so a warm start skips image decoding altogether. Formats the driver
+    // cannot sample fall back to the RGBA path.
+    //
+    static bool sCompressTextures;
+
+    //
+    // Set to true to draw every mesh with glBegin/glEnd instead of the
+    // buffer objects (useful for comparing the two paths).
+    //
+    static bool sImmediateMode;
+
     //
     // Read and Write the triangle mesh from/to files.
     //
@@ -95,26 +83,92 @@ public:
     
     //
     // Build topology and calculate normals for the triangle mesh.
+    // BuildTopology() sorts all half-edges by edge in parallel, connects
+    // faces across manifold edges and counts boundary and non-manifold
+    // edges (the latter are left unconnected).
     //
     bool Build();
     bool BuildTopology();
+    unsigned int mNumBoundaryEdges;
+    unsigned int mNumNonManifoldEdges;
     bool UpdateGeometry();
 	bool CalculateTextureCoordinatesViaSphericalProxy();
 	bool CalculateTextureCoordinatesViaCylindricalProxy(float h_min,float h_max,float center_x,float center_y,int axis_direction);
 
-    STFace* NextAdjFace(STVertex *v, STFace *f);
-    STFace* NextAdjFaceReverse(STVertex *v, STFace *f);
+    //
+    // Walk the faces around vertex v, starting from face f. Returns -1
+    // when the walk runs into a boundary edge.
+    //
+    int NextAdjFace(unsigned int v, int f) const;
+    int NextAdjFaceReverse(unsigned int v, int f) const;
+
+    //
+    // Loop subdivision on the flat arrays, all levels in one call, with the
+    // odd and even vertices of each level computed in parallel.
+    //  - LoopSubdivide(levels) splits every face.
+    //  - LoopSubdivide(selectedFaces, levels) only refines the faces whose
+    //    entry is non-zero (and their children), splitting neighbours just
+    //    enough to keep the mesh free of cracks.
+    //  - LoopSubdivideToScreenSize() keeps refining the faces whose longest
+    //    edge projects to more than maxEdgePixels, up to maxLevels times.
+    //    modelViewProj is a column-major 4x4 matrix as used by OpenGL.
+    // Only simple meshes (normals computed from the faces) are subdivided.
+    //
+    void LoopSubdivide(int levels=1);
+    void LoopSubdivide(const std::vector<char>& selectedFaces, int levels=1);
+    void LoopSubdivideToScreenSize(const float modelViewProj[16], float viewportWidth, float viewportHeight,
+                                   float maxEdgePixels, int maxLevels);
+    unsigned int SelectFacesByScreenSize(std::vector<char>& selectedFaces, const float modelViewProj[16],
+                                         float viewportWidth, float viewportHeight, float maxEdgePixels) const;
+
+    unsigned int NumVertices() const { return (unsigned int)mPositions.size(); }
+    unsigned int NumFaces() const { return (unsigned int)mIndices.size()/3; }
+
+    //
+    // Bytes of CPU memory held by the vertex and face arrays.
+    //
+    size_t GetMemoryUsage() const;
 
-    void LoopSubdivide();
     //
     // Local members
     //
-    std::vector<STVertex*> mVertices;
-    std::vector<STVector3*> mNormals;
-    std::vector<STPoint2*> mTexPos;
-    std::vector<STFace*> mFaces;
+
+    // Per-vertex attributes, all NumVertices() long.
+    std::vector<STPoint3> mPositions;
+    std::vector<STVector3> mNormals;
+    std::vector<STPoint2> mTexPos;
+    std::vector<int> mVertexFace;       // one face using each vertex, or -1
+
+    // Per-face data: 3 vertex ids, 1 normal and 3 adjacent faces per face.
+    std::vector<unsigned int> mIndices;
+    std::vector<STVector3> mFaceNormals;
+    std::vector<int> mAdjFaces;
     
     static std::string LoadObj(std::vector<STTriangleMesh*>& output_meshes, const std::string& filename);
+
+    //
+    // Everything LoadObj() does except creating OpenGL objects: parse (or
+    // read from the cache), build and decode the texture maps. Safe to call
+    // on any thread; UploadBuffers() and UploadTextures() must then be
+    // called on the OpenGL thread.
+    //
+    static std::string LoadObjData(std::vector<STTriangleMesh*>& output_meshes, const std::string& filename);
+
+    //
+    // Binary cache of the meshes LoadObj() builds, written next to the .obj
+    // file as <name>.stmesh after parsing it. The cache holds the vertex and
+    // face arrays, the computed normals, bounds and materials, so a later
+    // LoadObj() only has to map it and copy the arrays out. It is rejected
+    // (and rebuilt) when its .obj or .mtl files have a different size, or a
+    // different time stamp and content hash. Texture maps are only named in
+    // the cache and read when the meshes are loaded, so they are not checked.
+    // Set sUseMeshCache to false to always parse the .obj file.
+    //
+    static std::string GetMeshCacheFilename(const std::string& objFilename);
+    static bool ReadMeshCache(std::vector<STTriangleMesh*>& output_meshes, const std::string& cacheFilename);
+    static bool WriteMeshCache(const std::vector<STTriangleMesh*>& meshes, const std::string& cacheFilename,
+                               const std::vector<std::string>& sourceFiles);
+    static bool sUseMeshCache;
     
     float mMaterialAmbient[4];
     float mMaterialDiffuse[4];
@@ -122,10 +176,16 @@ public:
     float mShininess;  // # between 1 and 128.
     bool mHasColorMap;
 	STImage * mSurfaceColorImg;
-	STTexture * mSurfaceColorTex;
+	mutable STTexture * mSurfaceColorTex;
     bool mHasNormalMap;
     STImage * mSurfaceNormalImg;
-	STTexture * mSurfaceNormalTex;
+	mutable STTexture * mSurfaceNormalTex;
+    // Compressed maps waiting for UploadTextures(), or NULL.
+    mutable STCompressedImage * mSurfaceColorCompressed;
+    mutable STCompressedImage * mSurfaceNormalCompressed;
+    // Texture file names from the .mtl file, relative to the .obj file.
+    std::string mColorMapFile;
+    std::string mNormalMapFile;
 
     static STPoint3 GetMassCenter(const std::vector<STTriangleMesh*>& input_meshes);
     static std::pair<STPoint3,STPoint3> GetBoundingBox(const std::vector<STTriangleMesh*>& input_meshes);
@@ -144,6 +204,32 @@ public:
     static int instance_count;
 	static STImage whiteImg;
 	static STTexture* whiteTex;
+
+private:
+    void DrawImmediate(bool smooth) const;
+    void LoadTextureMaps(const std::string& base);
+    // Directory the map file names are relative to, set by LoadTextureMaps().
+    std::string mMapDirectory;
+
+    void SubdivideLevel(std::vector<char>* selected);
+    unsigned int OppositeHalfEdge(unsigned int f, unsigned int j) const;
+
+    //
+    // Vertex layout of the buffers built by UploadBuffers().
+    //
+    struct BufferVertex {
+        float pt[3];
+        float normal[3];
+        float texPos[2];
+    };
+
+    enum { kSmoothBuffers = 0, kFlatBuffers = 1 };
+
+    // OpenGL buffer ids and index counts, [kSmoothBuffers] and [kFlatBuffers].
+    mutable unsigned int mVertexBuffers[2];
+    mutable unsigned int mIndexBuffers[2];
+    mutable unsigned int mIndexCounts[2];
+    mutable bool mBuffersDirty;
 };
 
 #endif  // __STTRIANGLEMESH_H__
@@ -16,12 +16,18 @@
 #include "STColor3f.h"
 #include "STColor4f.h"
 #include "STColor4ub.h"
+#include "STCompressedImage.h"
+#include "STFrameCapture.h"
 #include "STFont.h"
 #include "STImage.h"
 #include "STJoystick.h"
+#include "STMappedFile.h"
+#include "STAssetLoader.h"
 #include "STMatrix4.h"
+#include "STParallel.h"
 #include "STPoint2.h"
 #include "STPoint3.h"
+#include "STProfiler.h"
 #include "STShaderProgram.h"
 #include "STShape.h"
 #include "STTexture.h"
@@ -13,12 +13,15 @@
 struct STColor3f;
 struct STColor4f;
 struct STColor4ub;
+class STCompressedImage;
 class STFont;
+class STFrameCapture;
 class STImage;
 class STJoystick;
 struct STMatrix4;
 struct STPoint2;
 struct STPoint3;
+class STProfiler;
 class STShape;
 class STTexture;
 class STTimer;
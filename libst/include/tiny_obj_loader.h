@@ -96,6 +96,24 @@ std::string LoadObj(
     std::istream& inStream,
     MaterialReader& readMatFn);
 
+/// Loads .obj from a file like LoadObj(), with identical results, but
+/// memory-maps the file and parses it on all cores.
+std::string LoadObjMapped(
+    std::vector<shape_t>& shapes,   // [output]
+    std::vector<material_t>& materials,   // [output]
+    const char* filename,
+    const char* mtl_basepath = NULL);
+
+/// Loads object from 'size' bytes at 'data' (need not be NUL-terminated),
+/// parsing chunks of it in parallel.
+/// Returns empty string when loading .obj success.
+std::string LoadObjFromMemory(
+    std::vector<shape_t>& shapes,   // [output]
+    std::vector<material_t>& materials,   // [output]
+    const char* data,
+    size_t size,
+    MaterialReader& readMatFn);
+
 /// Loads materials into std::map
 /// Returns an empty string if successful
 std::string LoadMtl (
@@ -25,10 +25,13 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 
 #include "tiny_obj_loader.h"
+#include "STMappedFile.h"
+#include "STParallel.h"
 
 namespace tinyobj {
 
@@ -225,7 +228,7 @@ void InitMaterial(material_t& material) {
 static bool
 exportFaceGroupToShape(
   shape_t& shape,
-  std::map<vertex_index, unsigned int> vertexCache,
+  std::map<vertex_index, unsigned int>& vertexCache,
   const std::vector<float> &in_positions,
   const std::vector<float> &in_normals,
   const std::vector<float> &in_texcoords,
@@ -235,6 +238,8 @@ exportFaceGroupToShape(
   bool clearCache)
 {
   if (faceGroup.empty()) {
+    if (clearCache)
+        vertexCache.clear();
     return false;
   }
 
@@ -729,4 +734,581 @@ std::string LoadObj(
 }
 
 
+
+//
+// Memory-mapped, multithreaded loader.
+//
+// The file is split into one chunk per thread at line boundaries. Each
+// chunk is parsed in place into its own attribute and face arrays plus an
+// ordered list of the commands (usemtl, mtllib, g, o) that affect how faces
+// are grouped. The chunks are then concatenated, the commands replayed in
+// file order to cut the faces into shapes exactly like LoadObj() does, and
+// every shape is flattened on its own thread.
+//
+
+// Scanning helpers for a line [token, end) of the mapped buffer, which is
+// not NUL-terminated.
+static inline char charAt(const char* token, const char* end) {
+  return token < end ? *token : '\0';
+}
+
+static inline bool isWhiteSpace(const char c) {
+  return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') || (c == '\v') || (c == '\f');
+}
+
+static inline bool isDigit(const char c) {
+  return (c >= '0') && (c <= '9');
+}
+
+static inline void skipSpace(const char*& token, const char* end) {
+  while (token < end && isSpace(*token)) token++;
+}
+
+static inline void skipSpaceOrCR(const char*& token, const char* end) {
+  while (token < end && (isSpace(*token) || *token == '\r')) token++;
+}
+
+static inline void skipToSpace(const char*& token, const char* end, bool slash = false) {
+  while (token < end && !isSpace(*token) && *token != '\r' && !(slash && *token == '/')) token++;
+}
+
+// Same result as atoi().
+static inline int fastAtoi(const char* token, const char* end)
+{
+  while (token < end && isWhiteSpace(*token)) token++;
+  bool negative = false;
+  if (token < end && (*token == '+' || *token == '-')) {
+    negative = (*token == '-');
+    token++;
+  }
+  int i = 0;
+  while (token < end && isDigit(*token)) {
+    i = i * 10 + (*token - '0');
+    token++;
+  }
+  return negative ? -i : i;
+}
+
+// Same result as (float)atof(). Decimal numbers with at most 15 significant
+// digits and a small enough exponent are exact in double precision, so
+// one multiply or divide by an exact power of ten rounds exactly like
+// strtod. Everything else (more digits, hex, inf/nan) goes to atof.
+static float fastAtof(const char* token, const char* end)
+{
+  static const double pow10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  const char* start = token;
+  while (token < end && isWhiteSpace(*token)) token++;
+  bool negative = false;
+  if (token < end && (*token == '+' || *token == '-')) {
+    negative = (*token == '-');
+    token++;
+  }
+
+  unsigned long long mantissa = 0;
+  int numDigits = 0;
+  int exponent = 0;
+  bool anyDigits = false;
+  bool exact = true;
+  bool fraction = false;
+  if (token + 1 < end && token[0] == '0' && (token[1] == 'x' || token[1] == 'X'))
+    exact = false;
+  for (; token < end; token++) {
+    char c = *token;
+    if (c == '.' && !fraction) {
+      fraction = true;
+      continue;
+    }
+    if (!isDigit(c)) break;
+    anyDigits = true;
+    if (mantissa == 0 && c == '0') {
+      if (fraction) exponent--;
+    } else if (numDigits < 15) {
+      mantissa = mantissa * 10 + (c - '0');
+      numDigits++;
+      if (fraction) exponent--;
+    } else {
+      exact = false;
+    }
+  }
+  if (token < end && (*token == 'e' || *token == 'E')) {
+    const char* e = token + 1;
+    bool negativeExponent = false;
+    if (e < end && (*e == '+' || *e == '-')) {
+      negativeExponent = (*e == '-');
+      e++;
+    }
+    if (e < end && isDigit(*e)) {
+      int value = 0;
+      while (e < end && isDigit(*e)) {
+        if (value < 10000) value = value * 10 + (*e - '0');
+        e++;
+      }
+      exponent += negativeExponent ? -value : value;
+    }
+  }
+
+  if (anyDigits && exact && (mantissa == 0 || (exponent >= -22 && exponent <= 22))) {
+    double value = (double)mantissa;
+    if (exponent >= 0) value *= pow10[exponent];
+    else value /= pow10[-exponent];
+    return (float)(negative ? -value : value);
+  }
+
+  // fall back to atof on a NUL-terminated copy of the rest of the line
+  char buf[128];
+  size_t len = end - start;
+  if (len > sizeof(buf) - 1) len = sizeof(buf) - 1;
+  memcpy(buf, start, len);
+  buf[len] = '\0';
+  return (float)atof(buf);
+}
+
+static inline float parseFloat(const char*& token, const char* end)
+{
+  skipSpace(token, end);
+  float f = fastAtof(token, end);
+  skipToSpace(token, end);
+  return f;
+}
+
+// First whitespace-separated word, like sscanf(token, "%s", ...).
+static inline std::string parseWord(const char* token, const char* end)
+{
+  while (token < end && isWhiteSpace(*token)) token++;
+  const char* b = token;
+  while (token < end && !isWhiteSpace(*token)) token++;
+  return std::string(b, token);
+}
+
+// A face corner index as stored by a chunk: absolute indices are final,
+// relative (negative) ones are fixed up once the chunk's offset is known.
+struct relative_index {
+  size_t pos;       // position in obj_chunk::corners
+  int local;        // index counted from the start of the chunk
+  int kind;         // 0 = v, 1 = vt, 2 = vn
+};
+
+struct obj_command {
+  enum { kUseMtl, kMtlLib, kGroup, kObject };
+  int type;
+  std::string name;
+  size_t face;      // number of faces in the chunk before this command
+};
+
+struct obj_chunk {
+  std::vector<float> v;
+  std::vector<float> vn;
+  std::vector<float> vt;
+  std::vector<int> corners;                 // v_idx, vt_idx, vn_idx per corner
+  std::vector<unsigned int> faceStarts;     // first corner of every face
+  std::vector<relative_index> relatives;
+  std::vector<obj_command> commands;
+};
+
+static inline int fixIndexInChunk(
+  int idx, int n, int kind, size_t pos, std::vector<relative_index>& relatives)
+{
+  if (idx > 0) return idx - 1;
+  if (idx == 0) return 0;
+  relative_index r;
+  r.pos = pos;
+  r.local = n + idx;
+  r.kind = kind;
+  relatives.push_back(r);
+  return 0;
+}
+
+// parseTriple() for a chunk: appends the corner to chunk.corners.
+static void parseTripleInChunk(const char*& token, const char* end, obj_chunk& chunk)
+{
+  size_t pos = chunk.corners.size();
+  int vsize = chunk.v.size() / 3, vtsize = chunk.vt.size() / 2, vnsize = chunk.vn.size() / 3;
+  chunk.corners.push_back(fixIndexInChunk(fastAtoi(token, end), vsize, 0, pos, chunk.relatives));
+  chunk.corners.push_back(-1);
+  chunk.corners.push_back(-1);
+  skipToSpace(token, end, true);
+  if (charAt(token, end) != '/') {
+    return;
+  }
+  token++;
+
+  // i//k
+  if (charAt(token, end) == '/') {
+    token++;
+    chunk.corners[pos+2] = fixIndexInChunk(fastAtoi(token, end), vnsize, 2, pos+2, chunk.relatives);
+    skipToSpace(token, end, true);
+    return;
+  }
+
+  // i/j/k or i/j
+  chunk.corners[pos+1] = fixIndexInChunk(fastAtoi(token, end), vtsize, 1, pos+1, chunk.relatives);
+  skipToSpace(token, end, true);
+  if (charAt(token, end) != '/') {
+    return;
+  }
+
+  // i/j/k
+  token++;  // skip '/'
+  chunk.corners[pos+2] = fixIndexInChunk(fastAtoi(token, end), vnsize, 2, pos+2, chunk.relatives);
+  skipToSpace(token, end, true);
+}
+
+static void parseChunk(const char* begin, const char* end, obj_chunk& chunk)
+{
+  const char* line = begin;
+  while (line < end) {
+    const char* lineEnd = (const char*)memchr(line, '\n', end - line);
+    if (!lineEnd) lineEnd = end;
+    const char* next = lineEnd + 1;
+    // Trim '\r'
+    if (lineEnd > line && lineEnd[-1] == '\r') lineEnd--;
+
+    const char* token = line;
+    line = next;
+    skipSpace(token, lineEnd);
+
+    if (token == lineEnd) continue; // empty line
+    if (token[0] == '#') continue;  // comment line
+
+    char c1 = charAt(token + 1, lineEnd);
+    char c2 = charAt(token + 2, lineEnd);
+
+    // vertex
+    if (token[0] == 'v' && isSpace(c1)) {
+      token += 2;
+      chunk.v.push_back(parseFloat(token, lineEnd));
+      chunk.v.push_back(parseFloat(token, lineEnd));
+      chunk.v.push_back(parseFloat(token, lineEnd));
+      continue;
+    }
+
+    // normal
+    if (token[0] == 'v' && c1 == 'n' && isSpace(c2)) {
+      token += 3;
+      chunk.vn.push_back(parseFloat(token, lineEnd));
+      chunk.vn.push_back(parseFloat(token, lineEnd));
+      chunk.vn.push_back(parseFloat(token, lineEnd));
+      continue;
+    }
+
+    // texcoord
+    if (token[0] == 'v' && c1 == 't' && isSpace(c2)) {
+      token += 3;
+      chunk.vt.push_back(parseFloat(token, lineEnd));
+      chunk.vt.push_back(parseFloat(token, lineEnd));
+      continue;
+    }
+
+    // face
+    if (token[0] == 'f' && isSpace(c1)) {
+      token += 2;
+      skipSpace(token, lineEnd);
+      chunk.faceStarts.push_back(chunk.corners.size() / 3);
+      while (!isNewLine(charAt(token, lineEnd))) {
+        parseTripleInChunk(token, lineEnd, chunk);
+        skipSpaceOrCR(token, lineEnd);
+      }
+      continue;
+    }
+
+    obj_command command;
+    command.face = chunk.faceStarts.size();
+    size_t length = lineEnd - token;
+
+    // use mtl, load mtl
+    if (length > 6 && isSpace(token[6]) &&
+        (0 == strncmp(token, "usemtl", 6) || 0 == strncmp(token, "mtllib", 6))) {
+      command.type = (token[0] == 'u') ? obj_command::kUseMtl : obj_command::kMtlLib;
+      command.name = parseWord(token + 7, lineEnd);
+      chunk.commands.push_back(command);
+      continue;
+    }
+
+    // group name
+    if (token[0] == 'g' && isSpace(c1)) {
+      command.type = obj_command::kGroup;
+      token += 1;
+      skipSpaceOrCR(token, lineEnd);
+      const char* b = token;
+      skipToSpace(token, lineEnd);
+      command.name = std::string(b, token);
+      chunk.commands.push_back(command);
+      continue;
+    }
+
+    // object name
+    if (token[0] == 'o' && isSpace(c1)) {
+      command.type = obj_command::kObject;
+      command.name = parseWord(token + 2, lineEnd);
+      chunk.commands.push_back(command);
+      continue;
+    }
+
+    // Ignore unknown command.
+  }
+  chunk.faceStarts.push_back(chunk.corners.size() / 3);
+}
+
+// Open-addressing replacement for the std::map vertex cache.
+class vertex_hash_table {
+ public:
+  vertex_hash_table() : size_(0) { rehash(1024); }
+
+  // Returns a pointer to the value for key, inserting kEmpty if missing.
+  unsigned int* find(const vertex_index& key) {
+    if ((size_ + 1) * 2 > keys_.size()) rehash(keys_.size() * 2);
+    size_t mask = keys_.size() - 1;
+    size_t slot = hash(key) & mask;
+    while (values_[slot] != kEmpty) {
+      const vertex_index& k = keys_[slot];
+      if (k.v_idx == key.v_idx && k.vt_idx == key.vt_idx && k.vn_idx == key.vn_idx)
+        return &values_[slot];
+      slot = (slot + 1) & mask;
+    }
+    keys_[slot] = key;
+    size_++;
+    return &values_[slot];
+  }
+
+  static const unsigned int kEmpty = 0xffffffffu;
+
+ private:
+  static size_t hash(const vertex_index& k) {
+    unsigned long long h = (unsigned int)k.v_idx;
+    h = h * 0x9E3779B97F4A7C15ull + (unsigned int)k.vt_idx;
+    h = h * 0x9E3779B97F4A7C15ull + (unsigned int)k.vn_idx;
+    return (size_t)(h ^ (h >> 29));
+  }
+
+  void rehash(size_t capacity) {
+    std::vector<vertex_index> keys(capacity);
+    std::vector<unsigned int> values(capacity, kEmpty);
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < keys_.size(); i++) {
+      if (values_[i] == kEmpty) continue;
+      size_t slot = hash(keys_[i]) & mask;
+      while (values[slot] != kEmpty) slot = (slot + 1) & mask;
+      keys[slot] = keys_[i];
+      values[slot] = values_[i];
+    }
+    keys_.swap(keys);
+    values_.swap(values);
+  }
+
+  std::vector<vertex_index> keys_;
+  std::vector<unsigned int> values_;
+  size_t size_;
+};
+
+const unsigned int vertex_hash_table::kEmpty;
+
+// A run of faces [faceBegin, faceEnd) exported with one material.
+struct face_segment {
+  size_t faceBegin, faceEnd;
+  int material_id;
+};
+
+struct shape_segments {
+  std::string name;
+  std::vector<face_segment> segments;
+};
+
+// exportFaceGroupToShape() for all face groups of one shape at once.
+static void exportSegmentsToShape(
+  shape_t& shape,
+  const shape_segments& source,
+  const obj_chunk& all)
+{
+  vertex_hash_table vertexCache;
+  std::vector<float>& positions = shape.mesh.positions;
+  std::vector<float>& normals = shape.mesh.normals;
+  std::vector<float>& texcoords = shape.mesh.texcoords;
+
+  for (size_t s = 0; s < source.segments.size(); s++) {
+    const face_segment& segment = source.segments[s];
+    for (size_t f = segment.faceBegin; f < segment.faceEnd; f++) {
+      unsigned int cornerBegin = all.faceStarts[f];
+      unsigned int npolys = all.faceStarts[f+1] - cornerBegin;
+
+      // Polygon -> triangle fan conversion
+      for (unsigned int k = 2; k < npolys; k++) {
+        unsigned int corners[3] = { cornerBegin, cornerBegin + k - 1, cornerBegin + k };
+        for (int c = 0; c < 3; c++) {
+          const int* idx = &all.corners[corners[c] * 3];
+          vertex_index i(idx[0], idx[1], idx[2]);
+          unsigned int* cached = vertexCache.find(i);
+          if (*cached == vertex_hash_table::kEmpty) {
+            assert(all.v.size() > (unsigned int) (3*i.v_idx+2));
+            positions.push_back(all.v[3*i.v_idx+0]);
+            positions.push_back(all.v[3*i.v_idx+1]);
+            positions.push_back(all.v[3*i.v_idx+2]);
+            if (i.vn_idx >= 0) {
+              normals.push_back(all.vn[3*i.vn_idx+0]);
+              normals.push_back(all.vn[3*i.vn_idx+1]);
+              normals.push_back(all.vn[3*i.vn_idx+2]);
+            }
+            if (i.vt_idx >= 0) {
+              texcoords.push_back(all.vt[2*i.vt_idx+0]);
+              texcoords.push_back(all.vt[2*i.vt_idx+1]);
+            }
+            *cached = positions.size() / 3 - 1;
+          }
+          shape.mesh.indices.push_back(*cached);
+        }
+        shape.mesh.material_ids.push_back(segment.material_id);
+      }
+    }
+  }
+  shape.name = source.name;
+}
+
+std::string
+LoadObjMapped(
+  std::vector<shape_t>& shapes,
+  std::vector<material_t>& materials,   // [output]
+  const char* filename,
+  const char* mtl_basepath)
+{
+
+  shapes.clear();
+
+  std::stringstream err;
+
+  STMappedFile file;
+  if (!file.Open(filename)) {
+    err << "Cannot open file [" << filename << "]" << std::endl;
+    return err.str();
+  }
+
+  std::string basePath;
+  if (mtl_basepath) {
+    basePath = mtl_basepath;
+  }
+  MaterialFileReader matFileReader( basePath );
+
+  return LoadObjFromMemory(shapes, materials, file.GetData(), file.GetSize(), matFileReader);
+}
+
+std::string LoadObjFromMemory(
+  std::vector<shape_t>& shapes,
+  std::vector<material_t>& materials,   // [output]
+  const char* data,
+  size_t size,
+  MaterialReader& readMatFn)
+{
+  const size_t kMinChunkSize = 1 << 18;
+
+  // Split at line starts, one chunk per thread.
+  size_t numChunks = STGetNumThreads();
+  if (numChunks > size / kMinChunkSize + 1) numChunks = size / kMinChunkSize + 1;
+  std::vector<size_t> starts(numChunks + 1, size);
+  starts[0] = 0;
+  for (size_t i = 1; i < numChunks; i++) {
+    size_t pos = (std::max)(size * i / numChunks, starts[i-1]);
+    const char* newline = (const char*)memchr(data + pos, '\n', size - pos);
+    starts[i] = newline ? (newline - data) + 1 : size;
+  }
+
+  std::vector<obj_chunk> chunks(numChunks);
+  STParallelFor(0, numChunks, [&](size_t begin, size_t end, size_t) {
+    for (size_t i = begin; i < end; i++)
+      parseChunk(data + starts[i], data + starts[i+1], chunks[i]);
+  }, 1);
+
+  // Concatenate the chunks into one, fixing up relative indices.
+  std::vector<size_t> vOffset(numChunks + 1, 0), vnOffset(numChunks + 1, 0), vtOffset(numChunks + 1, 0);
+  std::vector<size_t> cornerOffset(numChunks + 1, 0), faceOffset(numChunks + 1, 0);
+  for (size_t i = 0; i < numChunks; i++) {
+    vOffset[i+1] = vOffset[i] + chunks[i].v.size();
+    vnOffset[i+1] = vnOffset[i] + chunks[i].vn.size();
+    vtOffset[i+1] = vtOffset[i] + chunks[i].vt.size();
+    cornerOffset[i+1] = cornerOffset[i] + chunks[i].corners.size();
+    faceOffset[i+1] = faceOffset[i] + chunks[i].faceStarts.size() - 1;
+  }
+  obj_chunk all;
+  all.v.resize(vOffset[numChunks]);
+  all.vn.resize(vnOffset[numChunks]);
+  all.vt.resize(vtOffset[numChunks]);
+  all.corners.resize(cornerOffset[numChunks]);
+  all.faceStarts.resize(faceOffset[numChunks] + 1);
+  all.faceStarts[faceOffset[numChunks]] = cornerOffset[numChunks] / 3;
+  STParallelFor(0, numChunks, [&](size_t begin, size_t end, size_t) {
+    for (size_t i = begin; i < end; i++) {
+      obj_chunk& chunk = chunks[i];
+      for (size_t r = 0; r < chunk.relatives.size(); r++) {
+        const relative_index& rel = chunk.relatives[r];
+        size_t offset = rel.kind == 0 ? vOffset[i] / 3 : (rel.kind == 1 ? vtOffset[i] / 2 : vnOffset[i] / 3);
+        chunk.corners[rel.pos] = (int)(offset + rel.local);
+      }
+      std::copy(chunk.v.begin(), chunk.v.end(), all.v.begin() + vOffset[i]);
+      std::copy(chunk.vn.begin(), chunk.vn.end(), all.vn.begin() + vnOffset[i]);
+      std::copy(chunk.vt.begin(), chunk.vt.end(), all.vt.begin() + vtOffset[i]);
+      std::copy(chunk.corners.begin(), chunk.corners.end(), all.corners.begin() + cornerOffset[i]);
+      for (size_t f = 0; f + 1 < chunk.faceStarts.size(); f++)
+        all.faceStarts[faceOffset[i] + f] = chunk.faceStarts[f] + cornerOffset[i] / 3;
+      std::vector<float>().swap(chunk.v);
+      std::vector<float>().swap(chunk.vn);
+      std::vector<float>().swap(chunk.vt);
+      std::vector<int>().swap(chunk.corners);
+    }
+  }, 1);
+
+  // Replay the commands in file order to cut the faces into shapes.
+  std::map<std::string, int> material_map;
+  int material = -1;
+  std::string name;
+  std::string err;
+  std::vector<shape_segments> found;
+  shape_segments shape;
+  size_t groupBegin = 0;
+  bool failed = false;
+  for (size_t i = 0; i < numChunks && !failed; i++) {
+    for (size_t c = 0; c < chunks[i].commands.size(); c++) {
+      const obj_command& command = chunks[i].commands[c];
+      size_t face = faceOffset[i] + command.face;
+      face_segment segment = { groupBegin, face, material };
+
+      if (command.type == obj_command::kUseMtl) {
+        if (face > groupBegin) shape.segments.push_back(segment);
+        groupBegin = face;
+        std::map<std::string, int>::iterator it = material_map.find(command.name);
+        material = (it != material_map.end()) ? it->second : -1;
+      } else if (command.type == obj_command::kMtlLib) {
+        err = readMatFn(command.name, materials, material_map);
+        if (!err.empty()) {
+          failed = true;
+          break;
+        }
+      } else {
+        // flush previous face group.
+        if (face > groupBegin) {
+          shape.segments.push_back(segment);
+          shape.name = name;
+          found.push_back(shape);
+        }
+        shape = shape_segments();
+        groupBegin = face;
+        name = command.name;
+      }
+    }
+  }
+  if (!failed && faceOffset[numChunks] > groupBegin) {
+    face_segment segment = { groupBegin, faceOffset[numChunks], material };
+    shape.segments.push_back(segment);
+    shape.name = name;
+    found.push_back(shape);
+  }
+
+  shapes.resize(found.size());
+  STParallelFor(0, found.size(), [&](size_t begin, size_t end, size_t) {
+    for (size_t i = begin; i < end; i++)
+      exportSegmentsToShape(shapes[i], found[i], all);
+  }, 1);
+
+  return err;
+}
+
 }